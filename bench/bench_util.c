@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "bench_util.h"
+
+/* Syscalls issued by this process */
+static uint64_t syscall_count = 0;
+
+/* Provided by the linker when built with -Wl,--wrap=syscall */
+long __real_syscall(long number, ...);
+
+/** Count and forward every syscall(2) call */
+long __wrap_syscall(long number, ...) {
+    va_list ap;
+    long a[6];
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++)
+        a[i] = va_arg(ap, long);
+    va_end(ap);
+    syscall_count++;
+    return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+uint64_t bench_syscall_count(void) {
+    return syscall_count;
+}
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void* bench_shared_alloc(size_t sz) {
+    void* p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return p;
+}
+
+void bench_shared_free(void* p, size_t sz) {
+    munmap(p, sz);
+}
+
+uint64_t bench_run_procs(int nprocs, bench_proc_fn fn, void* arg) {
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < nprocs; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            fn(i, nprocs, arg);
+            _exit(0);
+        }
+        else if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < nprocs; i++) {
+        int status;
+        wait(&status);
+    }
+    return bench_now_ns() - start;
+}
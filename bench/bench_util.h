@@ -0,0 +1,43 @@
+/**
+ * Helpers shared by the micro benchmarks: timing, syscall counting and
+ * running a function in several forked processes.
+ */
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Per process body run by bench_run_procs */
+typedef void (*bench_proc_fn)(int rank, int nprocs, void* arg);
+
+/** @return a monotonic timestamp in nanoseconds */
+uint64_t bench_now_ns(void);
+
+/**
+ * @return the number of syscall(2) invocations made by this process.
+ * Only counts when the executable is linked with -Wl,--wrap=syscall.
+ */
+uint64_t bench_syscall_count(void);
+
+/** @return zero-filled memory shared with forked children */
+void* bench_shared_alloc(size_t sz);
+
+/** Release memory from bench_shared_alloc */
+void bench_shared_free(void* p, size_t sz);
+
+/**
+ * Run fn in nprocs forked processes and wait for them all.
+ * @return the wall clock time in nanoseconds from fork to the last exit
+ */
+uint64_t bench_run_procs(int nprocs, bench_proc_fn fn, void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * Barrier latency for shmbarrier_t against polling a shared counter.
+ *
+ * The "poll" rows are the pattern shmbarrier_t replaces: every rank
+ * increments a counter and polls shmcounter_value until all ranks of the
+ * phase have arrived. The "barrier" rows use shmbarrier_arrive_and_wait.
+ * Each rank runs the same number of phases; the time per phase and the
+ * syscalls per phase summed over all ranks are reported.
+ *
+ * Usage: shm_barrier_bench [phases]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_barrier.h"
+
+/** Shared state for a run */
+typedef struct bench_state {
+    const char* setname;
+    bool poll;
+    long phases;
+    uint64_t syscalls[256];
+} bench_state_t;
+
+/* Synchronize phases by polling a counter */
+static void poll_loop(shmcounter_t* sc, int nprocs, long phases) {
+    for (long i = 1; i <= phases; i++) {
+        shmcounter_inc_safe(sc, 1);
+        while (shmcounter_value(sc) < i * nprocs)
+            ;
+    }
+}
+
+static void barrier_loop(int rank, int nprocs, void* arg) {
+    bench_state_t* st = arg;
+    shmcounter_uid_t id = {.group = 1, .ctype = 1, .tag = 1, .lid = 1};
+    shmcounter_set_t scs;
+    shmcounter_set_create(&scs, st->setname);
+
+    uint64_t before = bench_syscall_count();
+    if (st->poll) {
+        shmcounter_t sc;
+        shmcounter_create(&sc, &scs, id);
+        before = bench_syscall_count();
+        poll_loop(&sc, nprocs, st->phases);
+        st->syscalls[rank] = bench_syscall_count() - before;
+        shmcounter_destroy(&sc);
+    } else {
+        shmbarrier_t sb;
+        shmbarrier_create(&sb, &scs, id, nprocs);
+        before = bench_syscall_count();
+        for (long i = 0; i < st->phases; i++)
+            shmbarrier_arrive_and_wait(&sb);
+        st->syscalls[rank] = bench_syscall_count() - before;
+        shmbarrier_destroy(&sb);
+    }
+    shmcounter_set_destroy(&scs);
+}
+
+int main(int argc, char** argv) {
+    long phases = (argc > 1) ? atol(argv[1]) : 2000;
+    int procs[] = {2, 4, 8, 16, 32, 64, 128};
+    const char* setname = "/shm_barrier_bench";
+    bench_state_t* st = bench_shared_alloc(sizeof(bench_state_t));
+
+    printf("%-8s %6s %14s %16s\n", "sync", "procs", "ns/phase", "syscalls/phase");
+    for (int poll = 1; poll >= 0; poll--) {
+        for (size_t p = 0; p < sizeof(procs) / sizeof(procs[0]); p++) {
+            int nprocs = procs[p];
+            memset(st, 0, sizeof(bench_state_t));
+            st->setname = setname;
+            st->poll = poll;
+            /* Polling ranks burn their whole time slice when oversubscribed */
+            st->phases = (poll && phases >= 100) ? phases / 100 : phases;
+            shm_unlink(setname);
+
+            /* Keep the set alive while ranks come and go */
+            shmcounter_set_t scs;
+            shmcounter_set_create(&scs, setname);
+            uint64_t ns = bench_run_procs(nprocs, barrier_loop, st);
+            shmcounter_set_destroy(&scs);
+
+            uint64_t syscalls = 0;
+            for (int r = 0; r < nprocs; r++)
+                syscalls += st->syscalls[r];
+            printf("%-8s %6d %14.0f %16.2f\n", poll ? "poll" : "barrier", nprocs,
+                   (double)ns / st->phases, (double)syscalls / st->phases);
+            fflush(stdout);
+        }
+    }
+    bench_shared_free(st, sizeof(bench_state_t));
+    return 0;
+}
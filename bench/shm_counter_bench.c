@@ -0,0 +1,107 @@
+/**
+ * Counter increment throughput as processes are added.
+ *
+ * The "locked" rows use a copy of the original increment, which shares the
+ * counter set lock and takes a mutex of the counter's own, as the before
+ * baseline (counters no longer carry one, so the bench keeps them aside);
+ * the "atomic" rows use shmcounter_inc_safe. In the "private" rows every
+ * process increments its own counter, which should scale with the number
+ * of CPUs; in the "shared" rows all processes increment one counter. The
+ * "sharded" rows increment one counter made with shmcounter_create_sharded.
+ *
+ * Usage: shm_counter_bench [total iterations]
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_counter.h"
+
+/** Shared state for a run */
+typedef struct bench_state {
+    const char* setname;
+    int mode;
+    bool shared;
+    long iters;
+} bench_state_t;
+
+/** Increment implementations compared */
+enum { BENCH_LOCKED, BENCH_ATOMIC, BENCH_SHARDED, BENCH_MODES };
+static const char* bench_mode_names[] = {"locked", "atomic", "sharded"};
+
+/** Per counter mutexes of the original increment, indexed by slot, shared with the children */
+static shmmutex_t* bench_mutexes;
+
+/* The original increment: share the set lock, then lock the counter */
+static void locked_inc(shmcounter_t* sc, int val) {
+    shmvector_lock_shared(sc->set->v);
+    shmmutex_lock(&bench_mutexes[sc->idx]);
+    sc->hot->count += val;
+    shmmutex_unlock(&bench_mutexes[sc->idx]);
+    shmvector_unlock_shared(sc->set->v);
+}
+
+static void inc_loop(int rank, int nprocs, void* arg) {
+    bench_state_t* st = arg;
+    shmcounter_uid_t id = {.group = 1, .ctype = 1, .tag = 1, .lid = st->shared ? 0 : rank};
+    shmcounter_set_t scs;
+    shmcounter_t sc;
+    shmcounter_set_create(&scs, st->setname);
+    if (BENCH_SHARDED == st->mode)
+        shmcounter_create_sharded(&sc, &scs, id);
+    else
+        shmcounter_create(&sc, &scs, id);
+    for (long i = 0; i < st->iters; i++) {
+        if (BENCH_LOCKED == st->mode)
+            locked_inc(&sc, 1);
+        else
+            shmcounter_inc_safe(&sc, 1);
+    }
+    shmcounter_destroy(&sc);
+    shmcounter_set_destroy(&scs);
+}
+
+int main(int argc, char** argv) {
+    long iters = (argc > 1) ? atol(argv[1]) : 4000000;
+    int procs[] = {1, 2, 4, 8, 16, 32, 64};
+    const char* setname = "/shm_counter_bench";
+    bench_state_t* st = bench_shared_alloc(sizeof(bench_state_t));
+    bench_mutexes = bench_shared_alloc(SHMCOUNTER_SET_SIZE * sizeof(shmmutex_t));
+    for (int i = 0; i < SHMCOUNTER_SET_SIZE; i++)
+        shmmutex_create(&bench_mutexes[i]);
+
+    printf("%-8s %-8s %6s %12s %14s\n", "inc", "counters", "procs", "ns/op", "ops/s");
+    for (int shared = 0; shared <= 1; shared++) {
+        for (int mode = 0; mode < BENCH_MODES; mode++) {
+            /* Every private counter would need its own shard block */
+            if (BENCH_SHARDED == mode && !shared)
+                continue;
+            for (size_t p = 0; p < sizeof(procs) / sizeof(procs[0]); p++) {
+                int nprocs = procs[p];
+                memset(st, 0, sizeof(bench_state_t));
+                st->setname = setname;
+                st->mode = mode;
+                st->shared = shared;
+                st->iters = iters / nprocs;
+                shm_unlink(setname);
+
+                shmcounter_set_t scs;
+                shmcounter_set_create(&scs, setname);
+                uint64_t ns = bench_run_procs(nprocs, inc_loop, st);
+                shmcounter_set_destroy(&scs);
+
+                long ops = st->iters * nprocs;
+                printf("%-8s %-8s %6d %12.1f %14.0f\n", bench_mode_names[mode],
+                       shared ? "shared" : "private", nprocs, (double)ns / ops, ops * 1e9 / ns);
+                fflush(stdout);
+            }
+        }
+    }
+    bench_shared_free(bench_mutexes, SHMCOUNTER_SET_SIZE * sizeof(shmmutex_t));
+    bench_shared_free(st, sizeof(bench_state_t));
+    return 0;
+}
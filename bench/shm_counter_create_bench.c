@@ -0,0 +1,121 @@
+/**
+ * Counter lookup and churn cost as a counter set fills up.
+ *
+ * The set is filled to 10%, 50% and 95% of SHMCOUNTER_SET_SIZE. The
+ * "lookup" column is shmcounter_create followed by shmcounter_destroy of an
+ * id that already exists, which only moves its refcount; the "churn" column
+ * is the same for an id that does not exist, so the counter is inserted and
+ * deleted again. The "legacy" rows use a copy of the original linear uid
+ * scan with shmvector_find_first_of as the before baseline; the "hash" rows
+ * use the hash index of shmcounter_create.
+ *
+ * Usage: shm_counter_create_bench [operations per row]
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_counter.h"
+
+static int legacy_uidcmp(void* lhs, void* rhs) {
+    shmcounter_uid_t* l = lhs;
+    shmcounter_data_t* r = rhs;
+    return !(l->group == r->id.group && l->ctype == r->id.ctype &&
+             l->tag == r->id.tag && l->lid == r->id.lid);
+}
+
+/* The original create: scan the set for the id, insert it at the first free slot */
+static int legacy_create(shmcounter_t* sc, shmcounter_set_t* scs, shmcounter_uid_t cid) {
+    shmvector_lock(scs->v);
+    int idx = shmvector_find_first_of(scs->v, &cid, legacy_uidcmp);
+    if (idx < 0) {
+        idx = shmvector_insert_quick(scs->v);
+        if (idx >= 0) {
+            shmcounter_data_t* slot = shmvector_at(scs->v, idx);
+            shmcounter_data_t d = {.id = cid, .refcount = 0};
+            *slot = d;
+        }
+    }
+    if (idx >= 0)
+        ((shmcounter_data_t*)shmvector_at(scs->v, idx))->refcount++;
+    shmvector_unlock(scs->v);
+    sc->idx = idx;
+    sc->set = scs;
+    return (idx < 0);
+}
+
+static void legacy_destroy(shmcounter_t* sc) {
+    shmvector_lock(sc->set->v);
+    shmcounter_data_t* cd = shmvector_at(sc->set->v, sc->idx);
+    if (0 == --cd->refcount) {
+        memset(cd, 0, sizeof(shmcounter_data_t));
+        shmvector_del(sc->set->v, sc->idx);
+    }
+    shmvector_unlock(sc->set->v);
+}
+
+static int bench_create(bool legacy, shmcounter_t* sc, shmcounter_set_t* scs,
+                        shmcounter_uid_t cid) {
+    return legacy ? legacy_create(sc, scs, cid) : shmcounter_create(sc, scs, cid);
+}
+
+static void bench_destroy(bool legacy, shmcounter_t* sc) {
+    if (legacy)
+        legacy_destroy(sc);
+    else
+        shmcounter_destroy(sc);
+}
+
+/* Ids look like those of a collective library: few groups, sequential local ids */
+static shmcounter_uid_t bench_uid(uint64_t n) {
+    shmcounter_uid_t id = {.group = 1 + n % 4, .ctype = 2, .tag = n % 16, .lid = n};
+    return id;
+}
+
+int main(int argc, char** argv) {
+    long ops = (argc > 1) ? atol(argv[1]) : 200000;
+    int occupancy[] = {10, 50, 95};
+    const char* setname = "/shm_counter_create_bench";
+    shmcounter_t* held = malloc(SHMCOUNTER_SET_SIZE * sizeof(shmcounter_t));
+
+    printf("%-8s %9s %14s %14s\n", "index", "occupancy", "lookup ns/op", "churn ns/op");
+    for (int legacy = 1; legacy >= 0; legacy--) {
+        for (size_t o = 0; o < sizeof(occupancy) / sizeof(occupancy[0]); o++) {
+            size_t filled = SHMCOUNTER_SET_SIZE * occupancy[o] / 100;
+            shm_unlink(setname);
+            shmcounter_set_t scs;
+            shmcounter_set_create(&scs, setname);
+            for (size_t i = 0; i < filled; i++)
+                bench_create(legacy, &held[i], &scs, bench_uid(i));
+
+            shmcounter_t sc;
+            uint64_t start = bench_now_ns();
+            for (long i = 0; i < ops; i++) {
+                bench_create(legacy, &sc, &scs, bench_uid(i % filled));
+                bench_destroy(legacy, &sc);
+            }
+            uint64_t lookup_ns = bench_now_ns() - start;
+
+            /* New ids never seen before, so each one is inserted and removed */
+            start = bench_now_ns();
+            for (long i = 0; i < ops; i++) {
+                bench_create(legacy, &sc, &scs, bench_uid(SHMCOUNTER_SET_SIZE + i));
+                bench_destroy(legacy, &sc);
+            }
+            uint64_t churn_ns = bench_now_ns() - start;
+
+            printf("%-8s %8d%% %14.1f %14.1f\n", legacy ? "legacy" : "hash", occupancy[o],
+                   (double)lookup_ns / ops, (double)churn_ns / ops);
+            fflush(stdout);
+
+            for (size_t i = 0; i < filled; i++)
+                bench_destroy(legacy, &held[i]);
+            shmcounter_set_destroy(&scs);
+        }
+    }
+    free(held);
+    return 0;
+}
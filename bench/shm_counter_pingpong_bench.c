@@ -0,0 +1,129 @@
+/**
+ * Cache line ping-pong between two unrelated counters.
+ *
+ * Two processes each increment their own counter, and the counters sit in
+ * neighbouring slots of a counter set. The "legacy" rows use a copy of the
+ * original 48 byte slot (mutex, uid, refcount and count), where the counts
+ * of neighbouring counters share a cache line, as the before baseline. The
+ * "packed" rows use the default layout, where counts sit side by side in
+ * <set name>.counts, and the "padded" rows a set with
+ * SHMCOUNTER_LAYOUT_PADDED, where each count has a cache line of its own. The "same line" column tells whether a write to
+ * one count invalidates the line holding the other.
+ *
+ * Usage: shm_counter_pingpong_bench [iterations per process]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_counter.h"
+
+/** The original counter slot */
+typedef struct legacy_data {
+    uint32_t mutex;
+    uint32_t pad;
+    shmcounter_uid_t id;
+    uint32_t refcount;
+    int count;
+} legacy_data_t;
+
+/** Layouts compared */
+enum { BENCH_LEGACY, BENCH_PACKED, BENCH_PADDED, BENCH_LAYOUTS };
+static const char* bench_layout_names[] = {"legacy", "packed", "padded"};
+
+/** Shared state for a run */
+typedef struct bench_state {
+    const char* setname;
+    int layout;
+    shmcounter_uid_t ids[2];
+    legacy_data_t legacy[5];
+    int lfirst;
+    long iters;
+} bench_state_t;
+
+static void inc_loop(int rank, int nprocs, void* arg) {
+    bench_state_t* st = arg;
+    if (BENCH_LEGACY == st->layout) {
+        for (long i = 0; i < st->iters; i++)
+            __atomic_fetch_add(&st->legacy[st->lfirst + rank].count, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    shmcounter_set_t scs;
+    shmcounter_t sc;
+    shmcounter_set_create(&scs, st->setname);
+    shmcounter_create(&sc, &scs, st->ids[rank]);
+    for (long i = 0; i < st->iters; i++)
+        shmcounter_inc_safe(&sc, 1);
+    shmcounter_destroy(&sc);
+    shmcounter_set_destroy(&scs);
+}
+
+/** Remove the segments of a set left by an earlier run */
+static void unlink_set(const char* setname) {
+    const char* suffixes[] = {"", ".counts", ".hot", ".shards"};
+    char name[256];
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        snprintf(name, sizeof(name), "%s%s", setname, suffixes[i]);
+        shm_unlink(name);
+    }
+}
+
+/** @return the cache line holding a count */
+static uintptr_t count_line(const void* count) {
+    return (uintptr_t)count / SHMVECTOR_CACHELINE;
+}
+
+int main(int argc, char** argv) {
+    long iters = (argc > 1) ? atol(argv[1]) : 10000000;
+    const char* setname = "/shm_counter_pingpong_bench";
+    bench_state_t* st = bench_shared_alloc(sizeof(bench_state_t));
+
+    printf("%-8s %10s %12s %14s\n", "layout", "same line", "ns/op", "ops/s");
+    for (int layout = 0; layout < BENCH_LAYOUTS; layout++) {
+        memset(st, 0, sizeof(bench_state_t));
+        st->setname = setname;
+        st->layout = layout;
+        st->iters = iters;
+        unlink_set(setname);
+
+        /* Counters are placed by uid hash: look for a second counter in the
+           slot after the first one */
+        shmcounter_set_t scs;
+        shmcounter_t sc[2];
+        shmcounter_set_create_layout(&scs, setname, NULL, (BENCH_PADDED == layout) ?
+                                     SHMCOUNTER_LAYOUT_PADDED : SHMCOUNTER_LAYOUT_PACKED);
+        st->ids[0] = (shmcounter_uid_t){.group = 1, .ctype = 1, .tag = 1, .lid = 0};
+        shmcounter_create(&sc[0], &scs, st->ids[0]);
+        for (uint64_t lid = 1;; lid++) {
+            st->ids[1] = (shmcounter_uid_t){.group = 1, .ctype = 1, .tag = 1, .lid = lid};
+            shmcounter_create(&sc[1], &scs, st->ids[1]);
+            if (sc[1].idx == sc[0].idx + 1)
+                break;
+            shmcounter_destroy(&sc[1]);
+        }
+        /* Some pair of neighbouring legacy slots has its counts on one line */
+        for (st->lfirst = 0; st->lfirst < 4; st->lfirst++) {
+            if (count_line(&st->legacy[st->lfirst].count) ==
+                count_line(&st->legacy[st->lfirst + 1].count))
+                break;
+        }
+        int same = (BENCH_LEGACY == layout) ?
+            count_line(&st->legacy[st->lfirst].count) ==
+            count_line(&st->legacy[st->lfirst + 1].count) :
+            count_line(&sc[0].hot->count) == count_line(&sc[1].hot->count);
+
+        uint64_t ns = bench_run_procs(2, inc_loop, st);
+        printf("%-8s %10s %12.2f %14.0f\n", bench_layout_names[layout], same ? "yes" : "no",
+               (double)ns / iters, 2 * iters * 1e9 / ns);
+        fflush(stdout);
+
+        shmcounter_destroy(&sc[1]);
+        shmcounter_destroy(&sc[0]);
+        shmcounter_set_destroy(&scs);
+    }
+    bench_shared_free(st, sizeof(bench_state_t));
+    return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * Lock/unlock throughput and syscalls per operation for shmmutex_t.
+ *
+ * The "legacy" rows use a copy of the original two-state protocol, which
+ * issues FUTEX_WAKE on every unlock, as the before baseline. The other
+ * rows exercise each SHMMUTEX_TYPE_*; "futex+stat" adds the cost of
+ * recording contention statistics. Every acquisition is timed and the
+ * 99th percentile wait is reported to expose unfair handoff.
+ *
+ * Usage: shm_mutex_bench [total iterations]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "bench_util.h"
+#include "shm_mutex.h"
+
+/** Lock implementation under test */
+typedef struct bench_lock_impl {
+    const char* name;
+    uint32_t type;
+    int (*lock)(shmmutex_t*);
+    int (*unlock)(shmmutex_t*);
+    /* Record contention statistics */
+    bool stats;
+} bench_lock_impl_t;
+
+/** Shared state for a run */
+typedef struct bench_state {
+    shmmutex_t lock;
+    shmmutex_stats_t stats;
+    const bench_lock_impl_t* impl;
+    long iters;
+    long counter;
+    uint64_t syscalls[256];
+    /* Acquisition latency of every operation, nprocs * iters entries */
+    uint32_t* wait_ns;
+} bench_state_t;
+
+/* The original two-state lock, which always wakes on unlock */
+static int legacy_lock(shmmutex_t *sm) {
+    while (1) {
+        uint32_t avail = SHMMUTEX_LOCK_AVAILABLE;
+        if (atomic_compare_exchange_strong(&(sm->val), &avail, SHMMUTEX_LOCK_TAKEN))
+            break;
+        syscall(SYS_futex, &sm->val, FUTEX_WAIT, SHMMUTEX_LOCK_TAKEN, NULL, NULL, 0);
+    }
+    return 0;
+}
+
+static int legacy_unlock(shmmutex_t *sm) {
+    uint32_t taken = SHMMUTEX_LOCK_TAKEN;
+    if (atomic_compare_exchange_strong(&(sm->val), &taken, SHMMUTEX_LOCK_AVAILABLE))
+        syscall(SYS_futex, &sm->val, FUTEX_WAKE, SHMMUTEX_LOCK_AVAILABLE, NULL, NULL, 0);
+    return 0;
+}
+
+static const bench_lock_impl_t impls[] = {
+    {"legacy", SHMMUTEX_TYPE_FUTEX, legacy_lock, legacy_unlock},
+    {"futex", SHMMUTEX_TYPE_FUTEX, shmmutex_lock, shmmutex_unlock},
+#ifdef SHMMUTEX_STATS
+    {"futex+stat", SHMMUTEX_TYPE_FUTEX, shmmutex_lock, shmmutex_unlock, true},
+#endif
+    {"spin", SHMMUTEX_TYPE_SPIN, shmmutex_lock, shmmutex_unlock},
+    {"adaptive", SHMMUTEX_TYPE_ADAPTIVE, shmmutex_lock, shmmutex_unlock},
+    {"ticket", SHMMUTEX_TYPE_TICKET, shmmutex_lock, shmmutex_unlock},
+    {"pi", SHMMUTEX_TYPE_PI, shmmutex_lock, shmmutex_unlock},
+};
+
+/* Lock, bump a shared counter, unlock */
+static void lock_loop(int rank, int nprocs, void* arg) {
+    bench_state_t* st = arg;
+    uint32_t* wait_ns = st->wait_ns + rank * st->iters;
+    uint64_t before = bench_syscall_count();
+    for (long i = 0; i < st->iters; i++) {
+        uint64_t start = bench_now_ns();
+        st->impl->lock(&st->lock);
+        wait_ns[i] = bench_now_ns() - start;
+        st->counter++;
+        st->impl->unlock(&st->lock);
+    }
+    st->syscalls[rank] = bench_syscall_count() - before;
+}
+
+static int cmp_u32(const void* l, const void* r) {
+    uint32_t a = *(const uint32_t*)l, b = *(const uint32_t*)r;
+    return (a > b) - (a < b);
+}
+
+int main(int argc, char** argv) {
+    long iters = (argc > 1) ? atol(argv[1]) : 1000000;
+    int procs[] = {1, 2, 8, 32, 64};
+    bench_state_t* st = bench_shared_alloc(sizeof(bench_state_t));
+    uint32_t* wait_ns = bench_shared_alloc(iters * sizeof(uint32_t));
+
+    printf("%-10s %6s %12s %12s %14s %12s\n", "lock", "procs", "ns/op", "ops/s", "syscalls/op", "p99 wait ns");
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        for (size_t p = 0; p < sizeof(procs) / sizeof(procs[0]); p++) {
+            int nprocs = procs[p];
+            memset(st, 0, sizeof(bench_state_t));
+            if (impls[i].stats)
+                shmmutex_stats_attach(&st->lock, &st->stats);
+            shmmutex_create_type(&st->lock, impls[i].type);
+            st->impl = &impls[i];
+            st->iters = iters / nprocs;
+            st->wait_ns = wait_ns;
+
+            uint64_t ns = bench_run_procs(nprocs, lock_loop, st);
+            long ops = st->iters * nprocs;
+            uint64_t syscalls = 0;
+            for (int r = 0; r < nprocs; r++)
+                syscalls += st->syscalls[r];
+            if (st->counter != ops)
+                fprintf(stderr, "ERROR: %s lost updates (%ld != %ld)\n", impls[i].name, st->counter, ops);
+
+            qsort(wait_ns, ops, sizeof(uint32_t), cmp_u32);
+
+            printf("%-10s %6d %12.1f %12.0f %14.4f %12u\n", impls[i].name, nprocs,
+                   (double)ns / ops, ops * 1e9 / ns, (double)syscalls / ops,
+                   wait_ns[(size_t)(ops * 0.99)]);
+            fflush(stdout);
+        }
+    }
+    bench_shared_free(wait_ns, iters * sizeof(uint32_t));
+    bench_shared_free(st, sizeof(bench_state_t));
+    return 0;
+}
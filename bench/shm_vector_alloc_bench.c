@@ -0,0 +1,86 @@
+/**
+ * Slot allocation cost of shmvector_insert_quick under churn.
+ *
+ * The vector is filled to 50%, 90% and 99% of its capacity so that
+ * next_back_idx has reached the capacity, then a random element is deleted
+ * and a new one allocated, repeatedly. The "legacy" rows allocate with a
+ * copy of the original linear scan of the actives array as the before
+ * baseline, over a bool per slot kept beside the vector as the original
+ * actives array was; the "stack" rows use insert_quick, which pops the
+ * free slot stack.
+ *
+ * Usage: shm_vector_alloc_bench [operations per row] [capacity]
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_vector.h"
+
+/* The original bool per slot actives array */
+static bool* legacy_actives;
+
+/* The original insert_quick search once the back of the vector is used */
+static int legacy_insert_quick(shmvector_t* sv) {
+    long zero = 0;
+    for (size_t i = 0; i < sv->shm->capacity; i++) {
+        if (!legacy_actives[i]) {
+            legacy_actives[i] = true;
+            return shmvector_insert_at(sv, i, &zero);
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    long ops = (argc > 1) ? atol(argv[1]) : 100000;
+    size_t capacity = (argc > 2) ? atol(argv[2]) : 65536;
+    int occupancy[] = {50, 90, 99};
+    const char* segname = "/shm_vector_alloc_bench";
+    int* held = malloc(capacity * sizeof(int));
+    legacy_actives = malloc(capacity * sizeof(bool));
+
+    printf("%-8s %9s %14s\n", "alloc", "occupancy", "ns/op");
+    for (int legacy = 1; legacy >= 0; legacy--) {
+        for (size_t o = 0; o < sizeof(occupancy) / sizeof(occupancy[0]); o++) {
+            size_t filled = capacity * occupancy[o] / 100;
+            shm_unlink(segname);
+            shmvector_t sv;
+            shmvector_create(&sv, segname, sizeof(long), capacity);
+
+            /* Use the whole vector once, then free slots at random */
+            shmvector_lock(&sv);
+            for (size_t i = 0; i < capacity; i++)
+                held[i] = shmvector_insert_quick(&sv);
+            memset(legacy_actives, true, capacity * sizeof(bool));
+            srand(1);
+            for (size_t n = capacity; n > filled; n--) {
+                size_t r = rand() % n;
+                shmvector_del(&sv, held[r]);
+                legacy_actives[held[r]] = false;
+                held[r] = held[n - 1];
+            }
+
+            uint64_t start = bench_now_ns();
+            for (long i = 0; i < ops; i++) {
+                size_t r = rand() % filled;
+                shmvector_del(&sv, held[r]);
+                legacy_actives[held[r]] = false;
+                held[r] = legacy ? legacy_insert_quick(&sv) : shmvector_insert_quick(&sv);
+            }
+            uint64_t ns = bench_now_ns() - start;
+            shmvector_unlock(&sv);
+
+            printf("%-8s %8d%% %14.1f\n", legacy ? "legacy" : "stack", occupancy[o],
+                   (double)ns / ops);
+            fflush(stdout);
+            shmvector_destroy(&sv);
+        }
+    }
+    free(legacy_actives);
+    free(held);
+    return 0;
+}
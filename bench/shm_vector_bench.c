@@ -0,0 +1,183 @@
+/**
+ * Reader and writer throughput for the shmarray_t header layout.
+ *
+ * Writers repeatedly take the segment lock and delete and re-insert an
+ * element, which updates the lock word and active_count. Readers run
+ * bounds-checked at() on the first elements without the lock until the
+ * writers finish. The "legacy" rows use a copy of the original packed
+ * header, where the lock, the counters, the geometry and element 0 share
+ * cache lines, as the before baseline; the "aligned" rows use shmvector_t.
+ *
+ * Usage: shm_vector_bench [writer iterations]
+ */
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_vector.h"
+
+/** Number of elements readers cycle through */
+#define BENCH_READ_ELES 4
+
+/** Capacity of the benchmark vector */
+#define BENCH_CAPACITY 64
+
+/** The original packed shmarray_t layout */
+typedef struct legacy_array {
+    shmmutex_t lock;
+    shmrwlock_t rwlock;
+    uint32_t flags;
+    size_t ref_count;
+    size_t capacity;
+    size_t esize;
+    size_t next_back_idx;
+    size_t active_count;
+    size_t eles_offset;
+    size_t actives_offset;
+} legacy_array_t;
+
+/* Keeps the reader loads from being optimized away */
+static volatile long bench_sink;
+
+/** Shared state for a run */
+typedef struct bench_state {
+    bool legacy;
+    legacy_array_t* la;
+    const char* segname;
+    int writers;
+    long iters;
+    atomic_int writers_done;
+    uint64_t writer_ns[256];
+    uint64_t reads[256];
+    uint64_t reader_ns[256];
+} bench_state_t;
+
+static void* legacy_at(legacy_array_t* la, size_t idx) {
+    bool* actives = (bool*)((char*)la + la->actives_offset);
+    if (la->next_back_idx > idx && actives[idx])
+        return (char*)la + la->eles_offset + idx * la->esize;
+    return NULL;
+}
+
+static void legacy_del_insert(legacy_array_t* la, size_t idx, long val) {
+    bool* actives = (bool*)((char*)la + la->actives_offset);
+    shmmutex_lock(&la->lock);
+    actives[idx] = false;
+    la->active_count--;
+    *(long*)((char*)la + la->eles_offset + idx * la->esize) = val;
+    actives[idx] = true;
+    la->active_count++;
+    shmmutex_unlock(&la->lock);
+}
+
+static void aligned_del_insert(shmvector_t* sv, size_t idx, long val) {
+    shmvector_lock(sv);
+    shmvector_del(sv, idx);
+    shmvector_insert_at(sv, idx, &val);
+    shmvector_unlock(sv);
+}
+
+/* Writers modify the element after those read; readers poll until the writers finish */
+static void layout_loop(int rank, int nprocs, void* arg) {
+    bench_state_t* st = arg;
+    shmvector_t sv;
+    if (!st->legacy)
+        shmvector_create(&sv, st->segname, sizeof(long), BENCH_CAPACITY);
+
+    if (rank < st->writers) {
+        size_t idx = BENCH_READ_ELES + rank;
+        uint64_t start = bench_now_ns();
+        for (long i = 0; i < st->iters; i++) {
+            if (st->legacy)
+                legacy_del_insert(st->la, idx, i);
+            else
+                aligned_del_insert(&sv, idx, i);
+        }
+        st->writer_ns[rank] = bench_now_ns() - start;
+        atomic_fetch_add(&st->writers_done, 1);
+    } else {
+        uint64_t reads = 0, start = bench_now_ns();
+        long sum = 0;
+        while (atomic_load_explicit(&st->writers_done, memory_order_relaxed) < st->writers) {
+            for (size_t idx = 0; idx < BENCH_READ_ELES; idx++) {
+                long* ele = st->legacy ? legacy_at(st->la, idx) : shmvector_at(&sv, idx);
+                if (ele)
+                    sum += *ele;
+            }
+            reads += BENCH_READ_ELES;
+        }
+        st->reads[rank] = reads;
+        st->reader_ns[rank] = bench_now_ns() - start;
+        bench_sink = sum;
+    }
+
+    if (!st->legacy)
+        shmvector_destroy_safe(&sv);
+}
+
+int main(int argc, char** argv) {
+    long iters = (argc > 1) ? atol(argv[1]) : 1000000;
+    int procs[] = {2, 4, 8, 16, 64};
+    const char* segname = "/shm_vector_bench";
+    size_t lsize = sizeof(legacy_array_t) + BENCH_CAPACITY * (sizeof(long) + sizeof(bool));
+    bench_state_t* st = bench_shared_alloc(sizeof(bench_state_t));
+    legacy_array_t* la = bench_shared_alloc(lsize);
+
+    printf("%-8s %6s %8s %14s %16s\n", "layout", "procs", "writers", "write ns/op", "reads/s/reader");
+    for (int legacy = 1; legacy >= 0; legacy--) {
+        for (size_t p = 0; p < sizeof(procs) / sizeof(procs[0]); p++) {
+            int nprocs = procs[p];
+            memset(st, 0, sizeof(bench_state_t));
+            st->legacy = legacy;
+            st->segname = segname;
+            st->writers = (nprocs / 4 > 0) ? nprocs / 4 : 1;
+            st->iters = iters / st->writers;
+
+            /* Fill the vector so readers and writers find their elements active */
+            shmvector_t sv;
+            long zero = 0;
+            if (legacy) {
+                memset(la, 0, lsize);
+                la->capacity = BENCH_CAPACITY;
+                la->esize = sizeof(long);
+                la->eles_offset = sizeof(legacy_array_t);
+                la->actives_offset = la->eles_offset + BENCH_CAPACITY * sizeof(long);
+                for (size_t i = 0; i < BENCH_CAPACITY; i++)
+                    ((bool*)((char*)la + la->actives_offset))[i] = true;
+                la->next_back_idx = la->active_count = BENCH_CAPACITY;
+                shmmutex_create(&la->lock);
+                st->la = la;
+            } else {
+                shm_unlink(segname);
+                shmvector_create(&sv, segname, sizeof(long), BENCH_CAPACITY);
+                for (size_t i = 0; i < BENCH_CAPACITY; i++)
+                    shmvector_push_back(&sv, &zero);
+            }
+
+            bench_run_procs(nprocs, layout_loop, st);
+            uint64_t write_ns = 0, reads = 0, read_ns = 0;
+            for (int r = 0; r < st->writers; r++)
+                write_ns += st->writer_ns[r];
+            for (int r = st->writers; r < nprocs; r++) {
+                reads += st->reads[r];
+                read_ns += st->reader_ns[r];
+            }
+
+            printf("%-8s %6d %8d %14.1f %16.0f\n", legacy ? "legacy" : "aligned", nprocs,
+                   st->writers, (double)write_ns / (st->iters * st->writers),
+                   read_ns ? reads * 1e9 / read_ns : 0.0);
+            fflush(stdout);
+
+            if (!legacy)
+                shmvector_destroy(&sv);
+        }
+    }
+    bench_shared_free(la, lsize);
+    bench_shared_free(st, sizeof(bench_state_t));
+    return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * Random shmvector_at cost with 4K, 2M and 1G pages.
+ *
+ * A vector of 64 byte elements much larger than the TLB reach of 4K pages
+ * is filled, then read at random indices. The "4K" row uses the default
+ * pages as the before baseline; the "2M" and "1G" rows set attr.page_size.
+ * The "backing" column tells what the segment got: "hugetlb" pages from a
+ * hugetlbfs mount, "thp" if it fell back to transparent huge pages (which
+ * the kernel may or may not provide), or "base" pages.
+ *
+ * Usage: shm_vector_hugepage_bench [vector MiB] [accesses per row]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_vector.h"
+
+/** One cache line per element */
+typedef struct bench_ele {
+    uint64_t val;
+    char pad[56];
+} bench_ele_t;
+
+/* Keeps the loads from being optimized away */
+static volatile uint64_t bench_sink;
+
+static const char* bench_backing(shmvector_t* sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_HUGETLB)
+        return "hugetlb";
+    return (sv->shm->flags & SHMVECTOR_FLAG_THP) ? "thp" : "base";
+}
+
+int main(int argc, char** argv) {
+    size_t mib = (argc > 1) ? atol(argv[1]) : 1024;
+    long accesses = (argc > 2) ? atol(argv[2]) : 10000000;
+    size_t count = (mib << 20) / sizeof(bench_ele_t);
+    size_t page_sizes[] = {0, SHMVECTOR_PAGE_2M, SHMVECTOR_PAGE_1G};
+    const char* names[] = {"4K", "2M", "1G"};
+    const char* segname = "/shm_vector_hugepage_bench";
+
+    printf("%-6s %-8s %12s %12s\n", "pages", "backing", "page size", "ns/access");
+    for (size_t p = 0; p < sizeof(page_sizes) / sizeof(page_sizes[0]); p++) {
+        shm_unlink(segname);
+        shmvector_attr_t attr;
+        shmvector_attr_init(&attr);
+        attr.page_size = page_sizes[p];
+        shmvector_t sv;
+        if (0 != shmvector_create_attr(&sv, segname, sizeof(bench_ele_t), count, &attr)) {
+            printf("%-6s %-8s\n", names[p], "failed");
+            continue;
+        }
+
+        /* Filling the vector also faults every page in */
+        bench_ele_t ele;
+        memset(&ele, 0, sizeof(ele));
+        for (size_t i = 0; i < count; i++) {
+            ele.val = i;
+            shmvector_push_back(&sv, &ele);
+        }
+
+        uint64_t x = 88172645463325252ull, sum = 0;
+        uint64_t start = bench_now_ns();
+        for (long i = 0; i < accesses; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            sum += ((bench_ele_t*)shmvector_at(&sv, x % count))->val;
+        }
+        uint64_t ns = bench_now_ns() - start;
+        bench_sink = sum;
+
+        printf("%-6s %-8s %12zu %12.1f\n", names[p], bench_backing(&sv), shmvector_page_size(&sv),
+               (double)ns / accesses);
+        fflush(stdout);
+        shmvector_destroy(&sv);
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * Time to steady state of a freshly created or attached vector.
+ *
+ * Each row sets up a vector of 64 byte elements, then writes every element
+ * twice. "setup" is shmvector_create_attr, "first pass" the first write of
+ * every element with the page faults it takes, and "steady" the second
+ * write; "to steady" is setup plus first pass. The "create" rows create the
+ * segment; the "attach" rows attach a new process to a segment another
+ * process already wrote, so its pages exist and only the mappings fault.
+ * The "lazy" rows use the default options as the before baseline; the
+ * others set attr.prefault, attr.mlock and attr.prefault_threads.
+ *
+ * Usage: shm_vector_prefault_bench [vector MiB] [prefault threads]
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "bench_util.h"
+#include "shm_vector.h"
+
+/** Options compared */
+enum { BENCH_LAZY, BENCH_PREFAULT, BENCH_MLOCK, BENCH_THREADS, BENCH_MODES };
+static const char* bench_mode_names[] = {"lazy", "prefault", "mlock", "threads"};
+
+/** Shared state for a run */
+typedef struct bench_state {
+    const char* segname;
+    size_t count;
+    shmvector_attr_t attr;
+    uint64_t setup_ns, first_ns, steady_ns;
+    long first_faults;
+} bench_state_t;
+
+static long bench_minor_faults(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+static void bench_write_all(shmvector_t* sv, size_t count, uint64_t val) {
+    for (size_t i = 0; i < count; i++)
+        *(uint64_t*)shmvector_slot(sv, i) = val;
+}
+
+/* Set up the vector and write it twice */
+static void steady_loop(int rank, int nprocs, void* arg) {
+    bench_state_t* st = arg;
+    shmvector_t sv;
+    uint64_t start = bench_now_ns();
+    shmvector_create_attr(&sv, st->segname, 64, st->count, &st->attr);
+    st->setup_ns = bench_now_ns() - start;
+
+    long faults = bench_minor_faults();
+    start = bench_now_ns();
+    bench_write_all(&sv, st->count, 1);
+    st->first_ns = bench_now_ns() - start;
+    st->first_faults = bench_minor_faults() - faults;
+
+    start = bench_now_ns();
+    bench_write_all(&sv, st->count, 2);
+    st->steady_ns = bench_now_ns() - start;
+    shmvector_destroy_safe(&sv);
+}
+
+int main(int argc, char** argv) {
+    size_t mib = (argc > 1) ? atol(argv[1]) : 256;
+    uint32_t threads = (argc > 2) ? atol(argv[2]) : 4;
+    const char* segname = "/shm_vector_prefault_bench";
+    bench_state_t* st = bench_shared_alloc(sizeof(bench_state_t));
+
+    printf("%-7s %-9s %10s %14s %10s %12s %12s\n", "role", "options", "setup ms",
+           "first pass ms", "faults", "steady ms", "to steady ms");
+    for (int attach = 0; attach <= 1; attach++) {
+        for (int mode = 0; mode < BENCH_MODES; mode++) {
+            memset(st, 0, sizeof(bench_state_t));
+            st->segname = segname;
+            st->count = (mib << 20) / 64;
+            shmvector_attr_init(&st->attr);
+            st->attr.prefault = (mode >= BENCH_PREFAULT);
+            st->attr.mlock = (BENCH_MLOCK == mode);
+            st->attr.prefault_threads = (BENCH_THREADS == mode) ? threads : 0;
+            shm_unlink(segname);
+
+            /* The owner keeps the written segment alive while another process attaches */
+            shmvector_t owner;
+            if (attach) {
+                shmvector_create(&owner, segname, 64, st->count);
+                bench_write_all(&owner, st->count, 0);
+            }
+            bench_run_procs(1, steady_loop, st);
+            if (attach)
+                shmvector_destroy_safe(&owner);
+
+            printf("%-7s %-9s %10.1f %14.1f %10ld %12.1f %12.1f\n", attach ? "attach" : "create",
+                   bench_mode_names[mode], st->setup_ns / 1e6, st->first_ns / 1e6, st->first_faults,
+                   st->steady_ns / 1e6, (st->setup_ns + st->first_ns) / 1e6);
+            fflush(stdout);
+        }
+    }
+    bench_shared_free(st, sizeof(bench_state_t));
+    return 0;
+}
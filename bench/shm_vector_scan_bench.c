@@ -0,0 +1,97 @@
+/**
+ * Iteration and search cost over a sparse vector.
+ *
+ * A vector of a few million one byte elements has 0.1%, 1% and 10% of its
+ * slots active, spread at random. The "iterate" column visits every active
+ * element and the "find" column is shmvector_find_first_of for a value no
+ * element holds, so both cover the whole vector. The "legacy" rows use a
+ * copy of the original loops over a bool per slot, kept beside the vector
+ * as the original actives array was, as the before baseline; the "bitmap"
+ * rows use shmvector_next and shmvector_find_first_of over the occupancy
+ * bitmap (configure with -DSHMVECTOR_AVX2=ON for the AVX2 scan).
+ *
+ * Usage: shm_vector_scan_bench [capacity] [passes per row]
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bench_util.h"
+#include "shm_vector.h"
+
+/* Keeps the loops from being optimized away */
+static volatile long bench_sink;
+
+static int bench_charcmp(void* lhs, void* rhs) {
+    return *(char*)lhs != *(char*)rhs;
+}
+
+/* The original find_first_of loop */
+static int legacy_find_first_of(shmvector_t* sv, bool* actives, void* data) {
+    char* eles = (char*)sv->shm + sv->shm->eles_offset;
+    for (int i = 0; i < sv->shm->capacity; i++) {
+        if (true == actives[i]) {
+            if (0 == bench_charcmp(data, eles + (i * sv->shm->esize)))
+                return i;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    size_t capacity = (argc > 1) ? atol(argv[1]) : 4 * 1024 * 1024;
+    long passes = (argc > 2) ? atol(argv[2]) : 20;
+    double density[] = {0.1, 1, 10};
+    const char* segname = "/shm_vector_scan_bench";
+    bool* actives = malloc(capacity * sizeof(bool));
+
+    printf("%-8s %8s %16s %16s\n", "scan", "active", "iterate ms/pass", "find ms/pass");
+    for (int legacy = 1; legacy >= 0; legacy--) {
+        for (size_t d = 0; d < sizeof(density) / sizeof(density[0]); d++) {
+            shm_unlink(segname);
+            shmvector_t sv;
+            shmvector_create(&sv, segname, sizeof(char), capacity);
+            memset(actives, 0, capacity * sizeof(bool));
+            srand(1);
+            size_t nactive = capacity * density[d] / 100;
+            char ele = 'a', missing = 'z';
+            for (size_t n = 0; n < nactive; n++) {
+                size_t idx = rand() % capacity;
+                shmvector_insert_at(&sv, idx, &ele);
+                actives[idx] = true;
+            }
+
+            long sum = 0;
+            uint64_t start = bench_now_ns();
+            for (long p = 0; p < passes; p++) {
+                if (legacy) {
+                    for (size_t i = 0; i < capacity; i++) {
+                        if (actives[i])
+                            sum += i;
+                    }
+                } else {
+                    for (int i = shmvector_next(&sv, 0); i >= 0; i = shmvector_next(&sv, i + 1))
+                        sum += i;
+                }
+            }
+            uint64_t iterate_ns = bench_now_ns() - start;
+
+            start = bench_now_ns();
+            for (long p = 0; p < passes; p++) {
+                sum += legacy ? legacy_find_first_of(&sv, actives, &missing) :
+                    shmvector_find_first_of(&sv, &missing, bench_charcmp);
+            }
+            uint64_t find_ns = bench_now_ns() - start;
+            bench_sink = sum;
+
+            printf("%-8s %7.1f%% %16.3f %16.3f\n", legacy ? "legacy" : "bitmap", density[d],
+                   iterate_ns / 1e6 / passes, find_ns / 1e6 / passes);
+            fflush(stdout);
+            shmvector_destroy(&sv);
+        }
+    }
+    free(actives);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_barrier.h"
+
+/** Wrapper for the futex system call */
+static long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/** Pause while spinning */
+static inline void shmbarrier_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/** @return the shared barrier state */
+static inline shmcounter_hot_t* shmbarrier_data(shmbarrier_t *sb) {
+    return sb->counter.hot;
+}
+
+int shmbarrier_create(shmbarrier_t *sb, shmcounter_set_t *scs, shmcounter_uid_t cid,
+                      uint32_t nprocs) {
+    if (0 == nprocs)
+        return EINVAL;
+    int rc = shmcounter_create(&sb->counter, scs, cid);
+    if (0 != rc)
+        return rc;
+
+    /* The first participant sizes the barrier; the set lock orders concurrent creators */
+    shmvector_lock(scs->v);
+    shmcounter_hot_t *d = shmbarrier_data(sb);
+    if (NULL == d)
+        rc = EINVAL;
+    else if (0 == d->nprocs)
+        d->nprocs = nprocs;
+    else if (d->nprocs != nprocs)
+        rc = EINVAL;
+    if (0 == rc)
+        sb->local_sense = atomic_load(&(d->sense));
+    shmvector_unlock(scs->v);
+    if (0 != rc) {
+        shmcounter_destroy(&sb->counter);
+        return rc;
+    }
+
+    /* Spinning only helps when the last arrival can run while we spin */
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    sb->spins = (ncpus > 1 && nprocs <= ncpus) ? SHMBARRIER_SPIN_LIMIT : 0;
+    sb->arrived = false;
+    return 0;
+}
+
+int shmbarrier_destroy(shmbarrier_t *sb) {
+    return shmcounter_destroy(&sb->counter);
+}
+
+int shmbarrier_arrive(shmbarrier_t *sb) {
+    shmcounter_hot_t *d = shmbarrier_data(sb);
+    sb->local_sense ^= 1;
+    sb->arrived = true;
+    if ((uint32_t)atomic_fetch_add(&(d->count), 1) + 1 < d->nprocs)
+        return 0;
+
+    /* Last arrival: reset for the next phase, then release this one */
+    atomic_store_explicit(&(d->count), 0, memory_order_relaxed);
+    atomic_store(&(d->sense), sb->local_sense);
+    if (atomic_load(&(d->sleepers)) > 0) {
+        if (-1 == futex(&(d->sense), FUTEX_WAKE, INT_MAX, NULL))
+            fprintf(stderr, "ERROR: Failure waking barrier waiters\n");
+    }
+    return SHMBARRIER_SERIAL;
+}
+
+int shmbarrier_wait(shmbarrier_t *sb, const struct timespec *abstime) {
+    if (!sb->arrived)
+        return EINVAL;
+    shmcounter_hot_t *d = shmbarrier_data(sb);
+    uint32_t target = sb->local_sense;
+
+    for (uint32_t i = 0; i < sb->spins; i++) {
+        if (target == atomic_load_explicit(&(d->sense), memory_order_acquire)) {
+            sb->arrived = false;
+            return 0;
+        }
+        shmbarrier_cpu_relax();
+    }
+
+    /* Announce ourselves before checking, so the last arrival sees us or we see it */
+    atomic_fetch_add(&(d->sleepers), 1);
+    while (target != atomic_load(&(d->sense))) {
+        long s = futex(&(d->sense), FUTEX_WAIT_BITSET, target ^ 1, abstime);
+        if (s == -1 && errno == ETIMEDOUT) {
+            atomic_fetch_sub(&(d->sleepers), 1);
+            return ETIMEDOUT;
+        }
+        if (s == -1 && errno != EAGAIN && errno != EINTR) {
+            fprintf(stderr, "ERROR: Failure while waiting at barrier\n");
+            atomic_fetch_sub(&(d->sleepers), 1);
+            return 1;
+        }
+    }
+    atomic_fetch_sub(&(d->sleepers), 1);
+    sb->arrived = false;
+    return 0;
+}
+
+int shmbarrier_arrive_and_wait(shmbarrier_t *sb) {
+    int rc = shmbarrier_arrive(sb);
+    if (SHMBARRIER_SERIAL == rc) {
+        sb->arrived = false;
+        return rc;
+    }
+    return shmbarrier_wait(sb, NULL);
+}
@@ -0,0 +1,95 @@
+/**
+ * A barrier stored in a counter set and keyed by a counter uid, so the
+ * ranks of a collective find it by the same id they use for counters.
+ *
+ * Sample usage:
+ *   shmbarrier_t sb;
+ *   shmbarrier_create(&sb, &scs, uid, nranks);
+ *   shmbarrier_arrive(&sb);
+ *   ... compute that does not depend on the other ranks ...
+ *   shmbarrier_wait(&sb, NULL);
+ *   shmbarrier_destroy(&sb);
+ */
+#ifndef SHM_BARRIER_H
+#define SHM_BARRIER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "shm_counter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Pause instructions a waiter spins for before sleeping on the futex */
+#define SHMBARRIER_SPIN_LIMIT 4096
+
+/** Returned by shmbarrier_arrive to the process completing a phase */
+#define SHMBARRIER_SERIAL 1
+
+/**
+ * Public type for using a shared barrier. The shared state is the hot
+ * words of a counter: count is the number of arrivals in the current phase, and sense is
+ * flipped by the last arrival. Each process keeps the sense of the phase it
+ * arrived at, so the barrier can be reused without resetting it (sense
+ * reversal). Waiters spin briefly, then sleep on sense.
+ */
+typedef struct shmbarrier {
+    /* Counter holding the barrier state */
+    shmcounter_t counter;
+
+    /* Sense the shared sense takes when the phase we arrived at completes */
+    uint32_t local_sense;
+
+    /* Spins before sleeping; 0 when there are more processes than CPUs */
+    uint32_t spins;
+
+    /* True between arrive and the matching wait */
+    bool arrived;
+} shmbarrier_t;
+
+/**
+ * Create or attach to the barrier with id cid in a counter set
+ * @param sb Struct to fill in
+ * @param scs Counter set holding the barrier
+ * @param cid Id shared by every participant
+ * @param nprocs Number of processes taking part in each phase
+ * @return 0 on success, EINVAL if the barrier exists with another nprocs
+ *         or cid is a sharded counter, other non-zero on failure
+ */
+int shmbarrier_create(shmbarrier_t *sb, shmcounter_set_t *scs, shmcounter_uid_t cid,
+                      uint32_t nprocs);
+
+/**
+ * Release this process's reference to the barrier
+ */
+int shmbarrier_destroy(shmbarrier_t *sb);
+
+/**
+ * Arrive at the barrier without waiting for the others (split phase).
+ * Every arrive must be followed by a shmbarrier_wait before the next arrive.
+ * @return SHMBARRIER_SERIAL in the process completing the phase, otherwise 0
+ */
+int shmbarrier_arrive(shmbarrier_t *sb);
+
+/**
+ * Wait until every process has arrived at the phase of our last arrive
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed (the arrival still
+ *         counts and waiting may be resumed), EINVAL if we have not arrived
+ */
+int shmbarrier_wait(shmbarrier_t *sb, const struct timespec *abstime);
+
+/**
+ * Arrive and wait for the other processes
+ * @return SHMBARRIER_SERIAL in the process completing the phase, otherwise
+ *         0 or the non-zero error of shmbarrier_wait
+ */
+int shmbarrier_arrive_and_wait(shmbarrier_t *sb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
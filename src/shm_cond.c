@@ -0,0 +1,91 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_cond.h"
+
+/** Wrapper for the futex system call */
+static long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout,
+                  uint32_t *uaddr2, uint32_t val3) {
+    return syscall(SYS_futex, uaddr, op, val, timeout, uaddr2, val3);
+}
+
+int shmcond_create(shmcond_t *sc) {
+    atomic_store(&(sc->waiters), 0);
+    atomic_store(&(sc->seq), 0);
+    return 0;
+}
+
+int shmcond_wait(shmcond_t *sc, shmmutex_t *sm) {
+    return shmcond_timedwait(sc, sm, NULL);
+}
+
+int shmcond_timedwait(shmcond_t *sc, shmmutex_t *sm, const struct timespec *abstime) {
+    int rc = 0;
+
+    /* Register while holding the mutex so a signaller that changed the condition sees us */
+    uint32_t seq = atomic_load(&(sc->seq));
+    atomic_fetch_add(&(sc->waiters), 1);
+    shmmutex_unlock(sm);
+
+    long s = futex(&(sc->seq), FUTEX_WAIT_BITSET, seq, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+    if (s == -1 && errno == ETIMEDOUT)
+        rc = ETIMEDOUT;
+    else if (s == -1 && errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "ERROR: Failure while waiting on condition\n");
+        rc = 1;
+    }
+    atomic_fetch_sub(&(sc->waiters), 1);
+
+    /* We may have been requeued onto the mutex, so other waiters may follow us */
+    int lrc = shmmutex_lock_contended(sm);
+    return (0 != lrc) ? lrc : rc;
+}
+
+int shmcond_signal(shmcond_t *sc) {
+    if (0 == atomic_load(&(sc->waiters)))
+        return 0;
+    atomic_fetch_add(&(sc->seq), 1);
+    if (-1 == futex(&(sc->seq), FUTEX_WAKE, 1, NULL, NULL, 0)) {
+        fprintf(stderr, "ERROR: Failure while signalling condition\n");
+        return 1;
+    }
+    return 0;
+}
+
+int shmcond_broadcast(shmcond_t *sc, shmmutex_t *sm) {
+    if (0 == atomic_load(&(sc->waiters)))
+        return 0;
+    uint32_t seq = atomic_fetch_add(&(sc->seq), 1) + 1;
+
+    /* Waiters of other mutex types do not sleep on val, so wake them all */
+    if (NULL == sm || (sm->type != SHMMUTEX_TYPE_FUTEX && sm->type != SHMMUTEX_TYPE_ADAPTIVE)) {
+        if (-1 == futex(&(sc->seq), FUTEX_WAKE, INT_MAX, NULL, NULL, 0)) {
+            fprintf(stderr, "ERROR: Failure while broadcasting condition\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    /*
+     * Wake one waiter and move the rest onto the mutex. The woken waiter
+     * takes the mutex in the contended state, so its release wakes the next.
+     * The requeue limit is passed in the timeout argument.
+     */
+    while (-1 == futex(&(sc->seq), FUTEX_CMP_REQUEUE, 1, (const struct timespec*)(uintptr_t)INT_MAX,
+                       &(sm->val), seq)) {
+        if (errno != EAGAIN) {
+            fprintf(stderr, "ERROR: Failure while broadcasting condition\n");
+            return 1;
+        }
+        /* Another signal advanced seq; requeue with the new value */
+        seq = atomic_load(&(sc->seq));
+    }
+    return 0;
+}
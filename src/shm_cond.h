@@ -0,0 +1,88 @@
+#ifndef SHM_COND_H
+#define SHM_COND_H
+
+#include <stdint.h>
+#include <time.h>
+#include "shm_mutex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Public type used to let processes sleep until a shared structure changes.
+ * Like shmmutex_t it must be stored in memory that every participating
+ * process can read and write (i.e. put it in SHM), and it is always used
+ * together with a shmmutex_t protecting the condition being waited for.
+ *
+ * Waiters sleep on seq, which every signal and broadcast advances, so a
+ * wakeup issued between releasing the mutex and going to sleep is not lost.
+ * Signal and broadcast only enter the kernel when waiters exist. Broadcast
+ * wakes one waiter and requeues the rest onto the mutex futex, so they are
+ * woken one at a time as the mutex is released instead of all at once.
+ *
+ * Zero-filled memory is a valid condition variable. Waits may return
+ * spuriously, so callers re-check their condition in a loop.
+ */
+typedef struct shmcond {
+    /* Futex word, advanced by every signal and broadcast */
+    uint32_t seq;
+
+    /* Number of processes inside shmcond_wait */
+    uint32_t waiters;
+} shmcond_t;
+
+/**
+ * Create the condition variable. Must be called by a single process on
+ * memory that is not yet in use.
+ *
+ * @param sc pointer to the condition variable data
+ * @return 0 on success
+ */
+int shmcond_create(shmcond_t *sc);
+
+/**
+ * Release the mutex, sleep until signalled and reacquire the mutex
+ *
+ * @param sc pointer to the condition variable data
+ * @param sm mutex held by the caller
+ * @return 0 on success, or the result of reacquiring sm (e.g. EOWNERDEAD)
+ */
+int shmcond_wait(shmcond_t *sc, shmmutex_t *sm);
+
+/**
+ * shmcond_wait() that stops sleeping at an absolute CLOCK_MONOTONIC
+ * deadline. The mutex is reacquired in either case.
+ *
+ * @param sc pointer to the condition variable data
+ * @param sm mutex held by the caller
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed, or the result of
+ *         reacquiring sm if that failed
+ */
+int shmcond_timedwait(shmcond_t *sc, shmmutex_t *sm, const struct timespec *abstime);
+
+/**
+ * Wake one waiting process, if any
+ *
+ * @param sc pointer to the condition variable data
+ * @return 0 on success, non-zero on failure
+ */
+int shmcond_signal(shmcond_t *sc);
+
+/**
+ * Wake every waiting process. The waiters of a FUTEX or ADAPTIVE mutex are
+ * requeued onto it and only one is woken immediately; other mutex types,
+ * or a NULL mutex, wake all waiters.
+ *
+ * @param sc pointer to the condition variable data
+ * @param sm the mutex the waiters use, or NULL
+ * @return 0 on success, non-zero on failure
+ */
+int shmcond_broadcast(shmcond_t *sc, shmmutex_t *sm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,13 +1,45 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "shm_mutex.h"
 #include "shm_vector.h"
 #include "shm_counter.h"
 
+/** Wrapper for the futex system call on a counter value */
+static long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout) {
+	return syscall(SYS_futex, uaddr, op, val, timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/** @return the low 32 bits of the count, which waiters sleep on */
+static inline uint32_t* shmcounter_futex_word(shmcounter_hot_t *h) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (uint32_t*)&(h->count) + 1;
+#else
+	return (uint32_t*)&(h->count);
+#endif
+}
+
+/** Wake processes in shmcounter_wait_value after the count changed */
+static void shmcounter_wake(shmcounter_hot_t *h) {
+	if (0 == atomic_load(&(h->waiters)))
+		return;
+	/* Waiters may want different values, so wake them all to recheck */
+	if (-1 == futex(shmcounter_futex_word(h), FUTEX_WAKE, INT_MAX, NULL))
+		fprintf(stderr, "ERROR: Failure waking counter waiters\n");
+}
+
 /** @return 0 if uids are equal, 1 if unequal */
 static int shmcounter_uidcmp(void* lhs, void* rhs) {
 	shmcounter_uid_t* l = (shmcounter_uid_t*)(lhs);
@@ -23,191 +55,717 @@ static int shmcounter_uidcmp(void* lhs, void* rhs) {
 	}
 }
 
+/** @return the uid hashed to a slot index */
+static inline size_t shmcounter_uid_hash(const shmcounter_uid_t *id, size_t capacity) {
+	/* Fold the fields through the splitmix64 finalizer */
+	uint64_t h = 0;
+	const uint64_t f[4] = {id->group, id->ctype, id->tag, id->lid};
+	for (int i = 0; i < 4; i++) {
+		h ^= f[i] + 0x9e3779b97f4a7c15ull;
+		h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+		h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+		h ^= h >> 31;
+	}
+	return h % capacity;
+}
+
+/** @return true if a free slot marks a deleted counter that probes must step over */
+static inline bool shmcounter_is_tombstone(const shmcounter_data_t *cd) {
+	return SHMCOUNTER_RESERVED_GROUP == cd->id.group &&
+		   SHMCOUNTER_RESERVED_CTYPE == cd->id.ctype &&
+		   SHMCOUNTER_RESERVED_TAG == cd->id.tag;
+}
+
+/**
+ * Look up cid by linear probing from its hash slot. The set lock must be
+ * held, at least shared.
+ * @param[out] free_idx first reusable slot on the probe path, or -1 (may be NULL)
+ * @return the index of the counter, or -1 if it does not exist
+ */
+static int shmcounter_probe(shmvector_t *v, const shmcounter_uid_t *cid, int *free_idx) {
+	size_t capacity = v->shm->capacity;
+	if (NULL != free_idx)
+		*free_idx = -1;
+	if (0 == capacity)
+		return -1;
+	size_t idx = shmcounter_uid_hash(cid, capacity);
+	for (size_t n = 0; n < capacity; n++, idx = (idx + 1 == capacity) ? 0 : idx + 1) {
+		shmcounter_data_t *cd = shmvector_at(v, idx);
+		if (NULL != cd) {
+			if (0 == shmcounter_uidcmp((void*)cid, cd))
+				return idx;
+			continue;
+		}
+		if (NULL != free_idx && -1 == *free_idx)
+			*free_idx = idx;
+		/* An empty slot ends the probe sequence, a tombstone does not */
+		if (!shmcounter_is_tombstone(shmvector_slot(v, idx)))
+			break;
+	}
+	return -1;
+}
+
+/** @return true if a counter after the free slot idx was probed past it when inserted */
+static bool shmcounter_probed_past(shmvector_t *v, size_t idx) {
+	size_t capacity = v->shm->capacity;
+	for (size_t d = 1; d < capacity; d++) {
+		size_t j = (idx + d) % capacity;
+		shmcounter_data_t *cd = shmvector_at(v, j);
+		if (NULL == cd) {
+			/* Probe paths do not extend past an empty slot */
+			if (!shmcounter_is_tombstone(shmvector_slot(v, j)))
+				return false;
+			continue;
+		}
+		/* Home slots further back than idx mean the probe passed through idx */
+		size_t home = shmcounter_uid_hash(&(cd->id), capacity);
+		if ((j + capacity - home) % capacity >= d)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Attach to the set segment <name><suffix>, creating it if no process has
+ * yet. Called with the set lock held, so that the last process using the
+ * segment cannot remove it while another attaches.
+ * @param[in,out] region the segment, NULL until attached
+ * @param[in,out] name the segment name, NULL until attached
+ * @return the segment, or NULL on failure
+ */
+static shmvector_t* shmcounter_set_region(shmcounter_set_t *scs, shmvector_t **region, char **name,
+										  const char *suffix, size_t elesz, size_t capacity) {
+	if (NULL != *region)
+		return *region;
+	size_t namelen = strlen(scs->name) + strlen(suffix) + 1;
+	char *n = malloc(namelen);
+	snprintf(n, namelen, "%s%s", scs->name, suffix);
+	shmvector_t *v = malloc(sizeof(shmvector_t));
+	memset(v, 0, sizeof(shmvector_t));
+	int rc = shmvector_create_attr(v, n, elesz, capacity, &(scs->attr));
+	if (0 != rc) {
+		fprintf(stderr, "ERROR: Failed creating shared storage for counter segment %s\n", n);
+		free(v);
+		free(n);
+		return NULL;
+	}
+	*region = v;
+	*name = n;
+	return v;
+}
+
+/** @return the segment holding the shard blocks of sharded counters, or NULL on failure */
+static shmvector_t* shmcounter_set_shards(shmcounter_set_t *scs) {
+	return shmcounter_set_region(scs, &(scs->shards), &(scs->shards_name), ".shards",
+								 sizeof(shmcounter_shard_block_t), SHMCOUNTER_SHARDED_SIZE);
+}
+
+/** @return the segment holding the hot words of packed counters, or NULL on failure */
+static shmvector_t* shmcounter_set_counts(shmcounter_set_t *scs) {
+	return shmcounter_set_region(scs, &(scs->counts), &(scs->counts_name), ".counts",
+								 sizeof(shmcounter_hot_t), SHMCOUNTER_HOT_LINES);
+}
+
+/** @return the segment holding the hot lines of padded counters, or NULL on failure */
+static shmvector_t* shmcounter_set_hot(shmcounter_set_t *scs) {
+	return shmcounter_set_region(scs, &(scs->hot), &(scs->hot_name), ".hot",
+								 sizeof(shmcounter_hot_line_t), SHMCOUNTER_HOT_LINES);
+}
+
+/** Free the slot of a deleted counter, called with the set lock held exclusively */
+static void shmcounter_remove(shmcounter_set_t *scs, shmvector_t *v, size_t idx) {
+	size_t capacity = v->shm->capacity;
+	shmcounter_data_t *cd = shmvector_slot(v, idx);
+	if (0 != cd->shard_block && NULL != shmcounter_set_shards(scs)) {
+		memset(shmvector_at(scs->shards, cd->shard_block - 1), 0, sizeof(shmcounter_shard_block_t));
+		shmvector_del(scs->shards, cd->shard_block - 1);
+	}
+	if (0 != cd->packed_hot && NULL != shmcounter_set_counts(scs)) {
+		memset(shmvector_at(scs->counts, cd->packed_hot - 1), 0, sizeof(shmcounter_hot_t));
+		shmvector_del(scs->counts, cd->packed_hot - 1);
+	}
+	if (0 != cd->hot_line && NULL != shmcounter_set_hot(scs)) {
+		memset(shmvector_at(scs->hot, cd->hot_line - 1), 0, sizeof(shmcounter_hot_line_t));
+		shmvector_del(scs->hot, cd->hot_line - 1);
+	}
+	memset(cd, 0, sizeof(shmcounter_data_t));
+	shmvector_del(v, idx);
+
+	/* Lookups of later counters must step over the slot: leave a tombstone */
+	if (shmcounter_probed_past(v, idx)) {
+		cd->id.group = SHMCOUNTER_RESERVED_GROUP;
+		cd->id.ctype = SHMCOUNTER_RESERVED_CTYPE;
+		cd->id.tag = SHMCOUNTER_RESERVED_TAG;
+		return;
+	}
+	/* Tombstones directly before the new empty slot end no probe path either */
+	size_t prev = (idx == 0) ? capacity - 1 : idx - 1;
+	while (prev != idx && NULL == shmvector_at(v, prev) &&
+		   shmcounter_is_tombstone(shmvector_slot(v, prev))) {
+		memset(shmvector_slot(v, prev), 0, sizeof(shmcounter_data_t));
+		prev = (prev == 0) ? capacity - 1 : prev - 1;
+	}
+}
+
+/**
+ * Attach to chained segment i of the set, creating it if it does not exist
+ * @param replace unlink a segment left behind by an earlier set first
+ */
+static int shmcounter_set_attach(shmcounter_set_t *scs, uint32_t i, bool replace) {
+	size_t namelen = strlen(scs->name) + 12;
+	char *name = malloc(namelen);
+	snprintf(name, namelen, "%s.%u", scs->name, i);
+	if (replace)
+		shm_unlink(name);
+	shmvector_t *v = malloc(sizeof(shmvector_t));
+	memset(v, 0, sizeof(shmvector_t));
+	int rc = shmvector_create_attr(v, name, sizeof(shmcounter_data_t), SHMCOUNTER_SET_SIZE,
+								   &(scs->attr));
+	if (0 != rc) {
+		fprintf(stderr, "ERROR: Failed creating shared storage for counter\n");
+		free(v);
+		free(name);
+		return rc;
+	}
+	scs->segs[i] = v;
+	scs->seg_names[i] = name;
+	scs->nsegs = i + 1;
+	return 0;
+}
+
+/** Attach to the segments other processes chained since we last looked. Called with the set lock held. */
+static int shmcounter_set_refresh(shmcounter_set_t *scs) {
+	uint32_t gen = shmvector_chain_gen(scs->v);
+	while (scs->nsegs <= gen && scs->nsegs < SHMCOUNTER_MAX_SEGMENTS) {
+		int rc = shmcounter_set_attach(scs, scs->nsegs, false);
+		if (0 != rc)
+			return rc;
+	}
+	return 0;
+}
+
+/** Release counters that a dead process left allocated but never referenced */
+static void shmcounter_set_repair(shmvector_t *sv, void *arg) {
+	/* The set handle reaches every segment, including sv */
+	(void)sv;
+	shmcounter_set_t *scs = (shmcounter_set_t*)arg;
+	shmcounter_set_refresh(scs);
+	for (uint32_t s = 0; s < scs->nsegs; s++) {
+		shmvector_t *v = scs->segs[s];
+		for (size_t i = 0; i < v->shm->capacity; i++) {
+			shmcounter_data_t *cd = shmvector_at(v, i);
+			if (NULL != cd && 0 == cd->refcount)
+				shmcounter_remove(scs, v, i);
+		}
+	}
+}
+
 /** Create and allocate a new shared counter set. Counters initialized to 0 once. */
 int shmcounter_set_create(shmcounter_set_t *scs, const char* counterset) {
+	return shmcounter_set_create_attr(scs, counterset, NULL);
+}
+
+/** Create a shared counter set with segment options */
+int shmcounter_set_create_attr(shmcounter_set_t *scs, const char* counterset,
+							   const shmvector_attr_t *attr) {
+	return shmcounter_set_create_layout(scs, counterset, attr, SHMCOUNTER_LAYOUT_PACKED);
+}
+
+/** Create a shared counter set whose new counters use layout */
+int shmcounter_set_create_layout(shmcounter_set_t *scs, const char* counterset,
+								 const shmvector_attr_t *attr, shmcounter_layout_t layout) {
 
 	int rc = 0;
 
+	/* Counter handles point into the segments, so they must never move */
+	if (NULL != attr && attr->growable)
+		return EINVAL;
+
 	/* Create the vector's local storage */
     shmvector_t *v = malloc(sizeof(shmvector_t));
 	memset(v, 0, sizeof(shmvector_t));
 
     /* Setup the vector's shared storage */
-    rc = shmvector_create(v, counterset, sizeof(shmcounter_data_t), SHMCOUNTER_SET_SIZE);
+    rc = shmvector_create_attr(v, counterset, sizeof(shmcounter_data_t), SHMCOUNTER_SET_SIZE, attr);
 	if (0 != rc) {
 		fprintf(stderr, "ERROR: Failed creating shared storage for counter\n");
 		free(v);
 		return rc;
 	}
+	/* The segments holding the counts are created when a counter first needs them */
+	scs->shards = NULL;
+	scs->shards_name = NULL;
+	scs->counts = NULL;
+	scs->counts_name = NULL;
+	scs->hot = NULL;
+	scs->hot_name = NULL;
+	if (NULL != attr)
+		scs->attr = *attr;
+	else
+		shmvector_attr_init(&(scs->attr));
+	scs->layout = layout;
+
 	/* Local initialization */
+	v->repair = &shmcounter_set_repair;
+	v->repair_arg = scs;
     scs->v = v;
+	scs->name = counterset;
+	memset(scs->segs, 0, sizeof(scs->segs));
+	memset(scs->seg_names, 0, sizeof(scs->seg_names));
+	scs->segs[0] = v;
+	scs->nsegs = 1;
 	return rc;
 }
 
 /** Release resources associated with this shared memory list */
 int shmcounter_set_destroy(shmcounter_set_t *scs) {
-	/* If the vector is not in use, delete it */
+	/* If the vectors are not in use, delete them */
+	for (uint32_t s = 1; s < scs->nsegs; s++) {
+		shmvector_destroy_safe(scs->segs[s]);
+		free(scs->segs[s]);
+		free(scs->seg_names[s]);
+		scs->segs[s] = 0;
+		scs->seg_names[s] = 0;
+	}
 	shmvector_destroy_safe(scs->v);
+	if (NULL != scs->shards)
+		shmvector_destroy_safe(scs->shards);
+	if (NULL != scs->counts)
+		shmvector_destroy_safe(scs->counts);
+	if (NULL != scs->hot)
+		shmvector_destroy_safe(scs->hot);
 	/* Release local resources */
 	free(scs->v);
+	free(scs->shards);
+	free(scs->shards_name);
+	free(scs->counts);
+	free(scs->counts_name);
+	free(scs->hot);
+	free(scs->hot_name);
 	scs->v = 0;
+	scs->counts = 0;
+	scs->counts_name = 0;
+	scs->hot = 0;
+	scs->hot_name = 0;
+	scs->segs[0] = 0;
+	scs->nsegs = 0;
+	scs->shards = 0;
+	scs->shards_name = 0;
 	return 0;
 }
 
-/** Create and allocate a new shared counter. Initialize it to 0. */
-int shmcounter_create(shmcounter_t *sc, shmcounter_set_t *scs, shmcounter_uid_t cid) {
+/** Read the counter set lock statistics */
+int shmcounter_set_stats(shmcounter_set_t *scs, shmmutex_stats_counts_t *out) {
+	return shmvector_stats(scs->v, out);
+}
 
-	int rc = 0;
+/**
+ * Look up cid in every segment of the set. The set lock must be held, at
+ * least shared.
+ * @param[out] v segment holding the counter
+ * @return the index of the counter, or -1 if it does not exist
+ */
+static int shmcounter_find(shmcounter_set_t *scs, const shmcounter_uid_t *cid, shmvector_t **v) {
+	for (uint32_t s = 0; s < scs->nsegs; s++) {
+		int idx = shmcounter_probe(scs->segs[s], cid, NULL);
+		if (idx >= 0) {
+			*v = scs->segs[s];
+			return idx;
+		}
+	}
+	return -1;
+}
 
-	/* Rely on vector's lock to prevent deletion of the 
-	   counter while we are performing arrival for the shared counter*/
-	shmmutex_lock(&(scs->v->shm->lock));
-	/* Search the vector for the supplied id, create it if required */
-	int sz = shmvector_size(scs->v);
-	int idx = shmvector_find_first_of(scs->v, &cid, &shmcounter_uidcmp);
+/**
+ * Find cid, inserting it if required, and take a reference to it. Called
+ * with the set lock held exclusively. A new counter goes to the first
+ * segment with room; when every segment is full another one is chained.
+ * @param[out] v segment holding the counter
+ * @return the index of the counter, or -1 if the set is full
+ */
+static int shmcounter_acquire_locked(shmcounter_set_t *scs, const shmcounter_uid_t *cid,
+									 bool sharded, shmvector_t **v) {
+	/* Search the index for the supplied id, create it if required */
+	int newidx = -1;
+	shmvector_t *newv = NULL;
+	int idx = -1;
+	if (0 != shmcounter_set_refresh(scs))
+		return -1;
+	for (uint32_t s = 0; s < scs->nsegs && idx < 0; s++) {
+		int freeidx;
+		idx = shmcounter_probe(scs->segs[s], cid, &freeidx);
+		if (idx >= 0)
+			*v = scs->segs[s];
+		else if (newidx < 0 && freeidx >= 0) {
+			newidx = freeidx;
+			newv = scs->segs[s];
+		}
+	}
 	if (idx < 0) {
-		size_t newidx = shmvector_insert_quick(scs->v);
-		if (newidx < 0) {
-			fprintf(stderr, "ERROR: Could not insert new counter\n");
-			rc = 1;			
+		/* Every segment is full: chain a new one, replacing any left by an earlier set */
+		if (newidx < 0 && scs->nsegs < SHMCOUNTER_MAX_SEGMENTS) {
+			uint32_t next = scs->nsegs;
+			if (0 == shmcounter_set_attach(scs, next, true)) {
+				shmvector_set_chain_gen(scs->v, next);
+				newv = scs->segs[next];
+				shmcounter_probe(newv, cid, &newidx);
+			}
+		}
+		int block = -1, line = -1, packed_hot = -1;
+		bool padded = !sharded && SHMCOUNTER_LAYOUT_PADDED == scs->layout;
+		bool packed = !sharded && !padded;
+		if (newidx >= 0 && sharded && NULL != shmcounter_set_shards(scs)) {
+			block = shmvector_insert_quick(scs->shards);
+			if (block >= 0)
+				memset(shmvector_at(scs->shards, block), 0, sizeof(shmcounter_shard_block_t));
 		}
-		else {
-			shmcounter_data_t *slot = shmvector_at(scs->v, newidx);
-			shmcounter_data_t d = {.mutex = 0, .id = cid, .count = 0, .refcount = 0};
-			*slot = d;
-			idx = newidx;
+		if (newidx >= 0 && padded && NULL != shmcounter_set_hot(scs)) {
+			line = shmvector_insert_quick(scs->hot);
+			if (line >= 0)
+				memset(shmvector_at(scs->hot, line), 0, sizeof(shmcounter_hot_line_t));
 		}
+		if (newidx >= 0 && packed && NULL != shmcounter_set_counts(scs)) {
+			packed_hot = shmvector_insert_quick(scs->counts);
+			if (packed_hot >= 0)
+				memset(shmvector_at(scs->counts, packed_hot), 0, sizeof(shmcounter_hot_t));
+		}
+		if (newidx < 0 || (sharded && block < 0) || (padded && line < 0) ||
+			(packed && packed_hot < 0)) {
+			fprintf(stderr, "ERROR: Could not insert new counter\n");
+			if (block >= 0)
+				shmvector_del(scs->shards, block);
+			if (line >= 0)
+				shmvector_del(scs->hot, line);
+			if (packed_hot >= 0)
+				shmvector_del(scs->counts, packed_hot);
+			return -1;
+		}
+		/* Initialize the counter */
+		shmcounter_data_t d = {.id = *cid, .refcount = 0,
+							   .packed_hot = (uint32_t)(packed_hot + 1),
+							   .hot_line = (uint32_t)(line + 1),
+							   .shard_block = (uint32_t)(block + 1)};
+		shmvector_insert_at(newv, newidx, &d);
+		idx = newidx;
+		*v = newv;
 	}
-	/* Initialize the counter mutex and increment refcount */
-	if (0 == rc) {
-		shmcounter_data_t *cd = shmvector_at(scs->v, idx);
-		cd->refcount++;
-		shmmutex_create(&(cd->mutex));
+	/* Increment refcount */
+	shmcounter_data_t *cd = shmvector_at(*v, idx);
+	atomic_fetch_add(&(cd->refcount), 1);
+	return idx;
+}
+
+/** Drop a reference, deleting the counter with the last one. Called with the set lock held exclusively. */
+static void shmcounter_release_locked(shmcounter_set_t *scs, shmvector_t *v, size_t idx) {
+	shmcounter_data_t *cd = shmvector_at(v, idx);
+	if (1 == cd->refcount) {
+		/* Set the data to 0 and return the memory */
+		shmcounter_remove(scs, v, idx);
+	} else {
+		atomic_fetch_sub(&(cd->refcount), 1);
 	}
+}
 
-	/* Unlock the vector */
-	shmmutex_unlock(&(scs->v->shm->lock));
+/**
+ * Fill in the local counter struct for the counter at idx of segment v.
+ * Called with the set lock held, at least shared, since it may attach to
+ * the segment holding the counter's hot words or shard block.
+ * @return 0 on success, non-zero if that segment cannot be attached
+ */
+static int shmcounter_init_local(shmcounter_t *sc, shmcounter_set_t *scs, shmvector_t *v,
+								 size_t idx) {
+	sc->v = v;
+	sc->idx = idx;
+	sc->set = scs;
+	sc->shards = NULL;
+	sc->hot = NULL;
+	shmcounter_data_t *cd = shmvector_at(v, idx);
+	if (0 != cd->packed_hot) {
+		if (NULL == shmcounter_set_counts(scs))
+			return 1;
+		sc->hot = shmvector_at(scs->counts, cd->packed_hot - 1);
+	}
+	if (0 != cd->hot_line) {
+		if (NULL == shmcounter_set_hot(scs))
+			return 1;
+		shmcounter_hot_line_t *hl = shmvector_at(scs->hot, cd->hot_line - 1);
+		sc->hot = &(hl->hot);
+	}
+	if (0 != cd->shard_block) {
+		if (NULL == shmcounter_set_shards(scs))
+			return 1;
+		shmcounter_shard_block_t *sb = shmvector_at(scs->shards, cd->shard_block - 1);
+		sc->shards = sb->shards;
+	}
+	return 0;
+}
 
-	/* Local initialization */
-	if (0 == rc) {
-		sc->idx = idx;
-		sc->set = scs;
+/** Find or insert a counter, giving a new counter shard slots if sharded is set */
+static int shmcounter_create_mode(shmcounter_t *sc, shmcounter_set_t *scs, shmcounter_uid_t cid,
+								  bool sharded) {
+
+	/* Most counters already exist: look the id up while sharing the set
+	   lock, which still prevents deletion of the counter */
+	shmvector_t *v = NULL;
+	int idx = -1, rc = 0;
+	shmvector_lock_shared(scs->v);
+	if (0 == shmcounter_set_refresh(scs))
+		idx = shmcounter_find(scs, &cid, &v);
+	if (idx >= 0) {
+		shmcounter_data_t *cd = shmvector_at(v, idx);
+		atomic_fetch_add(&(cd->refcount), 1);
+		rc = shmcounter_init_local(sc, scs, v, idx);
+	}
+	shmvector_unlock_shared(scs->v);
 
+	if (idx < 0) {
+		/* Rely on vector's lock to prevent deletion of the 
+		   counter while we are performing arrival for the shared counter*/
+		shmvector_lock(scs->v);
+		idx = shmcounter_acquire_locked(scs, &cid, sharded, &v);
+		if (idx >= 0)
+			rc = shmcounter_init_local(sc, scs, v, idx);
+		shmvector_unlock(scs->v);
+		if (idx < 0)
+			return 1;
 	}
-	return rc;
+	if (0 != rc) {
+		shmcounter_destroy(sc);
+		return rc;
+	}
+	return 0;
+}
+
+/** Create and allocate a new shared counter. Initialize it to 0. */
+int shmcounter_create(shmcounter_t *sc, shmcounter_set_t *scs, shmcounter_uid_t cid) {
+	return shmcounter_create_mode(sc, scs, cid, false);
+}
+
+/** Create a counter updated through per-CPU slots */
+int shmcounter_create_sharded(shmcounter_t *sc, shmcounter_set_t *scs, shmcounter_uid_t cid) {
+	return shmcounter_create_mode(sc, scs, cid, true);
+}
+
+/** Create n counters under one acquisition of the set lock */
+int shmcounter_create_n(shmcounter_t *scv, shmcounter_set_t *scs, const shmcounter_uid_t *cids,
+						size_t n) {
+	shmvector_lock(scs->v);
+	for (size_t i = 0; i < n; i++) {
+		int idx = shmcounter_acquire_locked(scs, &cids[i], false, &scv[i].v);
+		if (idx >= 0 && 0 != shmcounter_init_local(&scv[i], scs, scv[i].v, idx)) {
+			shmcounter_release_locked(scs, scv[i].v, idx);
+			idx = -1;
+		}
+		if (idx < 0) {
+			/* All or nothing: drop the references taken so far */
+			while (i-- > 0)
+				shmcounter_release_locked(scs, scv[i].v, scv[i].idx);
+			shmvector_unlock(scs->v);
+			return 1;
+		}
+	}
+	shmvector_unlock(scs->v);
+	return 0;
 }
 
 /** Release resources associated with this shared memory list */
 int shmcounter_destroy(shmcounter_t *sc) {
 	/* Vector critical section if we need to perform deletion */
-	shmmutex_lock(&(sc->set->v->shm->lock));
+	shmvector_lock(sc->set->v);
+	shmcounter_release_locked(sc->set, sc->v, sc->idx);
+	shmvector_unlock(sc->set->v);
+	return 0;
+}
 
-	/* If this is the last reference, delete the counter */
-	shmcounter_data_t *cd = shmvector_at(sc->set->v, sc->idx);
-	shmmutex_lock(&(cd->mutex));
-	if (1 == cd->refcount) {
-		/* Destroy the counter mutex, set the data to 0, and return the memory */
-		shmmutex_destroy_if_locked(&(cd->mutex));
-		memset(cd, 0, sizeof(shmcounter_data_t));
-		shmvector_del(sc->set->v, sc->idx);
-	} else {
-		cd->refcount--;
-		shmmutex_unlock(&(cd->mutex));
+/** Release n counters of one set under one acquisition of the set lock */
+int shmcounter_destroy_n(shmcounter_t *scv, size_t n) {
+	if (0 == n)
+		return 0;
+	shmcounter_set_t *scs = scv[0].set;
+	for (size_t i = 1; i < n; i++) {
+		if (scv[i].set != scs)
+			return EINVAL;
 	}
-	shmmutex_unlock(&(sc->set->v->shm->lock));
+	shmvector_lock(scs->v);
+	for (size_t i = 0; i < n; i++)
+		shmcounter_release_locked(scs, scv[i].v, scv[i].idx);
+	shmvector_unlock(scs->v);
 	return 0;
 }
 
-/** Increment the counter */
-void shmcounter_inc_safe(shmcounter_t* sc, int val) {
-	/* Lock the vector to prevent deletion */
-	shmmutex_lock(&(sc->set->v->shm->lock));
+/** @return the slot of a sharded counter that this CPU updates */
+static inline shmcounter_shard_t* shmcounter_local_shard(shmcounter_t* sc) {
+	int cpu = sched_getcpu();
+	if (cpu < 0)
+		cpu = getpid();
+	return &(sc->shards[cpu % SHMCOUNTER_SHARDS]);
+}
 
-	/* Lock the counter */
-	shmcounter_data_t *d = shmvector_at(sc->set->v, sc->idx);
-	shmmutex_lock(&(d->mutex));
-	d->count += val;
-	shmmutex_unlock(&(d->mutex));
+/** @return the count, summing the slots of a sharded counter */
+static int64_t shmcounter_load(shmcounter_t* sc) {
+	if (NULL == sc->shards)
+		return atomic_load_explicit(&(sc->hot->count), memory_order_relaxed);
+	int64_t sum = 0;
+	for (int i = 0; i < SHMCOUNTER_SHARDS; i++)
+		sum += atomic_load_explicit(&(sc->shards[i].count), memory_order_relaxed);
+	return sum;
+}
 
-	/* End vector critical section */
-	shmmutex_unlock(&(sc->set->v->shm->lock));
+/** Add val to the counter */
+static void shmcounter_add(shmcounter_t* sc, int val) {
+	/* Nobody can wait on a sharded counter, so there is nothing to wake */
+	if (NULL != sc->shards) {
+		atomic_fetch_add_explicit(&(shmcounter_local_shard(sc)->count), val, memory_order_relaxed);
+		return;
+	}
+	shmcounter_hot_t *h = sc->hot;
+	atomic_fetch_add(&(h->count), val);
+	shmcounter_wake(h);
 }
 
-/** Decrement the counter */
-void shmcounter_dec_safe(shmcounter_t* sc, int val) {
-	/* Lock the vector to prevent deletion */
-	shmmutex_lock(&(sc->set->v->shm->lock));
+/** Add vals[i] to counter i */
+void shmcounter_add_n(shmcounter_t* scv, const int *vals, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		shmcounter_add(&scv[i], vals[i]);
+}
 
-	/* Lock the counter */
-	shmcounter_data_t *d = shmvector_at(sc->set->v, sc->idx);
-	shmmutex_lock(&(d->mutex));
-	d->count -= val;
-	shmmutex_unlock(&(d->mutex));
+/** Increment the counter */
+void shmcounter_inc_safe(shmcounter_t* sc, int val) {
+	shmcounter_add(sc, val);
+}
 
-	/* End vector critical section */
-	shmmutex_unlock(&(sc->set->v->shm->lock));
+/** Decrement the counter */
+void shmcounter_dec_safe(shmcounter_t* sc, int val) {
+	shmcounter_add(sc, -val);
 }
 
 /** Set the counter to value if the counter is 0. Return true if the value was updated. */
 bool shmcounter_set_if_zero_safe(shmcounter_t* sc, int val) {
-	bool value_set = false;
-	/* Lock the vector to prevent deletion */
-	shmmutex_lock(&(sc->set->v->shm->lock));
-
-	/* Lock the counter */
-	shmcounter_data_t *d = shmvector_at(sc->set->v, sc->idx);
-	shmmutex_lock(&(d->mutex));
-	if (0 == d->count) {
-		d->count = val;
-		value_set = true;
-	}
-	shmmutex_unlock(&(d->mutex));
-
-	/* End vector critical section */
-	shmmutex_unlock(&(sc->set->v->shm->lock));
+	/* The slots of a sharded counter cannot be tested and set together */
+	if (NULL != sc->shards)
+		return false;
+	shmcounter_hot_t *h = sc->hot;
+	int64_t zero = 0;
+	bool value_set = atomic_compare_exchange_strong(&(h->count), &zero, val);
+	if (value_set)
+		shmcounter_wake(h);
 	return value_set;
 }
 
 /** return the value of the counter */
 int shmcounter_value(shmcounter_t* sc) {
-	shmcounter_data_t *d = shmvector_at(sc->set->v, sc->idx);
-	return (d->count);
+	return (int)shmcounter_load(sc);
 }
 
-/** Compare the value of the counter */
-bool shmcounter_isvalue(shmcounter_t* sc, int val) {
-	shmcounter_data_t *d = shmvector_at(sc->set->v, sc->idx);
-	return (val == d->count);
+/** return the full 64 bit value of the counter */
+int64_t shmcounter_value64(shmcounter_t* sc) {
+	return shmcounter_load(sc);
 }
 
-/** Compare the value of the counter */
-bool shmcounter_isequal_safe(shmcounter_t* lhs, shmcounter_t* rhs) {
-	int lcount, rcount;
-	shmcounter_data_t *l, *r;
+/** Add val, returning the previous value */
+int shmcounter_fetch_add(shmcounter_t* sc, int64_t val, int64_t *prev) {
+	/* The slots of a sharded counter have no single previous value */
+	if (NULL != sc->shards)
+		return ENOTSUP;
+	shmcounter_hot_t *h = sc->hot;
+	*prev = atomic_fetch_add(&(h->count), val);
+	shmcounter_wake(h);
+	return 0;
+}
 
-	/* Short circuit on self comparison (which isn't lock safe) */
-	if (lhs->idx == rhs->idx)
-		return true;
+/** Replace expected with desired, returning the previous value */
+int shmcounter_cas(shmcounter_t* sc, int64_t expected, int64_t desired, int64_t *prev) {
+	if (NULL != sc->shards)
+		return ENOTSUP;
+	shmcounter_hot_t *h = sc->hot;
+	*prev = expected;
+	if (atomic_compare_exchange_strong(&(h->count), prev, desired) && expected != desired)
+		shmcounter_wake(h);
+	return 0;
+}
 
-	/* Lock the vector to prevent deletion */
-	shmmutex_lock(&(lhs->set->v->shm->lock));
+/** Store val, returning the previous value */
+int shmcounter_exchange(shmcounter_t* sc, int64_t val, int64_t *prev) {
+	if (NULL != sc->shards)
+		return ENOTSUP;
+	shmcounter_hot_t *h = sc->hot;
+	*prev = atomic_exchange(&(h->count), val);
+	if (*prev != val)
+		shmcounter_wake(h);
+	return 0;
+}
 
-	/* Lock the lhs counter */
-	l = shmvector_at(lhs->set->v, lhs->idx);
-	shmmutex_lock(&(l->mutex));
-	lcount = l->count;
+/** Store val if it is larger (max) or smaller (min) than the count */
+static int shmcounter_fetch_extreme(shmcounter_t* sc, int64_t val, bool max, int64_t *prev) {
+	if (NULL != sc->shards)
+		return ENOTSUP;
+	shmcounter_hot_t *h = sc->hot;
+	int64_t c = atomic_load(&(h->count));
+	while ((max ? c < val : c > val) &&
+		   !atomic_compare_exchange_weak(&(h->count), &c, val))
+		;
+	*prev = c;
+	if (max ? c < val : c > val)
+		shmcounter_wake(h);
+	return 0;
+}
 
-	/* Lock the rhs counter */
-	r = shmvector_at(rhs->set->v, rhs->idx);
-	shmmutex_lock(&(r->mutex));
-	rcount = r->count;
+int shmcounter_fetch_max(shmcounter_t* sc, int64_t val, int64_t *prev) {
+	return shmcounter_fetch_extreme(sc, val, true, prev);
+}
 
-	/* Unlock the counters */
-	shmmutex_unlock(&(r->mutex));
-	shmmutex_unlock(&(l->mutex));
+int shmcounter_fetch_min(shmcounter_t* sc, int64_t val, int64_t *prev) {
+	return shmcounter_fetch_extreme(sc, val, false, prev);
+}
+
+/** Compare the value of the counter */
+bool shmcounter_isvalue(shmcounter_t* sc, int val) {
+	return (val == shmcounter_load(sc));
+}
 
-	/* End vector critical section */
-	shmmutex_unlock(&(lhs->set->v->shm->lock));
+/** Sleep on the count until it equals target */
+int shmcounter_wait_value(shmcounter_t* sc, int target, const struct timespec *abstime) {
+	if (NULL != sc->shards)
+		return ENOTSUP;
+	shmcounter_hot_t *h = sc->hot;
+	int64_t c = atomic_load(&(h->count));
+	if (c == target)
+		return 0;
 
+	/* Register before rechecking so an updater either sees us or we see its value */
+	int rc = 0;
+	atomic_fetch_add(&(h->waiters), 1);
+	while ((c = atomic_load(&(h->count))) != target) {
+		long s = futex(shmcounter_futex_word(h), FUTEX_WAIT_BITSET, (uint32_t)c, abstime);
+		if (s == -1 && errno == ETIMEDOUT) {
+			rc = ETIMEDOUT;
+			break;
+		}
+		if (s == -1 && errno != EAGAIN && errno != EINTR) {
+			fprintf(stderr, "ERROR: Failure while waiting on counter\n");
+			rc = 1;
+			break;
+		}
+	}
+	atomic_fetch_sub(&(h->waiters), 1);
+	return rc;
+}
+
+int shmcounter_wait_zero(shmcounter_t* sc, const struct timespec *abstime) {
+	return shmcounter_wait_value(sc, 0, abstime);
+}
+
+/** Compare the value of the counter */
+bool shmcounter_isequal_safe(shmcounter_t* lhs, shmcounter_t* rhs) {
+	int64_t lcount, rcount;
+
+	/* Reread lhs until it is unchanged around the rhs load, so both values
+	   were current at the moment rhs was read */
+	do {
+		lcount = shmcounter_load(lhs);
+		atomic_thread_fence(memory_order_seq_cst);
+		rcount = shmcounter_load(rhs);
+		atomic_thread_fence(memory_order_seq_cst);
+	} while (lcount != shmcounter_load(lhs));
 	return (lcount == rcount);
 }
@@ -15,15 +15,28 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "shm_mutex.h"
 #include "shm_vector.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/** Number of counters allowed within a set */
+/** Number of counters allowed within each segment of a set */
 #define SHMCOUNTER_SET_SIZE 2048
 
+/** Number of segments a set can grow to, each holding SHMCOUNTER_SET_SIZE counters */
+#define SHMCOUNTER_MAX_SEGMENTS 16
+
+/** Number of cache-line-padded slots of a sharded counter */
+#define SHMCOUNTER_SHARDS 64
+
+/** Number of sharded counters allowed within a set */
+#define SHMCOUNTER_SHARDED_SIZE 64
+
+/** Number of packed, and of padded, counters allowed within a set */
+#define SHMCOUNTER_HOT_LINES (SHMCOUNTER_SET_SIZE * SHMCOUNTER_MAX_SEGMENTS)
+
 /** Reserved values that cannot be used within the UID */
 #define SHMCOUNTER_RESERVED_GROUP 0xDEADBEEF
 #define SHMCOUNTER_RESERVED_CTYPE 0xDEADBEEF
@@ -41,26 +54,131 @@ typedef struct shmcounter_uid {
     uint64_t lid;
 } shmcounter_uid_t;
 
-/** The data stored within the shared storage for this counter */
-typedef struct shmcounter_data {
-    /* Mutex for this counter */
-    shmmutex_t mutex;
+/** Where the counters created through a set handle keep their count */
+typedef enum shmcounter_layout {
+    /* Packed with the counts of other counters, in the set's segment <name>.counts */
+    SHMCOUNTER_LAYOUT_PACKED = 0,
+    /* On a cache line of its own, in the set's segment <name>.hot */
+    SHMCOUNTER_LAYOUT_PADDED
+} shmcounter_layout_t;
+
+/** The words every update of a counter touches, and those of a barrier using it */
+typedef struct shmcounter_hot {
+    /* Value of this counter. Waiters sleep on its low 32 bits. */
+    int64_t count;
+
+    /* Number of processes sleeping on count in shmcounter_wait_value */
+    uint32_t waiters;
+
+    /* Number of processes a barrier using this counter waits for, 0 for plain counters */
+    uint32_t nprocs;
+
+    /* Barrier sense, flipped by the last arrival of each phase. Futex word. */
+    uint32_t sense;
+
+    /* Number of processes sleeping on sense */
+    uint32_t sleepers;
+} shmcounter_hot_t;
+
+/** The hot words of a padded counter, alone on their cache line */
+typedef struct shmcounter_hot_line {
+    shmcounter_hot_t hot;
+} __attribute__((aligned(SHMVECTOR_CACHELINE))) shmcounter_hot_line_t;
 
+/**
+ * The slot of a counter in the set's hash table. It holds only what
+ * lookups read, so that probes scan a dense region; the count lives in
+ * <name>.counts, <name>.hot or <name>.shards.
+ */
+typedef struct shmcounter_data {
     /* Unique id for this counter */
     shmcounter_uid_t id;
 
     /* Number of active reader/writers for this counter */
-    size_t refcount;
+    uint32_t refcount;
+
+    /* 1 + index of the hot words of a packed counter in <name>.counts, otherwise 0 */
+    uint32_t packed_hot;
+
+    /* 1 + index of the hot line of a padded counter in <name>.hot, otherwise 0 */
+    uint32_t hot_line;
 
-    /* Value of this counter*/
-    int count;
+    /* 1 + index of the shard block of a sharded counter, otherwise 0 */
+    uint32_t shard_block;
 } shmcounter_data_t;
 
-/** Public type for creating a set of shared counters */
+/** One slot of a sharded counter, alone on its cache line */
+typedef struct shmcounter_shard {
+    int64_t count;
+} __attribute__((aligned(SHMVECTOR_CACHELINE))) shmcounter_shard_t;
+
+/** The slots of a sharded counter. Stored in the set's shard segment. */
+typedef struct shmcounter_shard_block {
+    shmcounter_shard_t shards[SHMCOUNTER_SHARDS];
+} shmcounter_shard_block_t;
+
+/**
+ * Public type for creating a set of shared counters. The slots of the set
+ * form an open-addressing hash table keyed by the counter uid, resolved by
+ * linear probing. A deleted counter leaves a tombstone (a free slot holding
+ * the reserved group, ctype and tag) so that later counters on its probe
+ * path stay reachable.
+ *
+ * When every segment is full the set grows by chaining another segment of
+ * the same size, named <name>.1, <name>.2, ... A counter never moves, so
+ * existing handles stay valid. The number of chained segments is the chain
+ * generation of the first segment, and other processes attach to new
+ * segments when they next create a counter. The first segment's lock
+ * protects the whole chain.
+ *
+ * The segments holding packed hot words, hot lines and shard blocks are
+ * created under the set lock by the first counter that needs them, and other processes
+ * attach to them when they create such a counter. Every segment of the set
+ * uses the options the set was created with.
+ */
 typedef struct shmcounter_set {
 	/* A shared memory vector to store data */
 	shmvector_t* v;
 
+	/* Shard blocks of the sharded counters, in segment <name>.shards. NULL until
+	   this process first meets a sharded counter. */
+	shmvector_t* shards;
+
+	/* Name of the shard segment */
+	char* shards_name;
+
+	/* Hot words of the packed counters, in segment <name>.counts. NULL until
+	   this process first meets a packed counter. */
+	shmvector_t* counts;
+
+	/* Name of the packed hot word segment */
+	char* counts_name;
+
+	/* Hot lines of the padded counters, in segment <name>.hot. NULL until this
+	   process first meets a padded counter. */
+	shmvector_t* hot;
+
+	/* Name of the hot line segment */
+	char* hot_name;
+
+	/* Layout of the counters this handle creates */
+	shmcounter_layout_t layout;
+
+	/* Segment options, used for every segment of the set */
+	shmvector_attr_t attr;
+
+	/* Segments attached by this process: segs[0] is v, segs[i] is <name>.i */
+	shmvector_t* segs[SHMCOUNTER_MAX_SEGMENTS];
+
+	/* Names of the chained segments; seg_names[0] is unused */
+	char* seg_names[SHMCOUNTER_MAX_SEGMENTS];
+
+	/* Number of segments attached by this process */
+	uint32_t nsegs;
+
+	/* Name of the first segment */
+	const char* name;
+
 } shmcounter_set_t;
 
 /** Public type for creating a shared counter */
@@ -68,9 +186,18 @@ typedef struct shmcounter {
     /* The counter set this counter belongs to */
     shmcounter_set_t *set;
     
+    /* Segment of the set where the counter value is stored */
+    shmvector_t *v;
+
     /* Index of the vector where the counter value is stored */
     size_t idx;
 
+    /* Slots of a sharded counter, NULL for plain counters */
+    shmcounter_shard_t *shards;
+
+    /* Hot words of a plain counter, packed or on their own line; NULL if sharded */
+    shmcounter_hot_t *hot;
+
 } shmcounter_t;
 
 
@@ -80,18 +207,78 @@ typedef struct shmcounter {
 */
 int shmcounter_set_create(shmcounter_set_t *scs, const char* counterset);
 
+/**
+	Create a counter set with non-default segment options
+	@param scs Struct to fill in
+	@param counterset Name of the shared memory segment to use
+	@param attr Segment options, or NULL for the defaults
+	@return 0 on success, EINVAL if attr->growable is set: a set grows by
+	        chaining segments, since counter handles point into them
+*/
+int shmcounter_set_create_attr(shmcounter_set_t *scs, const char* counterset,
+							   const shmvector_attr_t *attr);
+
+/**
+	Create a counter set whose new counters use the given layout. With
+	SHMCOUNTER_LAYOUT_PADDED the count of each new counter gets a cache line
+	of its own, so processes updating different counters do not invalidate
+	each other's lines. With the default SHMCOUNTER_LAYOUT_PACKED the counts
+	are packed side by side, which takes less memory. Either way the slots
+	keep only the uid and refcount that lookups read. The layout is
+	recorded per counter: counters that already exist keep theirs, and
+	handles with other layouts can share the set.
+	@param scs Struct to fill in
+	@param counterset Name of the shared memory segment to use
+	@param attr Segment options, or NULL for the defaults
+	@param layout Layout of the counters created through scs
+	@return as for shmcounter_set_create_attr
+*/
+int shmcounter_set_create_layout(shmcounter_set_t *scs, const char* counterset,
+								 const shmvector_attr_t *attr, shmcounter_layout_t layout);
+
 /**
  * Release resources associated with this shared memory counter.
  * @param sc Counter struct
 */
 int shmcounter_set_destroy(shmcounter_set_t *scs);
 
+/**
+ * Read the counter set lock statistics without taking the lock.
+ * @param out totals over all processes
+ * @return 0 on success, ENOTSUP if the set does not record statistics
+ */
+int shmcounter_set_stats(shmcounter_set_t *scs, shmmutex_stats_counts_t *out);
+
 /**
 	Create and allocate a new shared counter. Initialize it to 0.
+	Finding an existing counter takes O(1) probes on average.
 	@param sc Struct to fill in
 */
 int shmcounter_create(shmcounter_t *sc, shmcounter_set_t *scs, shmcounter_uid_t cid);
 
+/**
+ * Create a sharded counter, or attach to the counter if cid already exists
+ * (in which case it keeps the mode it was created with). A sharded counter
+ * has SHMCOUNTER_SHARDS slots on separate cache lines; updates add to the
+ * slot of the CPU they run on, and reads sum the slots. This keeps counters
+ * updated by every process from bouncing one cache line between CPUs, at
+ * the cost of slower reads. Sharded counters do not support set_if_zero or
+ * wait_value, and a value read during updates need not have existed at any
+ * single instant.
+ * @param sc Struct to fill in
+ * @return 0 on success, non-zero if the set or its shard blocks are full
+ */
+int shmcounter_create_sharded(shmcounter_t *sc, shmcounter_set_t *scs, shmcounter_uid_t cid);
+
+/**
+ * Create or attach to n counters of a set, holding the set lock once for
+ * all of them. Either every counter is created or none is.
+ * @param scv Array of n structs to fill in
+ * @param cids Ids of the counters
+ * @return 0 on success, non-zero if the set is full and cannot grow
+ */
+int shmcounter_create_n(shmcounter_t *scv, shmcounter_set_t *scs, const shmcounter_uid_t *cids,
+						size_t n);
 /**
  * Release resources associated with this shared memory counter.
  * @param sc Counter struct
@@ -99,7 +286,24 @@ int shmcounter_create(shmcounter_t *sc, shmcounter_set_t *scs, shmcounter_uid_t
 int shmcounter_destroy(shmcounter_t *sc);
 
 /**
- * Increment the counter
+ * Release n counters, holding the set lock once for all of them
+ * @param scv Array of n counters, which must all belong to one set
+ * @return 0 on success, EINVAL if the counters belong to different sets
+ */
+int shmcounter_destroy_n(shmcounter_t *scv, size_t n);
+
+/**
+ * Add vals[i] to counter i, as shmcounter_inc_safe does for each. The
+ * updates take no lock, but are separate atomic operations: readers may
+ * see some of them before others.
+ * @param scv Array of n counters
+ * @param vals Array of n deltas, negative to decrement
+ */
+void shmcounter_add_n(shmcounter_t* scv, const int *vals, size_t n);
+
+/**
+ * Increment the counter with an atomic add. No lock is taken; the caller's
+ * reference keeps the counter from being deleted.
  * @param sc Counter struct
  * @param val Amount to increment counter
  */
@@ -113,17 +317,61 @@ void shmcounter_inc_safe(shmcounter_t* sc, int val);
 void shmcounter_dec_safe(shmcounter_t* sc, int val);
 
 /**
- * @return true if the value was 0 and the value is now val. Otherwise false.
+ * Compare-and-swap the counter from 0 to val
+ * @return true if the value was 0 and the value is now val. Otherwise false,
+ *         always for sharded counters.
  * @param sc Counter struct
  * @param val Value to set the counter to
  */
 bool shmcounter_set_if_zero_safe(shmcounter_t* sc, int val);
 
 /** 
- * @return the value of the counter 
+ * @return the value of the counter, the sum of the slots if sharded,
+ *         truncated to an int
  */
 int shmcounter_value(shmcounter_t* sc);
 
+/**
+ * @return the 64 bit value of the counter, the sum of the slots if sharded
+ */
+int64_t shmcounter_value64(shmcounter_t* sc);
+
+/**
+ * Atomically add val to the counter
+ * @param[out] prev the value before the addition
+ * @return 0, ENOTSUP for sharded counters
+ */
+int shmcounter_fetch_add(shmcounter_t* sc, int64_t val, int64_t *prev);
+
+/**
+ * Atomically set the counter to desired if it equals expected
+ * @param[out] prev the value before the operation; the swap happened if
+ *             it equals expected
+ * @return 0, ENOTSUP for sharded counters
+ */
+int shmcounter_cas(shmcounter_t* sc, int64_t expected, int64_t desired, int64_t *prev);
+
+/**
+ * Atomically set the counter to val
+ * @param[out] prev the value before the operation
+ * @return 0, ENOTSUP for sharded counters
+ */
+int shmcounter_exchange(shmcounter_t* sc, int64_t val, int64_t *prev);
+
+/**
+ * Atomically raise the counter to val if it is smaller
+ * @param[out] prev the value before the operation
+ * @return 0, ENOTSUP for sharded counters
+ */
+int shmcounter_fetch_max(shmcounter_t* sc, int64_t val, int64_t *prev);
+
+/**
+ * Atomically lower the counter to val if it is larger
+ * @param[out] prev the value before the operation
+ * @return 0, ENOTSUP for sharded counters
+ */
+int shmcounter_fetch_min(shmcounter_t* sc, int64_t val, int64_t *prev);
+
 /**
  * Compare the value of the counter
  * @param sc Counter struct
@@ -133,12 +381,30 @@ int shmcounter_value(shmcounter_t* sc);
 bool shmcounter_isvalue(shmcounter_t* sc, int val);
 
 /**
- * Compare two counters for equality with mutex safety
+ * Sleep until the counter equals target. The counter's count is the futex
+ * word; counter updates only enter the kernel to wake when a process waits.
+ * A value that passes through target between wakeups may be missed, as
+ * may a change of the count by a multiple of 2^32 while going to sleep.
+ * @param sc Counter struct
+ * @param target Value to wait for
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 once the counter equals target, ETIMEDOUT if the deadline passed,
+ *         ENOTSUP for sharded counters
+ */
+int shmcounter_wait_value(shmcounter_t* sc, int target, const struct timespec *abstime);
+
+/**
+ * Sleep until the counter is 0, see shmcounter_wait_value
+ * @return 0 once the counter is 0, ETIMEDOUT if the deadline passed
+ */
+int shmcounter_wait_zero(shmcounter_t* sc, const struct timespec *abstime);
+
+/**
+ * Compare two counters for equality without locking. lhs is reread until it
+ * is unchanged around the read of rhs, so both values held at one instant.
  * @param lhs Counter struct
  * @param rhs Counter struct
  * @return true if the counters have the same value, otherwise false
- * 
- * @note Currently assumes both counters are from the same counter set.
  */
 bool shmcounter_isequal_safe(shmcounter_t* lhs, shmcounter_t* rhs);
 
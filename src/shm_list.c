@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -83,20 +85,81 @@ static void* shmlist_malloc_copy_data(shmlist_t* sl, shmlist_ele_t* node) {
     return ele;
 }
 
+/*
+    Rebuild the list after a process died while modifying it. The next links
+    from the dummy head are trusted up to the first link that leaves the list,
+    the prev links are rebuilt from them, and unreachable nodes are freed.
+*/
+static void shmlist_repair(shmvector_t *sv, void *arg) {
+    /* Everything the repair needs is in the segment */
+    (void)arg;
+    shmlist_ele_t *dummy = shmvector_at(sv, 0);
+    if (NULL == dummy)
+        return;
+    size_t capacity = sv->shm->capacity;
+    bool *reached = calloc(capacity, sizeof(bool));
+    if (NULL == reached)
+        return;
+
+    /* Walk the next links, stopping at a dangling or repeated index */
+    size_t prev = 0;
+    size_t iter = dummy->next_idx;
+    reached[0] = true;
+    while (iter != 0) {
+        shmlist_ele_t *item = (iter < capacity) ? shmvector_at(sv, iter) : NULL;
+        if (NULL == item || reached[iter]) {
+            ((shmlist_ele_t*)shmvector_at(sv, prev))->next_idx = 0;
+            break;
+        }
+        reached[iter] = true;
+        item->idx = iter;
+        item->prev_idx = prev;
+        prev = iter;
+        iter = item->next_idx;
+    }
+    dummy->prev_idx = prev;
+
+    /* Release nodes that were allocated but never linked, or half unlinked */
+    for (size_t i = 1; i < capacity; i++) {
+        if (!reached[i])
+            shmvector_del(sv, i);
+    }
+    free(reached);
+}
+
+/* Lock the list without waiting if try is set, otherwise until abstime (NULL waits forever) */
+static int shmlist_lock_until(shmlist_t *sl, bool try, const struct timespec *abstime) {
+    if (try)
+        return shmvector_trylock(sl->v);
+    return shmvector_timedlock(sl->v, abstime);
+}
+
 /* 
     Create and allocate a new shared memory list 
     Note: We keep an empty value at the beginning of the list
         that is not the user's list "head"
 */
 int shmlist_create(shmlist_t *sl, const char* segname, size_t elesz, size_t sz) {
+    return shmlist_create_attr(sl, segname, elesz, sz, NULL);
+}
+
+/* Create and allocate a new shared memory list with segment options */
+int shmlist_create_attr(shmlist_t *sl, const char* segname, size_t elesz, size_t sz,
+                        const shmvector_attr_t *attr) {
+    /* Growth may move the segment, invalidating the element pointers we hand out */
+    if (NULL != attr && attr->growable)
+        return EINVAL;
+
     /* Create the vector */
     shmvector_t *v = malloc(sizeof(shmvector_t));
     /* Vector size must be at least 1 to support empty lists */
-    shmvector_create(v, segname, sizeof(shmlist_ele_t) + elesz, sz + 1);
+    shmvector_create_attr(v, segname, sizeof(shmlist_ele_t) + elesz, sz + 1, attr);
+    v->repair = &shmlist_repair;
+    v->repair_arg = sl;
     sl->v = v;
 
     /* Critical section: initialize the head once */
-    int rc = shmmutex_lock(&(sl->v->shm->lock));
+    int rc = shmvector_lock(sl->v);
     if (rc != 0) {
         fprintf(stderr, "Mutex lock failed: %s\n", __func__);
         abort();
@@ -112,7 +175,7 @@ int shmlist_create(shmlist_t *sl, const char* segname, size_t elesz, size_t sz)
     /* Set the pointer to the dummy idx */
     sl->cur_idx_unsafe = 0;
 
-    shmmutex_unlock(&(sl->v->shm->lock));
+    shmvector_unlock(sl->v);
     return 0;
 }
 
@@ -125,16 +188,18 @@ int shmlist_destroy(shmlist_t *sl) {
 /**
  * Add a copy of ele to the tail of the list
  */
-int shmlist_add_tail_safe(shmlist_t* sl, void* ele_data) {
-    int rc = 0;
-
-    shmmutex_lock(&(sl->v->shm->lock));
+static int shmlist_add_tail_until(shmlist_t* sl, void* ele_data, bool try,
+                                  const struct timespec *abstime) {
+    int rc = shmlist_lock_until(sl, try, abstime);
+    if (0 != rc)
+        return rc;
 
     /* Create the new list node */
     int tidx = shmvector_insert_quick(sl->v);
     if (tidx <= 0) {
         rc = 1;
         fprintf(stderr, "ERROR: Shared %s failed.\n", __FUNCTION__);
+        shmvector_unlock(sl->v);
         return rc;
     }
     void* ntail = shmvector_at(sl->v, tidx);
@@ -148,17 +213,32 @@ int shmlist_add_tail_safe(shmlist_t* sl, void* ele_data) {
     /* List now points at the new tail */
     sl->cur_idx_unsafe = tidx;
 
-    shmmutex_unlock(&(sl->v->shm->lock));
+    /* Hand the element to a consumer blocked in extract_head_wait */
+    shmvector_signal(sl->v);
+    shmvector_unlock(sl->v);
 
     return rc;
 }
 
+int shmlist_add_tail_safe(shmlist_t* sl, void* ele_data) {
+    return shmlist_add_tail_until(sl, ele_data, false, NULL);
+}
+
+int shmlist_add_tail_try(shmlist_t* sl, void* ele_data) {
+    return shmlist_add_tail_until(sl, ele_data, true, NULL);
+}
+
+int shmlist_add_tail_timed(shmlist_t* sl, void* ele_data, const struct timespec *abstime) {
+    return shmlist_add_tail_until(sl, ele_data, false, abstime);
+}
+
 /**
  * Delete this element from the list. This function is difficult to use correctly.
  */
-int shmlist_del_safe(shmlist_t* sl) {
-    int rc = 0;
-    shmmutex_lock(&(sl->v->shm->lock));
+static int shmlist_del_until(shmlist_t* sl, bool try, const struct timespec *abstime) {
+    int rc = shmlist_lock_until(sl, try, abstime);
+    if (0 != rc)
+        return rc;
     /* Deleting the dummy node at the list beginning is a no-op */
     if (sl->cur_idx_unsafe != 0) {
         
@@ -175,10 +255,22 @@ int shmlist_del_safe(shmlist_t* sl) {
         sl->cur_idx_unsafe = adj_next_idx;
     }
  
-    shmmutex_unlock(&(sl->v->shm->lock));
+    shmvector_unlock(sl->v);
     return rc;
 }
 
+int shmlist_del_safe(shmlist_t* sl) {
+    return shmlist_del_until(sl, false, NULL);
+}
+
+int shmlist_del_try(shmlist_t* sl) {
+    return shmlist_del_until(sl, true, NULL);
+}
+
+int shmlist_del_timed(shmlist_t* sl, const struct timespec *abstime) {
+    return shmlist_del_until(sl, false, abstime);
+}
+
 /**
  * @return true if the list is empty
  */
@@ -187,37 +279,76 @@ int shmlist_is_empty(shmlist_t *sl) {
     return (0 == hnext);
 }
 
+/** Remove the head of a non-empty list, called with the list lock held */
+static void shmlist_extract_head_locked(shmlist_t *sl, void** head_data) {
+    /* Retrieve the head */
+    size_t hidx = shmlist_get_next_idx(sl, 0);
+    shmlist_ele_t *phead = shmvector_at(sl->v, hidx);
+
+    /* Splice out the head */
+    shmlist_set_next_idx(sl, 0, phead->next_idx);
+    shmlist_set_prev_idx(sl, phead->next_idx, phead->prev_idx);
+
+    /* Make a local copy of phead data */
+    *head_data = shmlist_malloc_copy_data(sl, phead);
+    
+    /* Mark the phead memory as available for reuse */
+    shmvector_del(sl->v, phead->idx);
+}
+
 /** return Remove head from list and return a local copy  */
-int shmlist_extract_head_safe(shmlist_t *sl, void** head_data) {
-    shmmutex_lock(&(sl->v->shm->lock));
-    int rc = 0;
+static int shmlist_extract_head_until(shmlist_t *sl, void** head_data, bool try,
+                                      const struct timespec *abstime) {
+    int rc = shmlist_lock_until(sl, try, abstime);
+    if (0 != rc)
+        return rc;
     if (shmlist_is_empty(sl)) {
         rc = 1;
     }
     else {
-        /* Retrieve the head */
-        size_t hidx = shmlist_get_next_idx(sl, 0);
-        shmlist_ele_t *phead = shmvector_at(sl->v, hidx);
-
-        /* Splice out the head */
-        shmlist_set_next_idx(sl, 0, phead->next_idx);
-        shmlist_set_prev_idx(sl, phead->next_idx, phead->prev_idx);
-
-        /* Make a local copy of phead data */
-        *head_data = shmlist_malloc_copy_data(sl, phead);
-        
-        /* Mark the phead memory as available for reuse */
-        shmvector_del(sl->v, phead->idx);
+        shmlist_extract_head_locked(sl, head_data);
     }
-    shmmutex_unlock(&(sl->v->shm->lock));
+    shmvector_unlock(sl->v);
     return rc;
 }
 
+/** Sleep until the list has a head, then remove it and return a local copy */
+int shmlist_extract_head_wait(shmlist_t *sl, void** head_data, const struct timespec *abstime) {
+    int rc = shmlist_lock_until(sl, false, abstime);
+    if (0 != rc)
+        return rc;
+    while (shmlist_is_empty(sl)) {
+        rc = shmvector_wait(sl->v, abstime);
+        if (0 != rc) {
+            shmvector_unlock(sl->v);
+            return rc;
+        }
+    }
+    shmlist_extract_head_locked(sl, head_data);
+    shmvector_unlock(sl->v);
+    return 0;
+}
+
+int shmlist_extract_head_safe(shmlist_t *sl, void** head_data) {
+    return shmlist_extract_head_until(sl, head_data, false, NULL);
+}
+
+int shmlist_extract_head_try(shmlist_t *sl, void** head_data) {
+    return shmlist_extract_head_until(sl, head_data, true, NULL);
+}
+
+int shmlist_extract_head_timed(shmlist_t *sl, void** head_data, const struct timespec *abstime) {
+    return shmlist_extract_head_until(sl, head_data, false, abstime);
+}
+
 /** Remove matching element from list and return a local copy of the data */
-int shmlist_extract_first_match_safe(shmlist_t *sl, void* cmpvalue, shmlist_elecmp_fn elecmp, void** match) {
+static int shmlist_extract_first_match_until(shmlist_t *sl, void* cmpvalue, shmlist_elecmp_fn elecmp,
+                                             void** match, bool try, const struct timespec *abstime) {
 
-    int rc = 1;
-    shmmutex_lock(&(sl->v->shm->lock));
+    int rc = shmlist_lock_until(sl, try, abstime);
+    if (0 != rc)
+        return rc;
+    rc = 1;
     size_t iter = shmlist_get_next_idx(sl, 0);
     while (iter != 0) {
         shmlist_ele_t *item = shmvector_at(sl->v, iter);
@@ -237,20 +368,57 @@ int shmlist_extract_first_match_safe(shmlist_t *sl, void* cmpvalue, shmlist_elec
         }
         iter = shmlist_get_next_idx(sl, iter);
     }
-    shmmutex_unlock(&(sl->v->shm->lock));
+    shmvector_unlock(sl->v);
     return rc;
 }
 
-/** return an array of matches up to the supplied max */
-int shmlist_extract_n_matches_safe(shmlist_t *sl, size_t match_max, void *cmpvalue, shmlist_elecmp_fn elecmp, 
-								   size_t* elecnt, void **ele) {
+int shmlist_extract_first_match_safe(shmlist_t *sl, void* cmpvalue, shmlist_elecmp_fn elecmp, void** match) {
+    return shmlist_extract_first_match_until(sl, cmpvalue, elecmp, match, false, NULL);
+}
+
+int shmlist_extract_first_match_try(shmlist_t *sl, void* cmpvalue, shmlist_elecmp_fn elecmp, void** match) {
+    return shmlist_extract_first_match_until(sl, cmpvalue, elecmp, match, true, NULL);
+}
+
+int shmlist_extract_first_match_timed(shmlist_t *sl, void* cmpvalue, shmlist_elecmp_fn elecmp, void** match,
+                                      const struct timespec *abstime) {
+    return shmlist_extract_first_match_until(sl, cmpvalue, elecmp, match, false, abstime);
+}
+
+/** Return a local copy of the first matching element, sharing the list with other readers */
+int shmlist_find_first_match_shared(shmlist_t *sl, void* cmpvalue, shmlist_elecmp_fn elecmp, void** match) {
+
     int rc = 1;
+    shmvector_lock_shared(sl->v);
+    size_t iter = shmlist_get_next_idx(sl, 0);
+    while (iter != 0) {
+        shmlist_ele_t *item = shmvector_at(sl->v, iter);
+        if (0 == elecmp(cmpvalue, shmlist_ele_get_data(item))) {
+            *match = shmlist_malloc_copy_data(sl, item);
+            rc = 0;
+            break;
+        }
+        iter = shmlist_get_next_idx(sl, iter);
+    }
+    shmvector_unlock_shared(sl->v);
+    return rc;
+}
+
+/** return an array of matches up to the supplied max */
+static int shmlist_extract_n_matches_until(shmlist_t *sl, size_t match_max, void *cmpvalue,
+                                           shmlist_elecmp_fn elecmp, size_t* elecnt, void **ele,
+                                           bool try, const struct timespec *abstime) {
+    int rc = shmlist_lock_until(sl, try, abstime);
+    if (0 != rc) {
+        *elecnt = 0;
+        return rc;
+    }
+    rc = 1;
 
     /* Create an array to hold matching indexes */
     size_t *idx_matches = calloc(match_max, sizeof(size_t));
     size_t match_cnt = 0;
 
-    shmmutex_lock(&(sl->v->shm->lock));
     size_t iter = shmlist_get_next_idx(sl, 0);
     while (iter != 0 && match_cnt < match_max) {
         shmlist_ele_t *item = shmvector_at(sl->v, iter);
@@ -282,7 +450,7 @@ int shmlist_extract_n_matches_safe(shmlist_t *sl, size_t match_max, void *cmpval
         }
         rc = 0;
     }
-    shmmutex_unlock(&(sl->v->shm->lock));
+    shmvector_unlock(sl->v);
 
     /* Free local resources */
     free(idx_matches);
@@ -291,10 +459,30 @@ int shmlist_extract_n_matches_safe(shmlist_t *sl, size_t match_max, void *cmpval
 
 }
 
+int shmlist_extract_n_matches_safe(shmlist_t *sl, size_t match_max, void *cmpvalue, shmlist_elecmp_fn elecmp, 
+								   size_t* elecnt, void **ele) {
+    return shmlist_extract_n_matches_until(sl, match_max, cmpvalue, elecmp, elecnt, ele, false, NULL);
+}
+
+int shmlist_extract_n_matches_try(shmlist_t *sl, size_t match_max, void *cmpvalue, shmlist_elecmp_fn elecmp, 
+								  size_t* elecnt, void **ele) {
+    return shmlist_extract_n_matches_until(sl, match_max, cmpvalue, elecmp, elecnt, ele, true, NULL);
+}
+
+int shmlist_extract_n_matches_timed(shmlist_t *sl, size_t match_max, void *cmpvalue, shmlist_elecmp_fn elecmp, 
+								    size_t* elecnt, void **ele, const struct timespec *abstime) {
+    return shmlist_extract_n_matches_until(sl, match_max, cmpvalue, elecmp, elecnt, ele, false, abstime);
+}
+
+/** Read the list lock statistics */
+int shmlist_stats(shmlist_t *sl, shmmutex_stats_counts_t *out) {
+    return shmvector_stats(sl->v, out);
+}
+
 /** return the length of the list  */
 int shmlist_length(shmlist_t *sl) {
     /* Get the number of live elements in the vector minus the empty list head */
-    return sl->v->shm->active_count - 1;
+    return shmvector_size(sl->v) - 1;
 }
 
 /** return a pointer to the list head element */
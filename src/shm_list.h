@@ -49,6 +49,19 @@ typedef struct shmlist {
 */
 int shmlist_create(shmlist_t *sl, const char* segname, size_t elesz, size_t sz);
 
+/**
+	Create and allocate a new shared memory list with non-default segment options
+	@param sl Struct to fill in
+	@param segname Name of the shared memory segment to use
+	@param elesz Size of each list element
+	@param sz Number of list elements to preallocate
+	@param attr Segment options, or NULL for the defaults
+	@return 0 on success, EINVAL if attr->growable is set: a list hands out
+	        pointers into its segment, so the segment cannot move
+*/
+int shmlist_create_attr(shmlist_t *sl, const char* segname, size_t elesz, size_t sz,
+						const shmvector_attr_t *attr);
+
 /**
  * Release resources associated with this shared memory list
 */
@@ -59,11 +72,41 @@ int shmlist_destroy(shmlist_t *sl);
  */
 int shmlist_add_tail_safe(shmlist_t* sl, void* ele);
 
+/**
+ * add_tail_safe() that fails instead of waiting for the list lock
+ * @return 0 if a copy of ele was added to the list tail, EBUSY if the lock
+ *         is held, otherwise non-zero
+ */
+int shmlist_add_tail_try(shmlist_t* sl, void* ele);
+
+/**
+ * add_tail_safe() that gives up waiting for the list lock at a deadline
+ * @param abstime deadline on CLOCK_MONOTONIC
+ * @return 0 if a copy of ele was added to the list tail, ETIMEDOUT if the
+ *         deadline passed, otherwise non-zero
+ */
+int shmlist_add_tail_timed(shmlist_t* sl, void* ele, const struct timespec *abstime);
+
 /**
  * @return 0 if element was deleted from list, otherwise non-zero
  */
 int shmlist_del_safe(shmlist_t* sl);
 
+/**
+ * del_safe() that fails instead of waiting for the list lock
+ * @return 0 if element was deleted from list, EBUSY if the lock is held,
+ *         otherwise non-zero
+ */
+int shmlist_del_try(shmlist_t* sl);
+
+/**
+ * del_safe() that gives up waiting for the list lock at a deadline
+ * @param abstime deadline on CLOCK_MONOTONIC
+ * @return 0 if element was deleted from list, ETIMEDOUT if the deadline
+ *         passed, otherwise non-zero
+ */
+int shmlist_del_timed(shmlist_t* sl, const struct timespec *abstime);
+
 /**
  * @return true if the list is empty
  */
@@ -76,6 +119,26 @@ int shmlist_is_empty(shmlist_t *sl);
  */
 int shmlist_extract_head_safe(shmlist_t *sl, void** head);
 
+/**
+ * extract_head_safe() that fails with EBUSY instead of waiting for the list lock
+ */
+int shmlist_extract_head_try(shmlist_t *sl, void** head);
+
+/**
+ * extract_head_safe() that fails with ETIMEDOUT if the list lock is not
+ * acquired by the CLOCK_MONOTONIC deadline abstime
+ */
+int shmlist_extract_head_timed(shmlist_t *sl, void** head, const struct timespec *abstime);
+
+/**
+ * extract_head_safe() that sleeps until an element is added instead of
+ * failing on an empty list. add_tail wakes one sleeping consumer per element.
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 if the head was removed, ETIMEDOUT if the deadline passed,
+ *         ENOTSUP if the list uses a reader-writer lock, otherwise non-zero
+ */
+int shmlist_extract_head_wait(shmlist_t *sl, void** head, const struct timespec *abstime);
+
 /**
  * Remove matching element from list and return a local copy of the data
  * @return 0 if an element was matched and returned, non-zero if no match was found
@@ -86,6 +149,29 @@ int shmlist_extract_head_safe(shmlist_t *sl, void** head);
  */
 int shmlist_extract_first_match_safe(shmlist_t *sl, void *value, shmlist_elecmp_fn elecmp, void **ele);
 
+/**
+ * extract_first_match_safe() that fails with EBUSY instead of waiting for the list lock
+ */
+int shmlist_extract_first_match_try(shmlist_t *sl, void *value, shmlist_elecmp_fn elecmp, void **ele);
+
+/**
+ * extract_first_match_safe() that fails with ETIMEDOUT if the list lock is
+ * not acquired by the CLOCK_MONOTONIC deadline abstime
+ */
+int shmlist_extract_first_match_timed(shmlist_t *sl, void *value, shmlist_elecmp_fn elecmp, void **ele,
+									  const struct timespec *abstime);
+
+/**
+ * Find a matching element and return a local copy of the data without
+ * removing it. Holds the list lock for reading only.
+ * @return 0 if an element was matched and returned, non-zero if no match was found
+ * @param[in] sl List struct
+ * @param[in] value value to pass to lhs of comparison function
+ * @param[in] elecmp Element comparison function
+ * @param[out] ele a locally allocated copy of match (caller must free this memory)
+ */
+int shmlist_find_first_match_shared(shmlist_t *sl, void *value, shmlist_elecmp_fn elecmp, void **ele);
+
 /**
  * Remove up to n matching elements from list and return local copies of the data
  * @return 0 if an element was matched and returned, non-zero if no match was found
@@ -99,6 +185,26 @@ int shmlist_extract_first_match_safe(shmlist_t *sl, void *value, shmlist_elecmp_
 int shmlist_extract_n_matches_safe(shmlist_t *sl, size_t match_max, void *value, shmlist_elecmp_fn elecmp, 
 								   size_t* elecnt, void **ele);
 
+/**
+ * extract_n_matches_safe() that fails with EBUSY instead of waiting for the list lock
+ */
+int shmlist_extract_n_matches_try(shmlist_t *sl, size_t match_max, void *value, shmlist_elecmp_fn elecmp, 
+								  size_t* elecnt, void **ele);
+
+/**
+ * extract_n_matches_safe() that fails with ETIMEDOUT if the list lock is
+ * not acquired by the CLOCK_MONOTONIC deadline abstime
+ */
+int shmlist_extract_n_matches_timed(shmlist_t *sl, size_t match_max, void *value, shmlist_elecmp_fn elecmp, 
+								    size_t* elecnt, void **ele, const struct timespec *abstime);
+
+/**
+ * Read the list lock statistics without taking the lock
+ * @param out totals over all processes
+ * @return 0 on success, ENOTSUP if the list does not record statistics
+ */
+int shmlist_stats(shmlist_t *sl, shmmutex_stats_counts_t *out);
+
 /**
  * @return the length of the list
  */
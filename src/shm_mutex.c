@@ -1,8 +1,15 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
@@ -11,6 +18,11 @@
 #include <sys/time.h>
 #include "shm_mutex.h"
 
+#ifdef SHMMUTEX_STATS
+/** Futex waits made by the calling thread, sampled around each acquisition */
+static __thread uint64_t shmmutex_futex_waits = 0;
+#endif
+
 /** 
  * Wrapper for the futex system call
  * 
@@ -23,34 +35,238 @@
 */
 static int futex(uint32_t *uaddr, int op, uint32_t val,
                  const struct timespec *timeout, uint32_t *uaddr2, uint32_t val3) {
+#ifdef SHMMUTEX_STATS
+    if (op == FUTEX_WAIT || op == FUTEX_WAIT_BITSET || op == FUTEX_LOCK_PI || op == FUTEX_LOCK_PI2)
+        shmmutex_futex_waits++;
+#endif
     return syscall(SYS_futex, uaddr, op, val, timeout, uaddr2, val3);
 }
 
+/** Longest backoff, in pause instructions, used by the spin mutex */
+#define SHMMUTEX_SPIN_MAX_BACKOFF 1024
+
+/** Pause instructions per queue position a ticket waiter backs off */
+#define SHMMUTEX_TICKET_BACKOFF 64
+
+/** Pause instructions a ticket waiter may spend backing off before it sleeps */
+#define SHMMUTEX_TICKET_SPIN_BUDGET 4096
+
+/** Tell the CPU we are in a spin-wait loop */
+static inline void shmmutex_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/** @return true once the CLOCK_MONOTONIC deadline has passed. NULL never expires. */
+static bool shmmutex_expired(const struct timespec *abstime) {
+    struct timespec now;
+    if (NULL == abstime)
+        return false;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > abstime->tv_sec ||
+           (now.tv_sec == abstime->tv_sec && now.tv_nsec >= abstime->tv_nsec);
+}
+
+/** Distance from the robust list entry to the owner futex, as the kernel expects */
+#define SHMMUTEX_ROBUST_FUTEX_OFFSET \
+    ((long)offsetof(shmmutex_t, owner) - (long)offsetof(shmmutex_t, robust_next))
+
+/** Robust list head registered by us when the C library has not registered one */
+static __thread struct {
+    void* prev;
+    struct robust_list_head head;
+} shmmutex_own_head;
+
+/** Robust list head of the calling thread, NULL until first use */
+static __thread struct robust_list_head* shmmutex_robust_head = NULL;
+
+/** Cached TID of the calling thread, 0 until first use */
+static __thread uint32_t shmmutex_tid = 0;
+
+/** The child of a fork is a new thread with an empty robust list */
+static void shmmutex_atfork_child(void) {
+    shmmutex_robust_head = NULL;
+    shmmutex_tid = 0;
+}
+
+/** Register fork handling once per process */
+static void shmmutex_robust_init(void) {
+    pthread_atfork(NULL, NULL, shmmutex_atfork_child);
+}
+
+/** @return the calling thread's TID, the value kept in TID-valued lock words */
+static inline uint32_t shmmutex_gettid(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    if (0 == shmmutex_tid) {
+        pthread_once(&once, shmmutex_robust_init);
+        shmmutex_tid = syscall(SYS_gettid);
+    }
+    return shmmutex_tid;
+}
+
+/** 
+ * @return the calling thread's robust list head, registering one if needed,
+ *         or NULL if the registered list is incompatible with shmmutex_t
+ */
+static struct robust_list_head* shmmutex_get_robust_head(void) {
+    struct robust_list_head* head = NULL;
+    size_t len;
+
+    if (NULL != shmmutex_robust_head)
+        return shmmutex_robust_head;
+    shmmutex_gettid();
+
+    /* Share the list glibc registers for its robust mutexes when present */
+    if (0 == syscall(SYS_get_robust_list, 0, &head, &len) && NULL != head) {
+        if (head->futex_offset != SHMMUTEX_ROBUST_FUTEX_OFFSET) {
+            fprintf(stderr, "ERROR: Robust futex list layout is incompatible\n");
+            return NULL;
+        }
+    }
+    else {
+        head = &shmmutex_own_head.head;
+        head->list.next = &head->list;
+        head->futex_offset = SHMMUTEX_ROBUST_FUTEX_OFFSET;
+        head->list_op_pending = NULL;
+        shmmutex_own_head.prev = head;
+        if (0 != syscall(SYS_set_robust_list, head, sizeof(struct robust_list_head))) {
+            fprintf(stderr, "ERROR: Failed to register robust futex list\n");
+            return NULL;
+        }
+    }
+    shmmutex_robust_head = head;
+    return head;
+}
+
+/** Entries point at the next pointer; the prev pointer sits just before it */
+static inline void** shmmutex_robust_prev_slot(void* entry) {
+    return (void**)(((uintptr_t)entry & ~1ul) - sizeof(void*));
+}
+
+/** @return the robust list entry of the mutex; the kernel expects PI entries tagged with bit 0 */
+static inline struct robust_list* shmmutex_robust_entry(shmmutex_t *sm) {
+    return (struct robust_list*)((uintptr_t)&sm->robust_next | (sm->type == SHMMUTEX_TYPE_PI));
+}
+
+/** Link a held robust or PI mutex at the front of the thread's robust list */
+static void shmmutex_robust_enqueue(struct robust_list_head* head, shmmutex_t *sm) {
+    void* first = head->list.next;
+    sm->robust_next = first;
+    sm->robust_prev = &head->list;
+    *shmmutex_robust_prev_slot(first) = &sm->robust_next;
+    head->list.next = shmmutex_robust_entry(sm);
+}
+
+/** Unlink a robust mutex from the thread's robust list */
+static void shmmutex_robust_dequeue(shmmutex_t *sm) {
+    *shmmutex_robust_prev_slot(sm->robust_next) = sm->robust_prev;
+    *(void**)((uintptr_t)sm->robust_prev & ~1ul) = sm->robust_next;
+    sm->robust_next = sm->robust_prev = NULL;
+}
+
+/** Set once FUTEX_LOCK_PI2 has failed with ENOSYS */
+static bool shmmutex_no_lock_pi2 = false;
+
+/** Convert a CLOCK_MONOTONIC deadline to the CLOCK_REALTIME one FUTEX_LOCK_PI measures */
+static const struct timespec* shmmutex_realtime_deadline(const struct timespec *abstime,
+                                                         struct timespec *out) {
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t ns = (int64_t)(abstime->tv_sec - mono.tv_sec) * 1000000000 +
+                 (abstime->tv_nsec - mono.tv_nsec) + real.tv_nsec;
+    out->tv_sec = real.tv_sec + ns / 1000000000;
+    out->tv_nsec = ns % 1000000000;
+    if (out->tv_nsec < 0) {
+        out->tv_sec--;
+        out->tv_nsec += 1000000000;
+    }
+    return out;
+}
+
+/** Give up the PI owner futex, handing it to the highest priority waiter */
+static int shmmutex_pi_release_owner(shmmutex_t *sm) {
+    /* Fast path: no waiters, so no priority was lent to us */
+    uint32_t o = shmmutex_gettid();
+    if (atomic_compare_exchange_strong(&(sm->owner), &o, 0))
+        return 0;
+    if (-1 == futex(&(sm->owner), FUTEX_UNLOCK_PI, 0, NULL, NULL, 0)) {
+        fprintf(stderr, "ERROR: Failure while release lock\n");
+        return 1;
+    }
+    return 0;
+}
+
+/** Stop tracking a held PI mutex on the robust list and give up its owner futex */
+static int shmmutex_pi_release(shmmutex_t *sm) {
+    struct robust_list_head* head = shmmutex_get_robust_head();
+    if (NULL == head)
+        return 1;
+    head->list_op_pending = shmmutex_robust_entry(sm);
+    shmmutex_robust_dequeue(sm);
+    int rc = shmmutex_pi_release_owner(sm);
+    head->list_op_pending = NULL;
+    return rc;
+}
+
 /* Create the mutex variable and make it available. Called from 1 process only. */
 int shmmutex_create(shmmutex_t *sm) {
-    sm->val = SHMMUTEX_LOCK_AVAILABLE;
+    atomic_store(&(sm->val), SHMMUTEX_LOCK_AVAILABLE);
     return 0;
 }
 
+/* Create a mutex of a specific type. Called from 1 process only. */
+int shmmutex_create_type(shmmutex_t *sm, uint32_t type) {
+    if (type > SHMMUTEX_TYPE_PI)
+        return 1;
+    sm->type = type;
+    sm->owner = 0;
+    sm->spins = 0;
+    sm->ticket = 0;
+    sm->serving = 0;
+    sm->sleepers = 0;
+    /* Publish the type before anyone can acquire the lock */
+    return shmmutex_create(sm);
+}
+
 /* Destroy the mutex. This can be safely called by all processes */
 int shmmutex_destroy(shmmutex_t *sm) {
     /* Ensure no one is holding the lock and then set it to NOTREADY */
     int rc = 0;
     long s;
 
+    /* Robust, PI and ticket holders do not wait on val; take the lock properly */
+    if ((sm->type == SHMMUTEX_TYPE_ROBUST || sm->type == SHMMUTEX_TYPE_PI ||
+         sm->type == SHMMUTEX_TYPE_TICKET) && sm->val != SHMMUTEX_LOCK_NOTREADY) {
+        shmmutex_lock(sm);
+        return shmmutex_destroy_if_locked(sm);
+    }
+
     /* All destroyers race to be the first to safely set lock to NOTRREADY */
-    while (sm->val != SHMMUTEX_LOCK_NOTREADY) {
+    uint32_t c = sm->val;
+    while (c != SHMMUTEX_LOCK_NOTREADY) {
         /* If the futex is available, set it to notready */
-        const uint32_t avail = SHMMUTEX_LOCK_AVAILABLE;
-        if (atomic_compare_exchange_strong(&(sm->val), &avail, SHMMUTEX_LOCK_NOTREADY))
+        c = SHMMUTEX_LOCK_AVAILABLE;
+        if (atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_NOTREADY))
             break;      /* Yes */
 
-        /* Futex is not available and it is ready; wait. */
-        s = futex(&(sm->val), FUTEX_WAIT, SHMMUTEX_LOCK_TAKEN, NULL, NULL, 0);
-        if (s == -1 && errno != EAGAIN) {
-            fprintf(stderr, "ERROR: Failure while trying to lock\n");
-            rc = 1;
+        /* Futex is held; mark it contended so the holder wakes us on release */
+        if (c == SHMMUTEX_LOCK_TAKEN &&
+            !atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_CONTENDED))
+            continue;
+        if (c == SHMMUTEX_LOCK_TAKEN || c == SHMMUTEX_LOCK_CONTENDED) {
+            s = futex(&(sm->val), FUTEX_WAIT, SHMMUTEX_LOCK_CONTENDED, NULL, NULL, 0);
+            if (s == -1 && errno != EAGAIN && errno != EINTR) {
+                fprintf(stderr, "ERROR: Failure while trying to lock\n");
+                rc = 1;
+            }
         }
+        c = sm->val;
     }
     return 0;
 }
@@ -62,10 +278,45 @@ int shmmutex_destroy_if_locked(shmmutex_t *sm) {
     long s;
 
     /* If the futex is taken, set it to notready */
-    const uint32_t taken = SHMMUTEX_LOCK_TAKEN;
-    if (atomic_compare_exchange_strong(&(sm->val), &taken, SHMMUTEX_LOCK_NOTREADY)) {
+    uint32_t c = SHMMUTEX_LOCK_TAKEN;
+    if (atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_NOTREADY)) {
+        /* Nobody was sleeping on the futex, so there is no one to notify */
+        if (sm->type == SHMMUTEX_TYPE_ROBUST) {
+            /* Stop tracking the owner word and release it to its waiters, who find NOTREADY */
+            struct robust_list_head* head = shmmutex_get_robust_head();
+            head->list_op_pending = (struct robust_list*)&sm->robust_next;
+            shmmutex_robust_dequeue(sm);
+            uint32_t o = atomic_exchange(&(sm->owner), 0);
+            head->list_op_pending = NULL;
+            if (o & FUTEX_WAITERS) {
+                s = futex(&(sm->owner), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+                if (s == -1) {
+                    fprintf(stderr, "ERROR: Failure waking after destroying lock\n");
+                    rc = 1;
+                }
+            }
+        }
+        else if (sm->type == SHMMUTEX_TYPE_PI) {
+            /* The kernel hands the owner word to a waiter, who finds NOTREADY and passes it on */
+            rc = shmmutex_pi_release(sm);
+        }
+        else if (sm->type == SHMMUTEX_TYPE_TICKET) {
+            /* Serve no ticket that was handed out and wake the queue, which finds NOTREADY */
+            atomic_store(&(sm->serving), atomic_load(&(sm->ticket)) + 1);
+            if (atomic_load(&(sm->sleepers)) > 0) {
+                s = futex(&(sm->serving), FUTEX_WAKE_BITSET, INT_MAX, NULL, NULL,
+                          FUTEX_BITSET_MATCH_ANY);
+                if (s == -1) {
+                    fprintf(stderr, "ERROR: Failure waking after destroying lock\n");
+                    rc = 1;
+                }
+            }
+        }
+    }
+    else if (c == SHMMUTEX_LOCK_CONTENDED &&
+             atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_NOTREADY)) {
         /* We destroyed the futex, notify processes that may be sleep-waiting */
-        s = futex(&sm->val, FUTEX_WAKE, SHMMUTEX_LOCK_NOTREADY, NULL, NULL, 0);
+        s = futex(&sm->val, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
         if (s  == -1) {
             fprintf(stderr, "ERROR: Failure waking after destroying lock\n");
             rc = 1;
@@ -78,41 +329,454 @@ int shmmutex_destroy_if_locked(shmmutex_t *sm) {
     return rc;
 }
 
-int shmmutex_lock(shmmutex_t *sm) {
+/**
+ * Sleep on the futex until the lock is acquired.
+ *
+ * @param sm pointer to the mutex data
+ * @param c the last value observed in the futex
+ * @param abstime CLOCK_MONOTONIC deadline, or NULL to wait forever
+ */
+static int shmmutex_lock_wait(shmmutex_t *sm, uint32_t c, const struct timespec *abstime) {
+    int rc = 0;
+    long s;
+    while (1) {
+        /* Announce that a waiter exists before going to sleep */
+        if (c == SHMMUTEX_LOCK_TAKEN &&
+            !atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_CONTENDED))
+            continue;
 
-     /* atomic_compare_exchange_strong(ptr, oldval, newval)
-       atomically performs the equivalent of:
+        /* Futex is contended; wait. A NOTREADY futex is polled until created. */
+        if (c == SHMMUTEX_LOCK_TAKEN || c == SHMMUTEX_LOCK_CONTENDED) {
+            s = futex(&(sm->val), FUTEX_WAIT_BITSET, SHMMUTEX_LOCK_CONTENDED, abstime, NULL,
+                      FUTEX_BITSET_MATCH_ANY);
+            if (s == -1 && errno == ETIMEDOUT)
+                return ETIMEDOUT;
+            if (s == -1 && errno != EAGAIN && errno != EINTR) {
+                fprintf(stderr, "ERROR: Failure while trying to lock\n");
+                rc = 1;
+            }
+        }
 
-        if (*ptr == *oldval)
-            *ptr = newval;
+        /* 
+         * Once we have slept we cannot know whether other waiters remain,
+         * so the lock is acquired in the contended state.
+         */
+        c = SHMMUTEX_LOCK_AVAILABLE;
+        if (atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_CONTENDED))
+            break;      /* Yes */
+    }
+    return rc;
+}
 
-        It returns true if the test yielded true and *ptr was updated. 
-     */
+/** Spin with exponential backoff until the lock is acquired or the deadline passes */
+static int shmmutex_lock_spin(shmmutex_t *sm, const struct timespec *abstime) {
+    uint32_t backoff = 1;
+    while (1) {
+        /* Only attempt the CAS once the lock looks free to avoid line bouncing */
+        uint32_t c = atomic_load_explicit(&(sm->val), memory_order_relaxed);
+        if (c == SHMMUTEX_LOCK_AVAILABLE &&
+            atomic_compare_exchange_weak(&(sm->val), &c, SHMMUTEX_LOCK_TAKEN))
+            break;
+
+        for (uint32_t i = 0; i < backoff; i++)
+            shmmutex_cpu_relax();
+        if (backoff < SHMMUTEX_SPIN_MAX_BACKOFF)
+            backoff <<= 1;
+        else
+            sched_yield();  /* The holder is likely descheduled */
+        if (shmmutex_expired(abstime))
+            return ETIMEDOUT;
+    }
+    return 0;
+}
+
+/**
+ * Spin for a bounded time before sleeping. The bound tracks the number of
+ * spins that recently sufficed to acquire the lock.
+ */
+static int shmmutex_lock_adaptive(shmmutex_t *sm, uint32_t c, const struct timespec *abstime) {
+    uint32_t spins = atomic_load_explicit(&(sm->spins), memory_order_relaxed);
+    uint32_t max_spins = spins * 2 + 10;
+    if (max_spins > SHMMUTEX_ADAPTIVE_MAX_SPINS)
+        max_spins = SHMMUTEX_ADAPTIVE_MAX_SPINS;
+
+    for (uint32_t cnt = 0; cnt < max_spins; cnt++) {
+        shmmutex_cpu_relax();
+        c = atomic_load_explicit(&(sm->val), memory_order_relaxed);
+        if (c == SHMMUTEX_LOCK_AVAILABLE &&
+            atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_TAKEN)) {
+            /* Move the estimate 1/8th of the way towards this sample */
+            atomic_store_explicit(&(sm->spins), spins + ((int)cnt - (int)spins) / 8,
+                                  memory_order_relaxed);
+            return 0;
+        }
+    }
+    atomic_store_explicit(&(sm->spins), spins + ((int)max_spins - (int)spins) / 8,
+                          memory_order_relaxed);
+    return shmmutex_lock_wait(sm, c, abstime);
+}
+
+/** Poll until the mutex has been created. Returns NOTREADY if the deadline passes. */
+static uint32_t shmmutex_wait_ready(shmmutex_t *sm, const struct timespec *abstime) {
+    uint32_t c;
+    while (SHMMUTEX_LOCK_NOTREADY == (c = atomic_load(&(sm->val)))) {
+        if (shmmutex_expired(abstime))
+            break;
+        sched_yield();
+    }
+    return c;
+}
+
+/** Take a ticket and wait for it to be served */
+static int shmmutex_lock_ticket(shmmutex_t *sm) {
     int rc = 0;
     long s;
+    uint32_t my = atomic_fetch_add(&(sm->ticket), 1);
+    uint32_t spent = 0;
     while (1) {
-        /* If the futex is available, take it */
-        const uint32_t avail = SHMMUTEX_LOCK_AVAILABLE;
-        if (atomic_compare_exchange_strong(&(sm->val), &avail, SHMMUTEX_LOCK_TAKEN))
-            break;      /* Yes */
+        /* The mutex was destroyed while we waited */
+        if (SHMMUTEX_LOCK_NOTREADY == atomic_load(&(sm->val)))
+            return EINVAL;
+        uint32_t cur = atomic_load_explicit(&(sm->serving), memory_order_acquire);
+        if (cur == my)
+            break;
 
-        /* Futex is not available; wait. */
-        s = futex(&(sm->val), FUTEX_WAIT, SHMMUTEX_LOCK_TAKEN, NULL, NULL, 0);
-        if (s == -1 && errno != EAGAIN) {
-            fprintf(stderr, "ERROR: Failure while trying to lock\n");
+        /* 
+         * Back off in proportion to the number of owners ahead of us. Far
+         * back waiters exhaust the budget at once and sleep, so spinning
+         * does not steal CPU from the owners ahead of them.
+         */
+        uint32_t backoff = (my - cur) * SHMMUTEX_TICKET_BACKOFF;
+        if (spent + backoff <= SHMMUTEX_TICKET_SPIN_BUDGET) {
+            for (uint32_t i = 0; i < backoff; i++)
+                shmmutex_cpu_relax();
+            spent += backoff;
+            continue;
+        }
+
+        /* Sleep on our own bit of the serving futex until our turn */
+        atomic_fetch_add(&(sm->sleepers), 1);
+        cur = atomic_load(&(sm->serving));
+        if (cur != my) {
+            s = futex(&(sm->serving), FUTEX_WAIT_BITSET, cur, NULL, NULL, 1u << (my % 32));
+            if (s == -1 && errno != EAGAIN && errno != EINTR) {
+                fprintf(stderr, "ERROR: Failure while waiting for ticket\n");
+                rc = 1;
+            }
+        }
+        atomic_fetch_sub(&(sm->sleepers), 1);
+    }
+    atomic_store_explicit(&(sm->val), SHMMUTEX_LOCK_TAKEN, memory_order_relaxed);
+    return rc;
+}
+
+/** Take the lock only if no ticket is outstanding */
+static int shmmutex_trylock_ticket(shmmutex_t *sm) {
+    uint32_t cur = atomic_load(&(sm->serving));
+    uint32_t my = cur;
+    if (!atomic_compare_exchange_strong(&(sm->ticket), &my, cur + 1))
+        return EBUSY;
+    atomic_store_explicit(&(sm->val), SHMMUTEX_LOCK_TAKEN, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * A ticket cannot be given back, so a deadline-bounded waiter never joins
+ * the queue. It retries trylock each time the lock changes hands instead.
+ */
+static int shmmutex_lock_ticket_timed(shmmutex_t *sm, const struct timespec *abstime) {
+    while (0 != shmmutex_trylock_ticket(sm)) {
+        long s = 0;
+        if (SHMMUTEX_LOCK_NOTREADY == atomic_load(&(sm->val)))
+            return EINVAL;
+        atomic_fetch_add(&(sm->sleepers), 1);
+        uint32_t cur = atomic_load(&(sm->serving));
+        if (cur != atomic_load(&(sm->ticket)))
+            s = futex(&(sm->serving), FUTEX_WAIT_BITSET, cur, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+        atomic_fetch_sub(&(sm->sleepers), 1);
+        if (s == -1 && errno == ETIMEDOUT)
+            return ETIMEDOUT;
+        if (s == -1 && errno != EAGAIN && errno != EINTR) {
+            fprintf(stderr, "ERROR: Failure while waiting for ticket\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** Hand the lock to the next ticket */
+static int shmmutex_unlock_ticket(shmmutex_t *sm) {
+    int rc = 0;
+    long s;
+    uint32_t c = SHMMUTEX_LOCK_TAKEN;
+    if (!atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_AVAILABLE))
+        return rc;  /* Not held */
+
+    uint32_t next = atomic_load_explicit(&(sm->serving), memory_order_relaxed) + 1;
+    atomic_store(&(sm->serving), next);
+    if (atomic_load(&(sm->sleepers)) > 0) {
+        s = futex(&(sm->serving), FUTEX_WAKE_BITSET, INT_MAX, NULL, NULL, 1u << (next % 32));
+        if (s == -1) {
+            fprintf(stderr, "ERROR: Failure while waking next ticket\n");
             rc = 1;
         }
     }
     return rc;
 }
 
-int shmmutex_unlock(shmmutex_t *sm) {
+/**
+ * Acquire the owner futex, recording our TID in it
+ *
+ * @param abstime CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @param try return EBUSY instead of waiting
+ */
+static int shmmutex_lock_robust(shmmutex_t *sm, const struct timespec *abstime, bool try) {
     int rc = 0;
     long s;
-    const uint32_t taken = SHMMUTEX_LOCK_TAKEN;
-    if (atomic_compare_exchange_strong(&(sm->val), &taken, SHMMUTEX_LOCK_AVAILABLE)) {
-        /* We released the futex, notify processes that may be sleep-waiting */
-        s = futex(&sm->val, FUTEX_WAKE, SHMMUTEX_LOCK_AVAILABLE, NULL, NULL, 0);
+    struct robust_list_head* head = shmmutex_get_robust_head();
+    if (NULL == head)
+        return 1;
+
+    /* If we die before the mutex is linked, the kernel still checks this entry */
+    head->list_op_pending = (struct robust_list*)&sm->robust_next;
+    uint32_t o = 0;
+    if (!atomic_compare_exchange_strong(&(sm->owner), &o, shmmutex_tid)) {
+        while (1) {
+            /* The mutex was destroyed while we waited */
+            if (SHMMUTEX_LOCK_NOTREADY == atomic_load(&(sm->val))) {
+                head->list_op_pending = NULL;
+                return EINVAL;
+            }
+            if (o & FUTEX_OWNER_DIED) {
+                /* The kernel released a dead owner's lock; inherit it */
+                if (atomic_compare_exchange_strong(&(sm->owner), &o,
+                                                   shmmutex_tid | (o & FUTEX_WAITERS))) {
+                    rc = EOWNERDEAD;
+                    break;
+                }
+                continue;
+            }
+            if (0 == o) {
+                /* We cannot know whether others sleep, so keep the waiters bit */
+                if (atomic_compare_exchange_strong(&(sm->owner), &o, shmmutex_tid | FUTEX_WAITERS))
+                    break;
+                continue;
+            }
+            if (try) {
+                head->list_op_pending = NULL;
+                return EBUSY;
+            }
+            if (!(o & FUTEX_WAITERS)) {
+                if (!atomic_compare_exchange_strong(&(sm->owner), &o, o | FUTEX_WAITERS))
+                    continue;
+                o |= FUTEX_WAITERS;
+            }
+            s = futex(&(sm->owner), FUTEX_WAIT_BITSET, o, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+            if (s == -1 && errno == ETIMEDOUT) {
+                head->list_op_pending = NULL;
+                return ETIMEDOUT;
+            }
+            if (s == -1 && errno != EAGAIN && errno != EINTR) {
+                fprintf(stderr, "ERROR: Failure while trying to lock\n");
+                head->list_op_pending = NULL;
+                return 1;
+            }
+            o = atomic_load(&(sm->owner));
+        }
+    }
+    shmmutex_robust_enqueue(head, sm);
+    head->list_op_pending = NULL;
+    atomic_store_explicit(&(sm->val), SHMMUTEX_LOCK_TAKEN, memory_order_relaxed);
+    return rc;
+}
+
+/** Release the owner futex and stop tracking it */
+static int shmmutex_unlock_robust(shmmutex_t *sm) {
+    int rc = 0;
+    long s;
+    struct robust_list_head* head = shmmutex_get_robust_head();
+    uint32_t c = SHMMUTEX_LOCK_TAKEN;
+    if (NULL == head)
+        return 1;
+    if (!atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_AVAILABLE))
+        return rc;  /* Not held */
+
+    head->list_op_pending = (struct robust_list*)&sm->robust_next;
+    shmmutex_robust_dequeue(sm);
+    uint32_t o = atomic_exchange(&(sm->owner), 0);
+    head->list_op_pending = NULL;
+    if (o & FUTEX_WAITERS) {
+        s = futex(&(sm->owner), FUTEX_WAKE, 1, NULL, NULL, 0);
+        if (s == -1) {
+            fprintf(stderr, "ERROR: Failure while release lock\n");
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+/**
+ * Acquire the owner futex, letting the kernel boost the owner while we wait
+ *
+ * @param abstime CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @param try return EBUSY instead of waiting
+ */
+static int shmmutex_lock_pi(shmmutex_t *sm, const struct timespec *abstime, bool try) {
+    int rc = 0;
+    struct robust_list_head* head = shmmutex_get_robust_head();
+    if (NULL == head)
+        return 1;
+
+    /* If we die before the mutex is linked, the kernel still checks this entry */
+    head->list_op_pending = shmmutex_robust_entry(sm);
+
+    /* Fast path: an unowned lock word is claimed without entering the kernel */
+    uint32_t o = 0;
+    if (!atomic_compare_exchange_strong(&(sm->owner), &o, shmmutex_tid)) {
+        /* Only the kernel may take over a dead owner's lock */
+        if (try && !(o & FUTEX_OWNER_DIED)) {
+            head->list_op_pending = NULL;
+            return EBUSY;
+        }
+
+        /* The kernel queues us by priority and lends it to the owner. Unlike
+           FUTEX_LOCK_PI, FUTEX_LOCK_PI2 measures the deadline on CLOCK_MONOTONIC. */
+        int op = try ? FUTEX_TRYLOCK_PI :
+                 (abstime && !shmmutex_no_lock_pi2 ? FUTEX_LOCK_PI2 : FUTEX_LOCK_PI);
+        struct timespec realtime;
+        const struct timespec *timeout = abstime;
+        if (FUTEX_LOCK_PI == op && NULL != abstime)
+            timeout = shmmutex_realtime_deadline(abstime, &realtime);
+        while (-1 == futex(&(sm->owner), op, 0, timeout, NULL, 0)) {
+            if (SHMMUTEX_LOCK_NOTREADY == atomic_load(&(sm->val)))
+                rc = EINVAL;
+            else if (errno == ENOSYS && op == FUTEX_LOCK_PI2) {
+                /* Kernels before 5.14 lack FUTEX_LOCK_PI2 */
+                shmmutex_no_lock_pi2 = true;
+                op = FUTEX_LOCK_PI;
+                timeout = shmmutex_realtime_deadline(abstime, &realtime);
+                continue;
+            }
+            else if (errno == ETIMEDOUT)
+                rc = ETIMEDOUT;
+            else if (try && (errno == EAGAIN || errno == EBUSY))
+                rc = EBUSY;
+            else if (errno != EINTR && errno != EAGAIN) {
+                fprintf(stderr, "ERROR: Failure while trying to lock\n");
+                rc = 1;
+            }
+            if (0 != rc) {
+                head->list_op_pending = NULL;
+                return rc;
+            }
+        }
+        /* The kernel hands a dead owner's lock over with this bit set */
+        o = atomic_load(&(sm->owner));
+        if (o & FUTEX_OWNER_DIED) {
+            atomic_fetch_and(&(sm->owner), ~FUTEX_OWNER_DIED);
+            rc = EOWNERDEAD;
+        }
+    }
+    /* The mutex was destroyed while we waited; pass the owner word to the next waiter */
+    if (SHMMUTEX_LOCK_NOTREADY == atomic_load(&(sm->val))) {
+        shmmutex_pi_release_owner(sm);
+        head->list_op_pending = NULL;
+        return EINVAL;
+    }
+    shmmutex_robust_enqueue(head, sm);
+    head->list_op_pending = NULL;
+    atomic_store_explicit(&(sm->val), SHMMUTEX_LOCK_TAKEN, memory_order_relaxed);
+    return rc;
+}
+
+/** Release the owner futex, handing it to the highest priority waiter */
+static int shmmutex_unlock_pi(shmmutex_t *sm) {
+    uint32_t c = SHMMUTEX_LOCK_TAKEN;
+    if (!atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_AVAILABLE))
+        return 0;  /* Not held */
+    return shmmutex_pi_release(sm);
+}
+
+/** Acquire the lock, giving up at the deadline if one is supplied */
+static int shmmutex_acquire(shmmutex_t *sm, const struct timespec *abstime) {
+
+     /* atomic_compare_exchange_strong(ptr, oldval, newval)
+       atomically performs the equivalent of:
+
+        if (*ptr == *oldval)
+            *ptr = newval;
+
+        It returns true if the test yielded true and *ptr was updated. 
+        Otherwise *oldval is updated with the current value of *ptr.
+     */
+
+    /* The type is only valid once the mutex has been created */
+    uint32_t c = atomic_load(&(sm->val));
+    if (c == SHMMUTEX_LOCK_NOTREADY && SHMMUTEX_LOCK_NOTREADY == shmmutex_wait_ready(sm, abstime))
+        return ETIMEDOUT;
+    if (sm->type == SHMMUTEX_TYPE_TICKET)
+        return abstime ? shmmutex_lock_ticket_timed(sm, abstime) : shmmutex_lock_ticket(sm);
+    if (sm->type == SHMMUTEX_TYPE_ROBUST)
+        return shmmutex_lock_robust(sm, abstime, false);
+    if (sm->type == SHMMUTEX_TYPE_PI)
+        return shmmutex_lock_pi(sm, abstime, false);
+
+    /* Fast path: the futex is available, take it without waiters */
+    c = SHMMUTEX_LOCK_AVAILABLE;
+    if (atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_TAKEN))
+        return 0;
+
+    switch (sm->type) {
+        case SHMMUTEX_TYPE_SPIN:
+            return shmmutex_lock_spin(sm, abstime);
+        case SHMMUTEX_TYPE_ADAPTIVE:
+            return shmmutex_lock_adaptive(sm, c, abstime);
+        default:
+            return shmmutex_lock_wait(sm, c, abstime);
+    }
+}
+
+/** Take the lock without waiting */
+static int shmmutex_try(shmmutex_t *sm) {
+    if (SHMMUTEX_LOCK_NOTREADY == atomic_load(&(sm->val)))
+        return EBUSY;
+    switch (sm->type) {
+        case SHMMUTEX_TYPE_TICKET:
+            return shmmutex_trylock_ticket(sm);
+        case SHMMUTEX_TYPE_ROBUST:
+            return shmmutex_lock_robust(sm, NULL, true);
+        case SHMMUTEX_TYPE_PI:
+            return shmmutex_lock_pi(sm, NULL, true);
+    }
+
+    /* Never sleep; a held lock is reported as busy */
+    uint32_t c = SHMMUTEX_LOCK_AVAILABLE;
+    if (atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_TAKEN))
+        return 0;
+    return EBUSY;
+}
+
+/** Release the lock */
+static int shmmutex_release(shmmutex_t *sm) {
+    int rc = 0;
+    long s;
+
+    if (sm->type == SHMMUTEX_TYPE_TICKET)
+        return shmmutex_unlock_ticket(sm);
+    if (sm->type == SHMMUTEX_TYPE_ROBUST)
+        return shmmutex_unlock_robust(sm);
+    if (sm->type == SHMMUTEX_TYPE_PI)
+        return shmmutex_unlock_pi(sm);
+
+    /* Fast path: no waiters, release without entering the kernel */
+    uint32_t c = SHMMUTEX_LOCK_TAKEN;
+    if (atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_AVAILABLE))
+        return rc;
+
+    c = SHMMUTEX_LOCK_CONTENDED;
+    if (atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_AVAILABLE)) {
+        /* We released the futex, notify a process that may be sleep-waiting */
+        s = futex(&sm->val, FUTEX_WAKE, 1, NULL, NULL, 0);
         if (s  == -1) {
             fprintf(stderr, "ERROR: Failure while release lock\n");
             rc = 1;
@@ -120,3 +784,153 @@ int shmmutex_unlock(shmmutex_t *sm) {
     }
     return rc;
 }
+
+#ifdef SHMMUTEX_STATS
+/** @return the statistics block of the mutex, or NULL */
+static inline shmmutex_stats_t* shmmutex_get_stats(shmmutex_t *sm) {
+    if (0 == sm->stats_offset)
+        return NULL;
+    return (shmmutex_stats_t*)((char*)sm + sm->stats_offset);
+}
+
+static inline uint64_t shmmutex_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/** @return the calling thread's shard */
+static inline shmmutex_stats_counts_t* shmmutex_stats_shard(shmmutex_stats_t *st) {
+    return &(st->shards[shmmutex_gettid() % SHMMUTEX_STATS_SHARDS].counts);
+}
+
+/** Count an acquisition; wait_start is 0 if the lock was taken without waiting */
+static void shmmutex_stats_acquired(shmmutex_stats_t *st, uint64_t wait_start, uint64_t waits) {
+    shmmutex_stats_counts_t *sc = shmmutex_stats_shard(st);
+    uint64_t now = shmmutex_now_ns();
+    atomic_fetch_add_explicit(&(sc->acquisitions), 1, memory_order_relaxed);
+    if (0 != wait_start) {
+        uint64_t wait = now - wait_start;
+        atomic_fetch_add_explicit(&(sc->contended), 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&(sc->futex_waits), waits, memory_order_relaxed);
+        atomic_fetch_add_explicit(&(sc->wait_ns), wait, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&(sc->max_wait_ns), memory_order_relaxed);
+        while (wait > max &&
+               !atomic_compare_exchange_weak_explicit(&(sc->max_wait_ns), &max, wait,
+                                                      memory_order_relaxed, memory_order_relaxed));
+    }
+    /* Only the holder writes the start time */
+    atomic_store_explicit(&(st->hold_start_ns), now, memory_order_relaxed);
+}
+
+/** Add the current hold to the histogram */
+static void shmmutex_stats_releasing(shmmutex_stats_t *st) {
+    uint64_t hold = shmmutex_now_ns() - atomic_load_explicit(&(st->hold_start_ns), memory_order_relaxed);
+    uint32_t bucket = 63 - __builtin_clzll(hold | 1);
+    if (bucket >= SHMMUTEX_STATS_BUCKETS)
+        bucket = SHMMUTEX_STATS_BUCKETS - 1;
+    atomic_fetch_add_explicit(&(shmmutex_stats_shard(st)->hold_hist[bucket]), 1, memory_order_relaxed);
+}
+#endif
+
+/** Acquire the lock, recording statistics if the mutex has a block */
+static int shmmutex_lock_until(shmmutex_t *sm, const struct timespec *abstime) {
+#ifdef SHMMUTEX_STATS
+    shmmutex_stats_t *st = shmmutex_get_stats(sm);
+    if (NULL != st) {
+        int rc = shmmutex_try(sm);
+        if (EBUSY == rc) {
+            uint64_t waits = shmmutex_futex_waits;
+            uint64_t start = shmmutex_now_ns();
+            rc = shmmutex_acquire(sm, abstime);
+            if (0 == rc || EOWNERDEAD == rc)
+                shmmutex_stats_acquired(st, start, shmmutex_futex_waits - waits);
+        }
+        else if (0 == rc || EOWNERDEAD == rc) {
+            shmmutex_stats_acquired(st, 0, 0);
+        }
+        return rc;
+    }
+#endif
+    return shmmutex_acquire(sm, abstime);
+}
+
+int shmmutex_lock(shmmutex_t *sm) {
+    return shmmutex_lock_until(sm, NULL);
+}
+
+int shmmutex_timedlock(shmmutex_t *sm, const struct timespec *abstime) {
+    return shmmutex_lock_until(sm, abstime);
+}
+
+int shmmutex_lock_contended(shmmutex_t *sm) {
+    if (sm->type != SHMMUTEX_TYPE_FUTEX && sm->type != SHMMUTEX_TYPE_ADAPTIVE)
+        return shmmutex_lock(sm);
+#ifdef SHMMUTEX_STATS
+    shmmutex_stats_t *st = shmmutex_get_stats(sm);
+    uint64_t waits = shmmutex_futex_waits;
+    uint64_t start = (NULL != st) ? shmmutex_now_ns() : 0;
+#endif
+    int rc = 0;
+    uint32_t c = SHMMUTEX_LOCK_AVAILABLE;
+    if (!atomic_compare_exchange_strong(&(sm->val), &c, SHMMUTEX_LOCK_CONTENDED))
+        rc = shmmutex_lock_wait(sm, c, NULL);
+#ifdef SHMMUTEX_STATS
+    if (NULL != st && 0 == rc)
+        shmmutex_stats_acquired(st, (waits != shmmutex_futex_waits) ? start : 0,
+                                shmmutex_futex_waits - waits);
+#endif
+    return rc;
+}
+
+int shmmutex_trylock(shmmutex_t *sm) {
+    int rc = shmmutex_try(sm);
+#ifdef SHMMUTEX_STATS
+    shmmutex_stats_t *st = shmmutex_get_stats(sm);
+    if (NULL != st && (0 == rc || EOWNERDEAD == rc))
+        shmmutex_stats_acquired(st, 0, 0);
+#endif
+    return rc;
+}
+
+int shmmutex_unlock(shmmutex_t *sm) {
+#ifdef SHMMUTEX_STATS
+    shmmutex_stats_t *st = shmmutex_get_stats(sm);
+    if (NULL != st)
+        shmmutex_stats_releasing(st);
+#endif
+    return shmmutex_release(sm);
+}
+
+int shmmutex_stats_attach(shmmutex_t *sm, shmmutex_stats_t *stats) {
+    if (NULL == stats) {
+        sm->stats_offset = 0;
+        return 0;
+    }
+    ptrdiff_t offset = (char*)stats - (char*)sm;
+    if (0 == offset || offset != (int32_t)offset)
+        return 1;
+    sm->stats_offset = (int32_t)offset;
+    return 0;
+}
+
+int shmmutex_stats_read(const shmmutex_stats_t *stats, shmmutex_stats_counts_t *out) {
+    memset(out, 0, sizeof(shmmutex_stats_counts_t));
+#ifdef SHMMUTEX_STATS
+    for (int i = 0; i < SHMMUTEX_STATS_SHARDS; i++) {
+        const shmmutex_stats_counts_t *sc = &(stats->shards[i].counts);
+        out->acquisitions += atomic_load_explicit(&(sc->acquisitions), memory_order_relaxed);
+        out->contended += atomic_load_explicit(&(sc->contended), memory_order_relaxed);
+        out->futex_waits += atomic_load_explicit(&(sc->futex_waits), memory_order_relaxed);
+        out->wait_ns += atomic_load_explicit(&(sc->wait_ns), memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&(sc->max_wait_ns), memory_order_relaxed);
+        if (max > out->max_wait_ns)
+            out->max_wait_ns = max;
+        for (int b = 0; b < SHMMUTEX_STATS_BUCKETS; b++)
+            out->hold_hist[b] += atomic_load_explicit(&(sc->hold_hist[b]), memory_order_relaxed);
+    }
+    return 0;
+#else
+    return ENOTSUP;
+#endif
+}
@@ -2,6 +2,7 @@
 #define SHM_MUTEX_H
 
 #include <stdint.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +13,68 @@ extern "C" {
 #define SHMMUTEX_LOCK_NOTREADY 0
 #define SHMMUTEX_LOCK_AVAILABLE 1
 #define SHMMUTEX_LOCK_TAKEN 2
+#define SHMMUTEX_LOCK_CONTENDED 3
+
+/** Mutex types */
+#define SHMMUTEX_TYPE_FUTEX 0
+#define SHMMUTEX_TYPE_SPIN 1
+#define SHMMUTEX_TYPE_ADAPTIVE 2
+#define SHMMUTEX_TYPE_TICKET 3
+#define SHMMUTEX_TYPE_ROBUST 4
+#define SHMMUTEX_TYPE_PI 5
+
+/** Mutex type used when none is requested. Override at compile time. */
+#ifndef SHMMUTEX_DEFAULT_TYPE
+#define SHMMUTEX_DEFAULT_TYPE SHMMUTEX_TYPE_FUTEX
+#endif
+
+/** Upper bound on the number of spins before an adaptive mutex sleeps */
+#define SHMMUTEX_ADAPTIVE_MAX_SPINS 1000
+
+/** Number of per-thread shards in a statistics block */
+#define SHMMUTEX_STATS_SHARDS 16
+
+/** Number of log2 buckets in the hold time histogram; bucket i counts holds of [2^i, 2^(i+1)) ns */
+#define SHMMUTEX_STATS_BUCKETS 32
+
+/** Lock statistics counters */
+typedef struct shmmutex_stats_counts {
+    /* Number of times the lock was acquired */
+    uint64_t acquisitions;
+
+    /* Acquisitions that found the lock held and had to wait */
+    uint64_t contended;
+
+    /* Futex wait system calls made while acquiring */
+    uint64_t futex_waits;
+
+    /* Total and largest time spent waiting in contended acquisitions, in ns */
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+
+    /* Histogram of hold times */
+    uint64_t hold_hist[SHMMUTEX_STATS_BUCKETS];
+} shmmutex_stats_counts_t;
+
+/** One shard of a statistics block, on its own cache line(s) */
+typedef struct shmmutex_stats_shard {
+    shmmutex_stats_counts_t counts;
+} __attribute__((aligned(64))) shmmutex_stats_shard_t;
+
+/**
+ * Statistics block stored in shared memory beside a mutex. Each thread
+ * updates the shard selected by its TID with relaxed atomics, so updates
+ * from different processes rarely share a cache line. Readers sum the
+ * shards without taking the lock, so a snapshot may be slightly torn.
+ * A zero-filled block is empty. Statistics are only gathered when the
+ * library is built with SHMMUTEX_STATS defined.
+ */
+typedef struct shmmutex_stats {
+    /* Time the current holder acquired the lock */
+    uint64_t hold_start_ns;
+
+    shmmutex_stats_shard_t shards[SHMMUTEX_STATS_SHARDS];
+} shmmutex_stats_t;
 
 /** 
  * Public type used to perform mutual exclusion between processes. This type
@@ -21,15 +84,74 @@ extern "C" {
  * Mutex states/values:
  * 0 - not ready, no one can acquire the lock
  * 1 - lock is available
- * 2 - lock is taken
+ * 2 - lock is taken, no process is sleeping on the futex
+ * 3 - lock is taken, one or more processes may be sleeping on the futex
  * 
  * Note that 0 is defined this way because shared memory is zero-filled
  * before use. Nested lock calls are not supported.
+ *
+ * Only a release from the contended state (3) issues a FUTEX_WAKE, so an
+ * uncontended lock/unlock pair never enters the kernel.
+ *
+ * Mutex types:
+ * futex    - sleep on the futex as soon as the lock is found taken
+ * spin     - never sleep; spin with pause and exponential backoff
+ * adaptive - spin for a self-tuned bounded time, then sleep on the futex
+ * ticket   - FIFO queue lock; waiters take a ticket and back off in
+ *            proportion to their distance from the head of the queue before
+ *            sleeping on a futex bit of their own, so each release wakes
+ *            only the next owner
+ * robust   - the owner's TID is kept in a futex registered on the kernel's
+ *            robust futex list. If the owner dies the next shmmutex_lock
+ *            acquires the lock and returns EOWNERDEAD; the caller should
+ *            repair the protected data before unlocking.
+ * pi       - priority inheritance; the owner's TID is kept in a futex
+ *            managed with FUTEX_LOCK_PI/FUTEX_UNLOCK_PI, so while a higher
+ *            priority process waits the kernel runs the owner at the
+ *            waiter's priority and hands the lock to the highest priority
+ *            waiter on release. Uncontended lock/unlock stay in user space.
+ *            The mutex is also kept on the robust futex list, so a dead
+ *            owner's lock is recovered with EOWNERDEAD as for robust.
+ *
+ * The type is 0 (futex) in zero-filled memory. The spin type is meant for
+ * very short critical sections on processes that own their cores.
  * 
  */
 typedef struct shmmutex {
-    /* This futex can have the values 0, 1, 2. */
+    /* This futex can have the values 0, 1, 2, 3. */
     uint32_t val;
+
+    /* Locking algorithm, one of SHMMUTEX_TYPE_* */
+    uint32_t type;
+
+    /* Owner TID with FUTEX_WAITERS/FUTEX_OWNER_DIED bits (robust and pi mutex) */
+    uint32_t owner;
+
+    /* Running estimate of spins needed to acquire an adaptive mutex */
+    uint32_t spins;
+
+    /* Next ticket to hand out (ticket mutex) */
+    uint32_t ticket;
+
+    /* Ticket that currently owns the lock (ticket mutex) */
+    uint32_t serving;
+
+    /* Number of ticket holders sleeping on serving */
+    uint32_t sleepers;
+
+    /* 
+     * Byte offset from this mutex to its statistics block, 0 if it has none.
+     * Kept without SHMMUTEX_STATS so that every build shares one mutex layout.
+     */
+    int32_t stats_offset;
+
+    /* 
+     * Kernel robust list linkage of the owning thread (robust and pi mutex). The
+     * layout matches glibc's pthread_mutex_t so both can share one list:
+     * robust_next is 32 bytes past owner on LP64 targets.
+     */
+    void* robust_prev;
+    void* robust_next;
 } shmmutex_t;
 
 /**
@@ -48,6 +170,36 @@ typedef struct shmmutex {
  */
 int shmmutex_create(shmmutex_t *sm);
 
+/**
+ * Create the mutex with the supplied locking algorithm. The same
+ * preconditions as shmmutex_create apply.
+ * 
+ * @param sm pointer to the mutex data
+ * @param type one of SHMMUTEX_TYPE_*
+ * @return 0 on success, non-zero if the type is unknown
+ */
+int shmmutex_create_type(shmmutex_t *sm, uint32_t type);
+
+/**
+ * Record statistics for this mutex in a block stored in the same shared
+ * mapping. Call before the mutex is created; the block must be zero-filled
+ * and stay at the same distance from the mutex in every process.
+ * 
+ * @param sm pointer to the mutex data
+ * @param stats statistics block, or NULL to stop recording
+ * @return 0 on success, non-zero if the block is too far from the mutex
+ */
+int shmmutex_stats_attach(shmmutex_t *sm, shmmutex_stats_t *stats);
+
+/**
+ * Sum the shards of a statistics block. Does not take any lock.
+ * 
+ * @param stats statistics block
+ * @param out totals
+ * @return 0 on success, ENOTSUP if the library was built without SHMMUTEX_STATS
+ */
+int shmmutex_stats_read(const shmmutex_stats_t *stats, shmmutex_stats_counts_t *out);
+
 /**
  * Destroy the mutex. The shared mutex cannot be used by anyone after this call.
  * 
@@ -58,6 +210,7 @@ int shmmutex_destroy(shmmutex_t *sm);
 
 /** 
  * Destroy a locked mutex. The shared mutex cannot be used by anyone after this call.
+ * Processes waiting for a robust, pi or ticket mutex are woken and fail with EINVAL.
  * 
  * @param sm pointer to the mutex data
  * @return 0 on success
@@ -68,11 +221,46 @@ int shmmutex_destroy_if_locked(shmmutex_t *sm);
  * On success a single process holds the lock 
  * 
  * @param sm pointer to the mutex data
- * @return 0 on success, non-zero on failure
+ * @return 0 on success, EOWNERDEAD if a robust or pi mutex was acquired
+ *         from a dead owner (the lock is held), EINVAL if a robust, pi or
+ *         ticket mutex was destroyed while waiting, other non-zero values on failure
  * 
 */
 int shmmutex_lock(shmmutex_t *sm);
 
+/** 
+ * Acquire the lock only if it can be taken without waiting. A ticket mutex
+ * is only taken when no other process holds or is queued for it.
+ * 
+ * @param sm pointer to the mutex data
+ * @return 0 on success, EBUSY if the lock is held, EOWNERDEAD as for
+ *         shmmutex_lock, other non-zero values on failure
+*/
+int shmmutex_trylock(shmmutex_t *sm);
+
+/** 
+ * Acquire the lock, giving up at an absolute CLOCK_MONOTONIC deadline.
+ * A timed ticket waiter does not queue for a ticket; it retries trylock
+ * each time the lock is released.
+ * 
+ * @param sm pointer to the mutex data
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed, EOWNERDEAD as
+ *         for shmmutex_lock, other non-zero values on failure
+*/
+int shmmutex_timedlock(shmmutex_t *sm, const struct timespec *abstime);
+
+/** 
+ * Acquire the lock on behalf of a process that may have been moved onto the
+ * mutex futex by another wait queue, e.g. FUTEX_CMP_REQUEUE from shmcond_t.
+ * FUTEX and ADAPTIVE mutexes are taken in the contended state so that the
+ * release wakes the next requeued process; other types lock normally.
+ * 
+ * @param sm pointer to the mutex data
+ * @return as for shmmutex_lock
+*/
+int shmmutex_lock_contended(shmmutex_t *sm);
+
 /** 
  * On success a process holding the lock releases it 
  * 
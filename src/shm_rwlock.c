@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_rwlock.h"
+
+/** Wrapper for the futex system call */
+static long futex(uint32_t *uaddr, int op, uint32_t val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/** Sleep while the state word still holds val, until the CLOCK_MONOTONIC deadline if any */
+static int shmrwlock_wait(shmrwlock_t *rw, uint32_t val, const struct timespec *abstime) {
+    long s = syscall(SYS_futex, &(rw->state), FUTEX_WAIT_BITSET, val, abstime, NULL,
+                     FUTEX_BITSET_MATCH_ANY);
+    if (s == -1 && errno == ETIMEDOUT)
+        return ETIMEDOUT;
+    if (s == -1 && errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "ERROR: Failure while waiting for rwlock\n");
+        return 1;
+    }
+    return 0;
+}
+
+/** Wake every sleeper, if there are any. Sleepers that still must wait re-arm the bit. */
+static int shmrwlock_wake(shmrwlock_t *rw) {
+    uint32_t s = atomic_fetch_and(&(rw->state), ~SHMRWLOCK_SLEEPERS);
+    if (s & SHMRWLOCK_SLEEPERS) {
+        if (-1 == futex(&(rw->state), FUTEX_WAKE, INT_MAX)) {
+            fprintf(stderr, "ERROR: Failure waking rwlock waiters\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Create the rwlock. Called from 1 process only. */
+int shmrwlock_create(shmrwlock_t *rw) {
+    rw->writers = 0;
+    atomic_store(&(rw->state), 0);
+    return 0;
+}
+
+/** Acquire a read lock, giving up at the deadline if one is supplied */
+static int shmrwlock_rdlock_until(shmrwlock_t *rw, const struct timespec *abstime) {
+    int rc = 0;
+
+    /* Fast path: announce ourselves, done unless a writer holds or wants the lock */
+    uint32_t s = atomic_fetch_add(&(rw->state), 1);
+    while (s & (SHMRWLOCK_WRITER|SHMRWLOCK_WWAIT)) {
+        /* Back out; if we were the last reader a sleeping writer may proceed */
+        s = atomic_fetch_sub(&(rw->state), 1) - 1;
+        if (0 == (s & SHMRWLOCK_READERS) && (s & SHMRWLOCK_SLEEPERS))
+            rc |= shmrwlock_wake(rw);
+
+        /* Sleep until writers are done */
+        s = atomic_load(&(rw->state));
+        while (s & (SHMRWLOCK_WRITER|SHMRWLOCK_WWAIT)) {
+            if (!(s & SHMRWLOCK_SLEEPERS) &&
+                !atomic_compare_exchange_weak(&(rw->state), &s, s | SHMRWLOCK_SLEEPERS))
+                continue;
+            int w = shmrwlock_wait(rw, s | SHMRWLOCK_SLEEPERS, abstime);
+            if (ETIMEDOUT == w)
+                return ETIMEDOUT;
+            rc |= w;
+            s = atomic_load(&(rw->state));
+        }
+        s = atomic_fetch_add(&(rw->state), 1);
+    }
+    return rc;
+}
+
+int shmrwlock_rdlock(shmrwlock_t *rw) {
+    return shmrwlock_rdlock_until(rw, NULL);
+}
+
+int shmrwlock_timedrdlock(shmrwlock_t *rw, const struct timespec *abstime) {
+    return shmrwlock_rdlock_until(rw, abstime);
+}
+
+int shmrwlock_tryrdlock(shmrwlock_t *rw) {
+    uint32_t s = atomic_load(&(rw->state));
+    do {
+        if (s & (SHMRWLOCK_WRITER|SHMRWLOCK_WWAIT))
+            return EBUSY;
+    } while (!atomic_compare_exchange_weak(&(rw->state), &s, s + 1));
+    return 0;
+}
+
+int shmrwlock_rdunlock(shmrwlock_t *rw) {
+    uint32_t s = atomic_fetch_sub(&(rw->state), 1) - 1;
+    /* The last reader out lets a waiting writer in */
+    if (0 == (s & SHMRWLOCK_READERS) && (s & SHMRWLOCK_SLEEPERS))
+        return shmrwlock_wake(rw);
+    return 0;
+}
+
+/** Acquire the write lock, giving up at the deadline if one is supplied */
+static int shmrwlock_wrlock_until(shmrwlock_t *rw, const struct timespec *abstime) {
+    int rc = 0;
+
+    /* Fast path: no readers, no writers */
+    uint32_t s = 0;
+    if (atomic_compare_exchange_strong(&(rw->state), &s, SHMRWLOCK_WRITER))
+        return rc;
+
+    atomic_fetch_add(&(rw->writers), 1);
+    while (1) {
+        if (0 == (s & (SHMRWLOCK_WRITER|SHMRWLOCK_READERS))) {
+            /* Lock is free; take it, waiting writers re-announce on release */
+            uint32_t next = (s & SHMRWLOCK_SLEEPERS) | SHMRWLOCK_WRITER;
+            if (atomic_compare_exchange_weak(&(rw->state), &s, next))
+                break;
+            continue;
+        }
+
+        /* Keep new readers out and sleep until the lock is released */
+        uint32_t want = s | SHMRWLOCK_WWAIT | SHMRWLOCK_SLEEPERS;
+        if (s != want && !atomic_compare_exchange_weak(&(rw->state), &s, want))
+            continue;
+        int w = shmrwlock_wait(rw, want, abstime);
+        if (ETIMEDOUT == w) {
+            /* The last writer to give up lets the backed off readers in */
+            if (1 == atomic_fetch_sub(&(rw->writers), 1)) {
+                atomic_fetch_and(&(rw->state), ~SHMRWLOCK_WWAIT);
+                shmrwlock_wake(rw);
+            }
+            return ETIMEDOUT;
+        }
+        rc |= w;
+        s = atomic_load(&(rw->state));
+    }
+    atomic_fetch_sub(&(rw->writers), 1);
+    return rc;
+}
+
+int shmrwlock_wrlock(shmrwlock_t *rw) {
+    return shmrwlock_wrlock_until(rw, NULL);
+}
+
+int shmrwlock_timedwrlock(shmrwlock_t *rw, const struct timespec *abstime) {
+    return shmrwlock_wrlock_until(rw, abstime);
+}
+
+int shmrwlock_trywrlock(shmrwlock_t *rw) {
+    uint32_t s = atomic_load(&(rw->state));
+    do {
+        if (s & (SHMRWLOCK_WRITER|SHMRWLOCK_READERS))
+            return EBUSY;
+    } while (!atomic_compare_exchange_weak(&(rw->state), &s,
+                                           (s & SHMRWLOCK_SLEEPERS) | SHMRWLOCK_WRITER));
+    return 0;
+}
+
+int shmrwlock_wrunlock(shmrwlock_t *rw) {
+    uint32_t s = atomic_load(&(rw->state));
+    uint32_t next;
+    do {
+        /* Keep readers backed off while other writers are queued */
+        next = s & SHMRWLOCK_READERS;
+        if (atomic_load(&(rw->writers)) > 0)
+            next |= SHMRWLOCK_WWAIT;
+    } while (!atomic_compare_exchange_weak(&(rw->state), &s, next));
+
+    if (s & SHMRWLOCK_SLEEPERS) {
+        if (-1 == futex(&(rw->state), FUTEX_WAKE, INT_MAX)) {
+            fprintf(stderr, "ERROR: Failure waking rwlock waiters\n");
+            return 1;
+        }
+    }
+    return 0;
+}
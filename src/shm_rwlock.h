@@ -0,0 +1,119 @@
+#ifndef SHM_RWLOCK_H
+#define SHM_RWLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Reader-writer lock state bits */
+#define SHMRWLOCK_WRITER   0x80000000u
+#define SHMRWLOCK_WWAIT    0x40000000u
+#define SHMRWLOCK_SLEEPERS 0x20000000u
+#define SHMRWLOCK_READERS  0x1fffffffu
+
+/** 
+ * Public type used to perform reader-writer exclusion between processes.
+ * Like shmmutex_t it must be stored in memory that every participating
+ * process can read and write (i.e. put it in SHM).
+ * 
+ * The state word holds:
+ * bits 0-28 - number of readers holding (or briefly backing out of) the lock
+ * bit 29    - processes may be sleeping on the futex
+ * bit 30    - writers are waiting; new readers back off (writer preference)
+ * bit 31    - a writer holds the lock
+ * 
+ * Zero-filled memory is an unlocked rwlock. Acquiring a read lock that no
+ * writer wants is a single atomic add, and releases only enter the kernel
+ * when a process is sleeping. Nested lock calls are not supported.
+ */
+typedef struct shmrwlock {
+    /* Futex word, see above */
+    uint32_t state;
+
+    /* Number of writers waiting for the lock */
+    uint32_t writers;
+} shmrwlock_t;
+
+/**
+ * Create the rwlock. Must be called by a single process on memory that is
+ * not yet in use.
+ * 
+ * @param rw pointer to the rwlock data
+ * @return 0 on success
+ */
+int shmrwlock_create(shmrwlock_t *rw);
+
+/** 
+ * On success the caller shares the lock with other readers
+ * 
+ * @param rw pointer to the rwlock data
+ * @return 0 on success, non-zero on failure
+ */
+int shmrwlock_rdlock(shmrwlock_t *rw);
+
+/** 
+ * Acquire a read lock only if no writer holds or waits for the lock
+ * 
+ * @param rw pointer to the rwlock data
+ * @return 0 on success, EBUSY otherwise
+ */
+int shmrwlock_tryrdlock(shmrwlock_t *rw);
+
+/** 
+ * Acquire a read lock, giving up at an absolute CLOCK_MONOTONIC deadline
+ * 
+ * @param rw pointer to the rwlock data
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed
+ */
+int shmrwlock_timedrdlock(shmrwlock_t *rw, const struct timespec *abstime);
+
+/** 
+ * Release a read lock
+ * 
+ * @param rw pointer to the rwlock data
+ * @return 0 on success, non-zero on failure
+ */
+int shmrwlock_rdunlock(shmrwlock_t *rw);
+
+/** 
+ * On success a single process holds the lock and there are no readers
+ * 
+ * @param rw pointer to the rwlock data
+ * @return 0 on success, non-zero on failure
+ */
+int shmrwlock_wrlock(shmrwlock_t *rw);
+
+/** 
+ * Acquire the write lock only if it is free
+ * 
+ * @param rw pointer to the rwlock data
+ * @return 0 on success, EBUSY otherwise
+ */
+int shmrwlock_trywrlock(shmrwlock_t *rw);
+
+/** 
+ * Acquire the write lock, giving up at an absolute CLOCK_MONOTONIC deadline
+ * 
+ * @param rw pointer to the rwlock data
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed
+ */
+int shmrwlock_timedwrlock(shmrwlock_t *rw, const struct timespec *abstime);
+
+/** 
+ * Release a write lock
+ * 
+ * @param rw pointer to the rwlock data
+ * @return 0 on success, non-zero on failure
+ */
+int shmrwlock_wrunlock(shmrwlock_t *rw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
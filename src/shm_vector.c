@@ -1,13 +1,21 @@
-
+#define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mntent.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "shm_vector.h"
 
 /** Return a pointer to the array elements */
@@ -15,91 +23,493 @@ static inline void* shmarray_get_eles(shmarray_t *sa) {
     return ((void*)sa + sa->eles_offset);
 }
 
-/** Return a pointer to the array elements */
-static inline bool* shmarray_get_actives(shmarray_t *sa) {
+/** Return a pointer to the occupancy bitmap */
+static inline uint64_t* shmarray_get_actives(shmarray_t *sa) {
     void* actives = ((void*)sa + sa->actives_offset);
-    return (bool*)actives;
+    return (uint64_t*)actives;
+}
+
+/** Return the number of bitmap words for capacity elements */
+static inline size_t shmarray_active_words(size_t capacity) {
+    return (capacity + 63) / 64;
+}
+
+/** Return true if the element at idx is active */
+static inline bool shmarray_is_active(shmarray_t *sa, size_t idx) {
+    uint64_t word = atomic_load_explicit(shmarray_get_actives(sa) + idx / 64, memory_order_relaxed);
+    return (word >> (idx % 64)) & 1;
+}
+
+/** Mark the element at idx active or free, called with the segment lock held */
+static inline void shmarray_set_active(shmarray_t *sa, size_t idx, bool active) {
+    uint64_t *word = shmarray_get_actives(sa) + idx / 64;
+    uint64_t bit = (uint64_t)1 << (idx % 64);
+    uint64_t val = atomic_load_explicit(word, memory_order_relaxed);
+    atomic_store_explicit(word, active ? (val | bit) : (val & ~bit), memory_order_release);
+}
+
+/** Return the first bitmap word at or after w that is not zero, or nwords */
+static inline size_t shmarray_next_word(const uint64_t *words, size_t w, size_t nwords) {
+#ifdef __AVX2__
+    /* Skip empty regions 256 bits at a time */
+    for (; w + 4 <= nwords; w += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(words + w));
+        if (!_mm256_testz_si256(v, v))
+            break;
+    }
+#endif
+    while (w < nwords && 0 == words[w])
+        w++;
+    return w;
+}
+
+/** Return the offset of the free slot stack for capacity elements of esize bytes */
+static inline size_t shmarray_frees_offset(size_t capacity, size_t esize) {
+    size_t end = sizeof(shmarray_t) + (capacity * esize);
+    return (end + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+/** Return the offset of the occupancy bitmap for capacity elements of esize bytes */
+static inline size_t shmarray_actives_offset(size_t capacity, size_t esize) {
+    size_t end = shmarray_frees_offset(capacity, esize) + (2 * capacity * sizeof(uint32_t));
+    return (end + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/** Return the segment size for capacity elements of esize bytes */
+static inline size_t shmarray_segsize(size_t capacity, size_t esize) {
+    return shmarray_actives_offset(capacity, esize) + (shmarray_active_words(capacity) * sizeof(uint64_t));
+}
+
+/** Return a pointer to the free slot stack */
+static inline uint32_t* shmarray_get_frees(shmarray_t *sa) {
+    return (uint32_t*)((void*)sa + sa->frees_offset);
+}
+
+/** Return a pointer to the stack position of each free slot */
+static inline uint32_t* shmarray_get_free_pos(shmarray_t *sa) {
+    return shmarray_get_frees(sa) + sa->capacity;
+}
+
+/** Push a slot that became free below next_back_idx */
+static inline void shmarray_free_push(shmarray_t *sa, size_t idx) {
+    shmarray_get_frees(sa)[sa->free_count] = idx;
+    shmarray_get_free_pos(sa)[idx] = sa->free_count;
+    sa->free_count++;
+}
+
+/** Pop the most recently freed slot */
+static inline size_t shmarray_free_pop(shmarray_t *sa) {
+    return shmarray_get_frees(sa)[--sa->free_count];
+}
+
+/** Take a free slot off the stack, moving the top entry into its place */
+static inline void shmarray_free_remove(shmarray_t *sa, size_t idx) {
+    uint32_t *frees = shmarray_get_frees(sa);
+    uint32_t *pos = shmarray_get_free_pos(sa);
+    uint32_t top = frees[--sa->free_count];
+    frees[pos[idx]] = top;
+    pos[top] = pos[idx];
+}
+
+/** Start modifying the bookkeeping fields, called with the segment lock held */
+static inline void shmarray_write_begin(shmarray_t *sa) {
+    uint32_t seq = atomic_load_explicit(&sa->seq, memory_order_relaxed);
+    atomic_store_explicit(&sa->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/** Publish the modified bookkeeping fields */
+static inline void shmarray_write_end(shmarray_t *sa) {
+    uint32_t seq = atomic_load_explicit(&sa->seq, memory_order_relaxed);
+    atomic_store_explicit(&sa->seq, seq + 1, memory_order_release);
+}
+
+/** Wait until no modification is in progress and return the sequence */
+static inline uint32_t shmarray_read_begin(shmarray_t *sa) {
+    uint32_t seq;
+    while ((seq = atomic_load_explicit(&sa->seq, memory_order_acquire)) & 1) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    return seq;
+}
+
+/** Return true if the fields read since shmarray_read_begin may be inconsistent */
+static inline bool shmarray_read_retry(shmarray_t *sa, uint32_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return seq != atomic_load_explicit(&sa->seq, memory_order_relaxed);
+}
+
+/** Return the file and mapping size for segsize bytes: whole pages when huge pages back the segment */
+static inline size_t shmvector_file_size(shmvector_t *sv, size_t segsize) {
+    if (sv->page_size <= (size_t)sysconf(_SC_PAGESIZE))
+        return segsize;
+    return (segsize + sv->page_size - 1) & ~(sv->page_size - 1);
+}
+
+/** Ask for transparent huge pages on the local mapping if the segment wants them */
+static inline void shmvector_advise(shmvector_t *sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_THP)
+        madvise(sv->shm, sv->map_size, MADV_HUGEPAGE);
+}
+
+/** A part of the mapping faulted in by one thread */
+typedef struct shmvector_prefault_arg {
+    void *addr;
+    size_t len;
+} shmvector_prefault_arg_t;
+
+/** Fault in a page aligned range for writing */
+static void* shmvector_prefault_range(void *arg) {
+    shmvector_prefault_arg_t *a = arg;
+#ifdef MADV_POPULATE_WRITE
+    if (0 == madvise(a->addr, a->len, MADV_POPULATE_WRITE))
+        return NULL;
+#endif
+    /* Older kernels: write to each page without changing it, other processes may be using it */
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < a->len; off += page)
+        atomic_fetch_add_explicit((char*)a->addr + off, 0, memory_order_relaxed);
+    return NULL;
+}
+
+/** Fault in the mapping from offset from, split over the prefault threads, and lock it if asked */
+static void shmvector_prefault(shmvector_t *sv, size_t from) {
+    if (sv->prefault && from < sv->map_size) {
+        uint32_t nthreads = (sv->prefault_threads > 1) ? sv->prefault_threads : 1;
+        size_t page = (sv->page_size > 0) ? sv->page_size : (size_t)sysconf(_SC_PAGESIZE);
+        from &= ~(page - 1);
+        size_t pages = (sv->map_size - from + page - 1) / page;
+        if (nthreads > pages)
+            nthreads = pages;
+        shmvector_prefault_arg_t args[nthreads];
+        pthread_t threads[nthreads];
+        bool started[nthreads];
+        for (uint32_t t = 0; t < nthreads; t++) {
+            size_t first = pages * t / nthreads, last = pages * (t + 1) / nthreads;
+            args[t].addr = (void*)sv->shm + from + first * page;
+            args[t].len = (last - first) * page;
+            if (from + last * page > sv->map_size)
+                args[t].len = sv->map_size - from - first * page;
+            /* The calling thread takes the first part */
+            started[t] = (t > 0 &&
+                          0 == pthread_create(&threads[t], NULL, shmvector_prefault_range, &args[t]));
+        }
+        for (uint32_t t = 0; t < nthreads; t++) {
+            if (!started[t])
+                shmvector_prefault_range(&args[t]);
+        }
+        for (uint32_t t = 1; t < nthreads; t++) {
+            if (started[t])
+                pthread_join(threads[t], NULL);
+        }
+    }
+    if (sv->mlock && 0 != mlock(sv->shm, sv->map_size))
+        fprintf(stderr, "ERROR: Failure locking shared array in memory\n");
+}
+
+/** Resize the local mapping, in place if possible */
+static int shmvector_map(shmvector_t *sv, size_t segsize) {
+    size_t len = shmvector_file_size(sv, segsize);
+    void *shm = mremap(sv->shm, sv->map_size, len, 0);
+    if (MAP_FAILED == shm)
+        shm = mremap(sv->shm, sv->map_size, len, MREMAP_MAYMOVE);
+    if (MAP_FAILED == shm) {
+        /* Not every kernel can resize hugetlb mappings, so map the segment afresh */
+        shm = mmap(0, len, PROT_READ|PROT_WRITE, MAP_SHARED, sv->segd, 0);
+        if (MAP_FAILED != shm)
+            munmap(sv->shm, sv->map_size);
+    }
+    if (MAP_FAILED == shm) {
+        fprintf(stderr, "ERROR: MRemap of shared array failed\n");
+        return 1;
+    }
+    size_t old_size = sv->map_size;
+    sv->shm = shm;
+    sv->map_size = len;
+    shmvector_advise(sv);
+    shmvector_prefault(sv, old_size);
+    return 0;
+}
+
+/** Map the whole segment after another process grew it */
+static int shmvector_remap(shmvector_t *sv) {
+    shmarray_t *sa = sv->shm;
+    size_t capacity;
+    uint32_t seq, gen;
+    do {
+        seq = shmarray_read_begin(sa);
+        gen = atomic_load_explicit(&sa->map_gen, memory_order_relaxed);
+        capacity = atomic_load_explicit(&sa->capacity, memory_order_relaxed);
+    } while (shmarray_read_retry(sa, seq));
+    size_t segsize = shmarray_segsize(capacity, sa->esize);
+    if (shmvector_file_size(sv, segsize) > sv->map_size && 0 != shmvector_map(sv, segsize))
+        return 1;
+    sv->map_gen = gen;
+    return 0;
+}
+
+/** Remap the segment if it grew since this process last mapped it */
+static inline int shmvector_sync(shmvector_t *sv) {
+    if (sv->map_gen == atomic_load_explicit(&sv->shm->map_gen, memory_order_acquire))
+        return 0;
+    return shmvector_remap(sv);
+}
+
+/** Fill in the default segment options */
+void shmvector_attr_init(shmvector_attr_t *attr) {
+    memset(attr, 0, sizeof(shmvector_attr_t));
+    attr->lock_type = SHMMUTEX_DEFAULT_TYPE;
 }
 
 /** Allocate space in shared memory for an array of size N */
 int shmvector_create(shmvector_t *sv, const char* segname, size_t elesz, size_t sz) {
-	int rc = 0;
-    assert(segname != 0);
-    assert(elesz != 0);
-    memset(sv, 0, sizeof(shmvector_t));
-    sv->segname = segname;
-    /* Open exclusive so segment is intialized once */
-    sv->segd = shm_open(segname, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
-    if (-1 == sv->segd) {
-        /* Open exclusive failed, so segment is initialized elsewhere */
-        int rbytes = 0;
-        size_t capacity = 0, elesize = 0, segsize = 0;
-
-        /* Open the file and wait for the shmmutex to exist */
-        sv->segd = shm_open(segname, O_RDWR, S_IRUSR|S_IWUSR);
-        while (rbytes < sizeof(shmmutex_t)) {
-            shmmutex_t tmp;
-            rbytes = pread(sv->segd, &tmp, sizeof(shmmutex_t), offsetof(shmarray_t, lock));
-        }
+    return shmvector_create_attr(sv, segname, elesz, sz, NULL);
+}
 
-        /* MMap the lock to determine if shm initialization has completed */
-        sv->shm = mmap(offsetof(shmarray_t, lock), sizeof(shmmutex_t), 
-                                PROT_READ|PROT_WRITE, MAP_SHARED, sv->segd, 0);
-        if (sv->shm == MAP_FAILED) {
-            fprintf(stderr, "ERROR: MMap to acquire existing lock failed\n");
-            close(sv->segd);
-            rc = 1;
+/** Use POSIX shared memory instead of hugetlbfs */
+static void shmvector_drop_hugetlb(shmvector_t *sv) {
+    free(sv->hugetlb_path);
+    sv->hugetlb_path = NULL;
+    sv->page_size = sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Look for a writable hugetlbfs mount with pages of page_size for the segment file.
+ * With a page_size of 0, look for a mount of any page size that already holds it.
+ */
+static void shmvector_find_hugetlb(shmvector_t *sv, size_t page_size) {
+    FILE *mounts = setmntent("/proc/mounts", "r");
+    if (NULL == mounts)
+        return;
+    struct mntent *m;
+    while (NULL != (m = getmntent(mounts))) {
+        struct statfs fs;
+        if (0 != strcmp(m->mnt_type, "hugetlbfs") || 0 != statfs(m->mnt_dir, &fs))
+            continue;
+        if (0 != page_size && ((size_t)fs.f_bsize != page_size || 0 != access(m->mnt_dir, W_OK)))
+            continue;
+        sv->hugetlb_path = malloc(strlen(m->mnt_dir) + strlen(sv->segname) + 1);
+        if (NULL == sv->hugetlb_path)
+            break;
+        strcpy(sv->hugetlb_path, m->mnt_dir);
+        strcat(sv->hugetlb_path, sv->segname);
+        if (0 == page_size && 0 != access(sv->hugetlb_path, F_OK)) {
+            shmvector_drop_hugetlb(sv);
+            continue;
         }
+        sv->page_size = fs.f_bsize;
+        break;
+    }
+    endmntent(mounts);
+}
 
-        /* Critical section - lock/unlock to ensure mutex creation is complete */
-        shmmutex_lock(&(sv->shm->lock));
-        shmmutex_unlock(&(sv->shm->lock));
-        munmap(sv->shm, sizeof(shmmutex_t));
+/** Open the segment file on hugetlbfs or in POSIX shared memory */
+static int shmvector_open(shmvector_t *sv, int oflag) {
+    if (NULL != sv->hugetlb_path)
+        return open(sv->hugetlb_path, oflag, S_IRUSR|S_IWUSR);
+    return shm_open(sv->segname, oflag, S_IRUSR|S_IWUSR);
+}
 
-        /* Setup local pointers into shared memory space */
-        rbytes = 0;
-        while (rbytes < (sizeof(size_t) * 2)) {
-            rbytes = pread(sv->segd, &capacity, sizeof(size_t), offsetof(shmarray_t, capacity));
-            rbytes += pread(sv->segd, &elesize, sizeof(size_t), offsetof(shmarray_t, esize));
-        }
-        segsize = sizeof(shmarray_t) + (capacity * elesize) + (capacity * sizeof(bool));
-        sv->shm = mmap(0, segsize, PROT_READ|PROT_WRITE, MAP_SHARED, sv->segd, 0);    
-        if (sv->shm == MAP_FAILED) {
-            fprintf(stderr, "ERROR: MMap to acquire shared array failed\n");
+/** Remove the segment file */
+static void shmvector_unlink(shmvector_t *sv) {
+    if (NULL != sv->hugetlb_path)
+        unlink(sv->hugetlb_path);
+    else
+        shm_unlink(sv->segname);
+}
+
+/**
+ * Attach to a segment initialized by another process
+ * @return 0 on success, EAGAIN if the segment was removed before it was
+ *         initialized, other non-zero on failure
+ */
+static int shmvector_attach(shmvector_t *sv) {
+    int rc = 0;
+    size_t capacity = 0, elesize = 0, segsize = 0;
+
+    /* Open the file and wait for the header to exist */
+    struct stat st = {0};
+    sv->segd = shmvector_open(sv, O_RDWR);
+    if (-1 == sv->segd)
+        return EAGAIN;
+    while (0 == fstat(sv->segd, &st) && st.st_size < (off_t)sizeof(shmarray_t)) {
+        /* The creator could not get huge pages and fell back to POSIX shared memory */
+        if (0 == st.st_nlink) {
             close(sv->segd);
-            rc = 1;
+            return EAGAIN;
         }
+    }
 
-        /* Critical section - increment the reference count */
-        shmmutex_lock(&(sv->shm->lock));
-        sv->shm->ref_count++;
-        shmmutex_unlock(&(sv->shm->lock));
+    /* MMap the header to determine if shm initialization has completed */
+    size_t hdrsize = shmvector_file_size(sv, sizeof(shmarray_t));
+    sv->shm = mmap(0, hdrsize, PROT_READ|PROT_WRITE, MAP_SHARED, sv->segd, 0);
+    if (sv->shm == MAP_FAILED) {
+        fprintf(stderr, "ERROR: MMap to acquire existing lock failed\n");
+        close(sv->segd);
+        return 1;
     }
-    else {
-        /* Initialize the shared memory segement */
-        size_t segsize = sizeof(shmarray_t) + (sz * elesz) + (sz * sizeof(bool));
+
+    /* Critical section - lock/unlock to ensure mutex creation is complete */
+    shmmutex_lock(&(sv->shm->lock));
+    shmmutex_unlock(&(sv->shm->lock));
+    uint32_t version = sv->shm->version;
+    uint32_t header_size = sv->shm->header_size;
+    capacity = sv->shm->capacity;
+    elesize = sv->shm->esize;
+    if (sv->shm->flags & SHMVECTOR_FLAG_THP)
+        sv->page_size = SHMVECTOR_PAGE_2M;
+    munmap(sv->shm, hdrsize);
+    if (SHMVECTOR_FORMAT_VERSION != version) {
+        fprintf(stderr, "ERROR: Segment %s has layout version %#x, expected %#x\n",
+                sv->segname, version, SHMVECTOR_FORMAT_VERSION);
+        close(sv->segd);
+        sv->shm = NULL;
+        return 1;
+    }
+    if (sizeof(shmarray_t) != header_size) {
+        fprintf(stderr, "ERROR: Segment %s has a %u byte header, expected %zu\n",
+                sv->segname, header_size, sizeof(shmarray_t));
+        close(sv->segd);
+        sv->shm = NULL;
+        return 1;
+    }
+
+    /* Setup local pointers into shared memory space */
+    segsize = shmvector_file_size(sv, shmarray_segsize(capacity, elesize));
+    sv->shm = mmap(0, segsize, PROT_READ|PROT_WRITE, MAP_SHARED, sv->segd, 0);    
+    if (sv->shm == MAP_FAILED) {
+        fprintf(stderr, "ERROR: MMap to acquire shared array failed\n");
+        close(sv->segd);
+        rc = 1;
+    }
+    sv->map_size = segsize;
+    shmvector_advise(sv);
+    shmvector_prefault(sv, 0);
+
+    /* Critical section - increment the reference count; the segment may have grown since we read its capacity */
+    shmvector_lock(sv);
+    shmvector_remap(sv);
+    sv->shm->ref_count++;
+    shmvector_unlock(sv);
+    return rc;
+}
+
+/**
+ * Initialize a segment we created
+ * @return 0 on success, EAGAIN if huge pages are unavailable and the segment
+ *         should be created in POSIX shared memory, other non-zero on failure
+ */
+static int shmvector_init(shmvector_t *sv, size_t elesz, size_t sz, const shmvector_attr_t *attr) {
+    int rc = 0;
+    uint32_t flags = attr->rwlock ? SHMVECTOR_FLAG_RWLOCK : 0;
+    if (attr->growable)
+        flags |= SHMVECTOR_FLAG_GROWABLE;
+    if (NULL != sv->hugetlb_path)
+        flags |= SHMVECTOR_FLAG_HUGETLB;
+    else if (attr->page_size > (size_t)sysconf(_SC_PAGESIZE)) {
+        /* No hugetlbfs pages of that size: let the kernel use transparent huge pages */
+        flags |= SHMVECTOR_FLAG_THP;
+        sv->page_size = SHMVECTOR_PAGE_2M;
+    }
+    size_t segsize = shmvector_file_size(sv, shmarray_segsize(sz, elesz));
+
+    if (flags & SHMVECTOR_FLAG_HUGETLB) {
+        /* Mapping reserves the huge pages, so map before other processes see the size */
+        sv->shm = mmap(0, segsize, PROT_READ|PROT_WRITE, MAP_SHARED, sv->segd, 0);
+        if (sv->shm == MAP_FAILED || 0 != ftruncate(sv->segd, segsize)) {
+            if (sv->shm != MAP_FAILED)
+                munmap(sv->shm, segsize);
+            shmvector_unlink(sv);
+            close(sv->segd);
+            shmvector_drop_hugetlb(sv);
+            return EAGAIN;
+        }
+    } else {
         /* Don't need to check the ftruncate, because mmap fails if ftruncate failed */
         ftruncate(sv->segd, segsize);
         sv->shm = mmap(0, segsize, PROT_READ|PROT_WRITE, MAP_SHARED, sv->segd, 0);
-        if (sv->shm != MAP_FAILED) {
-            /* Initialize everything but the mutex */
-            sv->shm->ref_count = 1;
-            sv->shm->capacity = sz;
-            sv->shm->esize = elesz;
-            sv->shm->active_count = 0;
-            sv->shm->next_back_idx = 0;
-            sv->shm->eles_offset = sizeof(shmarray_t);
-            sv->shm->actives_offset = sv->shm->eles_offset + (sz * elesz);
-
-            /* Create the mutex as the last step to unblock other processes */
-            shmmutex_create(&sv->shm->lock);
-        } else {
-            fprintf(stderr, "ERROR: MMap failed while creating shared array\n");
-            close(sv->segd);
-            rc = 1;
+    }
+    if (sv->shm != MAP_FAILED) {
+        sv->map_size = segsize;
+        /* Initialize everything but the mutex */
+        sv->shm->version = SHMVECTOR_FORMAT_VERSION;
+        sv->shm->header_size = sizeof(shmarray_t);
+        sv->shm->ref_count = 1;
+        sv->shm->capacity = sz;
+        sv->shm->esize = elesz;
+        sv->shm->active_count = 0;
+        sv->shm->next_back_idx = 0;
+        sv->shm->free_count = 0;
+        sv->shm->eles_offset = sizeof(shmarray_t);
+        sv->shm->frees_offset = shmarray_frees_offset(sz, elesz);
+        sv->shm->actives_offset = shmarray_actives_offset(sz, elesz);
+        sv->shm->map_gen = 0;
+        sv->shm->flags = flags;
+        shmvector_advise(sv);
+        shmvector_prefault(sv, 0);
+        shmrwlock_create(&sv->shm->rwlock);
+        shmcond_create(&sv->shm->cond);
+#ifdef SHMMUTEX_STATS
+        if (attr->stats) {
+            sv->shm->flags |= SHMVECTOR_FLAG_STATS;
+            shmmutex_stats_attach(&sv->shm->lock, &sv->shm->lock_stats);
+        }
+#endif
+
+        /* Create the mutex as the last step to unblock other processes */
+        if (0 != shmmutex_create_type(&sv->shm->lock, attr->lock_type)) {
+            fprintf(stderr, "ERROR: Unknown lock type %u, using the default\n", attr->lock_type);
+            shmmutex_create_type(&sv->shm->lock, SHMMUTEX_DEFAULT_TYPE);
         }
+    } else {
+        fprintf(stderr, "ERROR: MMap failed while creating shared array\n");
+        close(sv->segd);
+        rc = 1;
     }
-	return rc;
+    return rc;
+}
+
+/** Allocate space in shared memory for an array of size N with segment options */
+int shmvector_create_attr(shmvector_t *sv, const char* segname, size_t elesz, size_t sz,
+                          const shmvector_attr_t *attr) {
+	int rc = 0;
+    shmvector_attr_t defaults;
+    if (NULL == attr) {
+        shmvector_attr_init(&defaults);
+        attr = &defaults;
+    }
+    assert(segname != 0);
+    assert(elesz != 0);
+    memset(sv, 0, sizeof(shmvector_t));
+    sv->segname = segname;
+    sv->page_size = sysconf(_SC_PAGESIZE);
+    sv->prefault = attr->prefault;
+    sv->mlock = attr->mlock;
+    sv->prefault_threads = attr->prefault_threads;
+    if (attr->page_size > sv->page_size)
+        shmvector_find_hugetlb(sv, attr->page_size);
+    do {
+        /* A segment that could not get huge pages lives in POSIX shared memory */
+        if (NULL != sv->hugetlb_path) {
+            int fd = shm_open(segname, O_RDWR, 0);
+            if (-1 != fd) {
+                close(fd);
+                shmvector_drop_hugetlb(sv);
+            }
+        }
+        /* Open exclusive so segment is intialized once */
+        sv->segd = shmvector_open(sv, O_RDWR|O_CREAT|O_EXCL);
+        if (-1 == sv->segd)
+            /* Open exclusive failed, so segment is initialized elsewhere */
+            rc = shmvector_attach(sv);
+        else
+            rc = shmvector_init(sv, elesz, sz, attr);
+    } while (EAGAIN == rc);
+    if (0 != rc)
+        shmvector_drop_hugetlb(sv);
+    return rc;
 }
 
 int shmvector_destroy(shmvector_t *sv) {
@@ -107,77 +517,322 @@ int shmvector_destroy(shmvector_t *sv) {
     int rc = shmmutex_destroy(&sv->shm->lock);
 
     /* Free resources */
-    size_t segsize = sizeof(shmarray_t) + (sv->shm->capacity * sv->shm->esize) + 
-        (sv->shm->capacity * sizeof(bool));
-    shm_unlink(sv->segname);
+    shmvector_unlink(sv);
     close(sv->segd);
-    munmap(sv->shm, segsize);
+    munmap(sv->shm, sv->map_size);
+    shmvector_drop_hugetlb(sv);
     return rc;
 }
 
 int shmvector_destroy_safe(shmvector_t *sv) {
     /* Take the lock and destroy it if the refcount is 0 */
     int rc = 0;
-    shmmutex_lock(&(sv->shm->lock));
+    shmvector_lock(sv);
     sv->shm->ref_count--;
     if (0 == sv->shm->ref_count) {
-        shm_unlink(sv->segname);
-        rc = shmmutex_destroy_if_locked(&sv->shm->lock);
+        shmvector_unlink(sv);
+        if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+            rc = shmmutex_destroy(&sv->shm->lock);
+        else
+            rc = shmmutex_destroy_if_locked(&sv->shm->lock);
     } else {
-        shmmutex_unlock(&(sv->shm->lock));
+        shmvector_unlock(sv);
     }
 
     /* Perform local cleanup */
-    size_t segsize = sizeof(shmarray_t) + (sv->shm->capacity * sv->shm->esize) + 
-        (sv->shm->capacity * sizeof(bool));
     close(sv->segd);
-    munmap(sv->shm, segsize);
+    munmap(sv->shm, sv->map_size);
+    shmvector_drop_hugetlb(sv);
+    return rc;
+}
+
+/** Restore the segment state after the previous lock owner died */
+static int shmvector_recover(shmvector_t *sv) {
+    shmvector_repair(sv);
+    if (NULL != sv->repair)
+        sv->repair(sv, sv->repair_arg);
+    return 0;
+}
+
+/** Take the segment lock exclusively */
+int shmvector_lock(shmvector_t *sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_wrlock(&sv->shm->rwlock);
+    int rc = shmmutex_lock(&sv->shm->lock);
+    if (EOWNERDEAD == rc)
+        rc = shmvector_recover(sv);
+    return rc;
+}
+
+/** Release the exclusive segment lock */
+int shmvector_unlock(shmvector_t *sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_wrunlock(&sv->shm->rwlock);
+    return shmmutex_unlock(&sv->shm->lock);
+}
+
+/** Take the segment lock exclusively without waiting */
+int shmvector_trylock(shmvector_t *sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_trywrlock(&sv->shm->rwlock);
+    int rc = shmmutex_trylock(&sv->shm->lock);
+    if (EOWNERDEAD == rc)
+        rc = shmvector_recover(sv);
+    return rc;
+}
+
+/** Take the segment lock exclusively before the deadline */
+int shmvector_timedlock(shmvector_t *sv, const struct timespec *abstime) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_timedwrlock(&sv->shm->rwlock, abstime);
+    int rc = shmmutex_timedlock(&sv->shm->lock, abstime);
+    if (EOWNERDEAD == rc)
+        rc = shmvector_recover(sv);
     return rc;
 }
 
+/** Take the segment lock for reading */
+int shmvector_lock_shared(shmvector_t *sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_rdlock(&sv->shm->rwlock);
+    int rc = shmmutex_lock(&sv->shm->lock);
+    if (EOWNERDEAD == rc)
+        rc = shmvector_recover(sv);
+    return rc;
+}
+
+/** Take the segment lock for reading without waiting */
+int shmvector_trylock_shared(shmvector_t *sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_tryrdlock(&sv->shm->rwlock);
+    return shmvector_trylock(sv);
+}
+
+/** Take the segment lock for reading before the deadline */
+int shmvector_timedlock_shared(shmvector_t *sv, const struct timespec *abstime) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_timedrdlock(&sv->shm->rwlock, abstime);
+    return shmvector_timedlock(sv, abstime);
+}
+
+/** Release the segment lock held for reading */
+int shmvector_unlock_shared(shmvector_t *sv) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return shmrwlock_rdunlock(&sv->shm->rwlock);
+    return shmmutex_unlock(&sv->shm->lock);
+}
+
+/** Sleep until the segment is signalled, holding the exclusive lock before and after */
+int shmvector_wait(shmvector_t *sv, const struct timespec *abstime) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_RWLOCK)
+        return ENOTSUP;
+    int rc = shmcond_timedwait(&sv->shm->cond, &sv->shm->lock, abstime);
+    if (EOWNERDEAD == rc)
+        rc = shmvector_recover(sv);
+    return rc;
+}
+
+/** Wake one process waiting on the segment */
+int shmvector_signal(shmvector_t *sv) {
+    return shmcond_signal(&sv->shm->cond);
+}
+
+/** Wake every process waiting on the segment */
+int shmvector_broadcast(shmvector_t *sv) {
+    return shmcond_broadcast(&sv->shm->cond, &sv->shm->lock);
+}
+
+/** Recount the active elements and the back index from the occupancy bitmap */
+void shmvector_repair(shmvector_t *sv) {
+    shmvector_sync(sv);
+    uint64_t *actives = shmarray_get_actives(sv->shm);
+    size_t nwords = shmarray_active_words(sv->shm->capacity);
+    size_t count = 0, back = 0;
+    for (size_t w = 0; w < nwords; w++) {
+        if (0 != actives[w]) {
+            count += __builtin_popcountll(actives[w]);
+            back = (w + 1) * 64 - __builtin_clzll(actives[w]);
+        }
+    }
+    /* The owner may have died between write_begin and write_end */
+    if (atomic_load_explicit(&sv->shm->seq, memory_order_relaxed) & 1)
+        shmarray_write_end(sv->shm);
+    shmarray_write_begin(sv->shm);
+    sv->shm->active_count = count;
+    if (sv->shm->next_back_idx < back || sv->shm->next_back_idx > sv->shm->capacity)
+        sv->shm->next_back_idx = back;
+    shmarray_write_end(sv->shm);
+
+    /* Rebuild the free slot stack */
+    sv->shm->free_count = 0;
+    for (size_t w = 0; w * 64 < sv->shm->next_back_idx; w++) {
+        uint64_t free = ~actives[w];
+        size_t left = sv->shm->next_back_idx - w * 64;
+        if (left < 64)
+            free &= ((uint64_t)1 << left) - 1;
+        for (; 0 != free; free &= free - 1)
+            shmarray_free_push(sv->shm, w * 64 + __builtin_ctzll(free));
+    }
+}
+
+/** Sum the segment lock statistics */
+int shmvector_stats(shmvector_t *sv, shmmutex_stats_counts_t *out) {
+    if (sv->shm->flags & SHMVECTOR_FLAG_STATS)
+        return shmmutex_stats_read(&sv->shm->lock_stats, out);
+    memset(out, 0, sizeof(shmmutex_stats_counts_t));
+    return ENOTSUP;
+}
+
+/** Sum the segment lock statistics of a segment we are not attached to */
+int shmvector_stats_by_name(const char* segname, shmmutex_stats_counts_t *out) {
+    int rc = 1;
+    shmvector_t sv = {0};
+    sv.segname = segname;
+    sv.page_size = sysconf(_SC_PAGESIZE);
+    int segd = shmvector_open(&sv, O_RDONLY);
+    if (-1 == segd) {
+        /* The segment may be a file on a hugetlbfs mount */
+        shmvector_find_hugetlb(&sv, 0);
+        if (NULL != sv.hugetlb_path)
+            segd = shmvector_open(&sv, O_RDONLY);
+    }
+    if (-1 == segd) {
+        shmvector_drop_hugetlb(&sv);
+        return rc;
+    }
+    size_t hdrsize = shmvector_file_size(&sv, sizeof(shmarray_t));
+    shmarray_t *shm = mmap(0, hdrsize, PROT_READ, MAP_SHARED, segd, 0);
+    if (shm != MAP_FAILED) {
+        memset(out, 0, sizeof(shmmutex_stats_counts_t));
+        rc = ENOTSUP;
+        if (SHMVECTOR_FORMAT_VERSION != shm->version || sizeof(shmarray_t) != shm->header_size)
+            rc = 1;
+        else if (shm->flags & SHMVECTOR_FLAG_STATS)
+            rc = shmmutex_stats_read(&shm->lock_stats, out);
+        munmap(shm, hdrsize);
+    }
+    close(segd);
+    shmvector_drop_hugetlb(&sv);
+    return rc;
+}
+
+/** Read the bookkeeping fields under the sequence counter */
+void shmvector_header(shmvector_t *sv, shmvector_header_t *out) {
+    shmarray_t *sa = sv->shm;
+    uint32_t seq;
+    do {
+        seq = shmarray_read_begin(sa);
+        out->capacity = atomic_load_explicit(&sa->capacity, memory_order_relaxed);
+        out->next_back_idx = atomic_load_explicit(&sa->next_back_idx, memory_order_relaxed);
+        out->active_count = atomic_load_explicit(&sa->active_count, memory_order_relaxed);
+    } while (shmarray_read_retry(sa, seq));
+}
+
+/** Return the number of segments chained to this one */
+uint32_t shmvector_chain_gen(shmvector_t *sv) {
+    return atomic_load_explicit(&sv->shm->chain_gen, memory_order_acquire);
+}
+
+/** Publish a new number of chained segments */
+void shmvector_set_chain_gen(shmvector_t *sv, uint32_t gen) {
+    atomic_store_explicit(&sv->shm->chain_gen, gen, memory_order_release);
+}
+
+/** Return the size of the pages backing the segment */
+size_t shmvector_page_size(shmvector_t *sv) {
+    return sv->page_size;
+}
+
 /** Return the number of active elements */
 size_t shmvector_size(shmvector_t *sv) { 
-    return sv->shm->active_count; 
+    shmvector_header_t hdr;
+    shmvector_header(sv, &hdr);
+    return hdr.active_count; 
+}
+
+/** Return the first active index at or after idx, or -1 */
+int shmvector_next(shmvector_t *sv, size_t idx) {
+    shmvector_sync(sv);
+    shmarray_t *sa = sv->shm;
+    if (idx >= sa->capacity)
+        return -1;
+    const uint64_t *actives = shmarray_get_actives(sa);
+    size_t nwords = shmarray_active_words(sa->capacity);
+    size_t w = idx / 64;
+    uint64_t word = actives[w] & (~(uint64_t)0 << (idx % 64));
+    if (0 == word) {
+        w = shmarray_next_word(actives, w + 1, nwords);
+        if (w == nwords)
+            return -1;
+        word = actives[w];
+    }
+    return w * 64 + __builtin_ctzll(word);
 }
 
 /** Return the element if found, or -1 if not found */
 int shmvector_find_first_of(shmvector_t *sv, void* data, shmvector_elecmp_fn elecmp) {
-    /* Search for an entry not marked active */
-    int found_idx = -1;
-    bool* actives = shmarray_get_actives(sv->shm);
-    void* eles = shmarray_get_eles(sv->shm);
-    for (int i = 0; i < sv->shm->capacity; i++) {
-        if (true == actives[i]) {
-            if (0 == elecmp(data, eles + (i * sv->shm->esize))) {
-                found_idx = i;
-                break;
-            }
-        }
+    /* Compare the active entries only */
+    for (int i = shmvector_next(sv, 0); i >= 0; i = shmvector_next(sv, i + 1)) {
+        if (0 == elecmp(data, shmarray_get_eles(sv->shm) + (i * sv->shm->esize)))
+            return i;
     }
-    return found_idx;   
+    return -1;
+}
+
+/** Return the element if found, or -1 if not found, with thread-safety for readers */
+int shmvector_find_first_of_shared(shmvector_t *sv, void* data, shmvector_elecmp_fn elecmp) {
+    int idx;
+    shmvector_lock_shared(sv);
+    idx = shmvector_find_first_of(sv, data, elecmp);
+    shmvector_unlock_shared(sv);
+    return idx;
 }
 
 /** Add an element to the array with thread-safety */
 int shmvector_safe_push_back(shmvector_t* sv, void* ele) {
     int idx;
-    shmmutex_lock(&sv->shm->lock);
+    shmvector_lock(sv);
+    idx = shmvector_push_back(sv, ele);
+    shmvector_unlock(sv);
+	return idx;
+}
+
+/** Add an element to the array if the lock is free */
+int shmvector_safe_push_back_try(shmvector_t* sv, void* ele) {
+    int idx, rc = shmvector_trylock(sv);
+    if (0 != rc)
+        return -rc;
+    idx = shmvector_push_back(sv, ele);
+    shmvector_unlock(sv);
+	return idx;
+}
+
+/** Add an element to the array if the lock is acquired before the deadline */
+int shmvector_safe_push_back_timed(shmvector_t* sv, void* ele, const struct timespec *abstime) {
+    int idx, rc = shmvector_timedlock(sv, abstime);
+    if (0 != rc)
+        return -rc;
     idx = shmvector_push_back(sv, ele);
-    shmmutex_unlock(&sv->shm->lock);
+    shmvector_unlock(sv);
 	return idx;
 }
 
 /** Add an element to the array */
 int shmvector_push_back(shmvector_t* sv, void* ele) {
 	int idx = -1;
+	shmvector_sync(sv);
+	if (sv->shm->next_back_idx == sv->shm->capacity && (sv->shm->flags & SHMVECTOR_FLAG_GROWABLE))
+		shmvector_grow_array(sv);
 	if (sv->shm->next_back_idx < sv->shm->capacity) {
         void* eles = shmarray_get_eles(sv->shm);
-        bool* actives = shmarray_get_actives(sv->shm);
 		void* buf_offset = eles + (sv->shm->esize * sv->shm->next_back_idx);
 		buf_offset = memcpy(buf_offset, ele, sv->shm->esize);
-		actives[sv->shm->next_back_idx] = true;
+		shmarray_set_active(sv->shm, sv->shm->next_back_idx, true);
         idx = sv->shm->next_back_idx;
+		shmarray_write_begin(sv->shm);
 		sv->shm->next_back_idx++;
 		sv->shm->active_count++;
+		shmarray_write_end(sv->shm);
 	}
 	return idx;
 }
@@ -185,19 +840,30 @@ int shmvector_push_back(shmvector_t* sv, void* ele) {
 /** Insert an element to the array at position idx */
 int shmvector_insert_at(shmvector_t* sv, size_t idx, void* ele) {
     int rc = -1;
+    shmvector_sync(sv);
 	if (idx < sv->shm->capacity) {
         void* eles = shmarray_get_eles(sv->shm);
-        bool* actives = shmarray_get_actives(sv->shm);
+        bool active = shmarray_is_active(sv->shm, idx);
 		void* buf_offset = eles + (sv->shm->esize * idx);
 		buf_offset = memcpy(buf_offset, ele, sv->shm->esize);
+        /* Keep the free slot stack to the free slots below next_back_idx */
+        if (idx < sv->shm->next_back_idx) {
+            if (!active)
+                shmarray_free_remove(sv->shm, idx);
+        } else {
+            for (size_t i = sv->shm->next_back_idx; i < idx; i++)
+                shmarray_free_push(sv->shm, i);
+        }
         /* Update the active count and last_idx if required */
-        if (!actives[idx]) {
-		    actives[idx] = true;
+        shmarray_write_begin(sv->shm);
+        if (!active) {
+		    shmarray_set_active(sv->shm, idx, true);
 		    sv->shm->active_count++;
         }
         if (idx >= sv->shm->next_back_idx) {
             sv->shm->next_back_idx = idx + 1;
         }
+        shmarray_write_end(sv->shm);
         rc = idx;
 	}
 	return rc;
@@ -206,73 +872,161 @@ int shmvector_insert_at(shmvector_t* sv, size_t idx, void* ele) {
 /** Return a pointer to the element at idx with thread-safety*/
 void* shmvector_safe_at(shmvector_t* sv, size_t idx) {
 	void *val;
-    shmmutex_lock(&sv->shm->lock);
+    shmvector_lock(sv);
     val = shmvector_at(sv, idx);
-    shmmutex_unlock(&sv->shm->lock);
+    shmvector_unlock(sv);
+	return val;
+}
+
+/** Return a pointer to the element at idx if the lock is free */
+void* shmvector_safe_at_try(shmvector_t* sv, size_t idx) {
+	void *val;
+    int rc = shmvector_trylock(sv);
+    if (0 != rc) {
+        errno = rc;
+        return NULL;
+    }
+    val = shmvector_at(sv, idx);
+    shmvector_unlock(sv);
+	return val;
+}
+
+/** Return a pointer to the element at idx if the lock is acquired before the deadline */
+void* shmvector_safe_at_timed(shmvector_t* sv, size_t idx, const struct timespec *abstime) {
+	void *val;
+    int rc = shmvector_timedlock(sv, abstime);
+    if (0 != rc) {
+        errno = rc;
+        return NULL;
+    }
+    val = shmvector_at(sv, idx);
+    shmvector_unlock(sv);
+	return val;
+}
+
+/** Return a pointer to the element at idx with thread-safety for readers */
+void* shmvector_safe_at_shared(shmvector_t* sv, size_t idx) {
+	void *val;
+    shmvector_lock_shared(sv);
+    val = shmvector_at(sv, idx);
+    shmvector_unlock_shared(sv);
 	return val;
 }
 
 /** Return a pointer to the element at idx */
 void* shmvector_at(shmvector_t* sv, size_t idx) {
-	void *val = 0;
-    bool *actives = shmarray_get_actives(sv->shm);
-	if (sv->shm->next_back_idx > idx && true == actives[idx]) {
-        void *eles = shmarray_get_eles(sv->shm);
-        val = eles + (sv->shm->esize * idx);
-	}
+	void *val;
+    shmarray_t *sa;
+    uint32_t seq, gen;
+    /* The bitmap moves when the segment grows, so read it under the sequence too */
+    do {
+        shmvector_sync(sv);
+        sa = sv->shm;
+        val = 0;
+        seq = shmarray_read_begin(sa);
+        gen = atomic_load_explicit(&sa->map_gen, memory_order_relaxed);
+        size_t back = atomic_load_explicit(&sa->next_back_idx, memory_order_relaxed);
+        size_t offset = atomic_load_explicit(&sa->actives_offset, memory_order_relaxed);
+        uint64_t *word = (uint64_t*)((void*)sa + offset) + idx / 64;
+        if (back > idx && (void*)(word + 1) <= (void*)sa + sv->map_size &&
+            ((atomic_load_explicit(word, memory_order_relaxed) >> (idx % 64)) & 1))
+            val = shmarray_get_eles(sa) + (sa->esize * idx);
+    } while (shmarray_read_retry(sa, seq) || gen != sv->map_gen);
 	return val;
 }
 
+/** Return a pointer to the storage of idx, active or not */
+void* shmvector_slot(shmvector_t* sv, size_t idx) {
+    shmvector_sync(sv);
+    if (idx >= sv->shm->capacity)
+        return NULL;
+    return shmarray_get_eles(sv->shm) + (sv->shm->esize * idx);
+}
 
-/* Perform an empty push back if possible, otherwise search for an empty slot */
+
+/* Reuse the most recently freed slot if possible, otherwise perform an empty push back */
 int shmvector_insert_quick(shmvector_t* sv) {
     int idx = -1;
-    /* If the vector has space find a location to insert this element */
-    if (sv->shm->active_count < sv->shm->capacity) {
-        /* If space is avilable at the back of the list, use that */
-        if (sv->shm->next_back_idx < sv->shm->capacity) {
-            idx = sv->shm->next_back_idx;
-            bool *actives = shmarray_get_actives(sv->shm);
-            actives[sv->shm->next_back_idx] = true;
-            sv->shm->next_back_idx++;
-            sv->shm->active_count++;
-        }
-        else {
-            /* back insertion failed so search for an entry not marked active */
-            bool *actives = shmarray_get_actives(sv->shm);
-            for (int i = 0; i < sv->shm->capacity; i++) {
-                if (!(actives[i])) {
-                    idx = i;
-                    actives[i] = true;
-                    sv->shm->active_count++;
-                    break;
-                }
-            }
-        }
+    shmvector_sync(sv);
+    if (sv->shm->active_count == sv->shm->capacity && (sv->shm->flags & SHMVECTOR_FLAG_GROWABLE))
+        shmvector_grow_array(sv);
+    if (sv->shm->free_count > 0) {
+        /* A recently freed slot is likely still in cache */
+        idx = shmarray_free_pop(sv->shm);
+        shmarray_set_active(sv->shm, idx, true);
+        shmarray_write_begin(sv->shm);
+        sv->shm->active_count++;
+        shmarray_write_end(sv->shm);
+    }
+    else if (sv->shm->next_back_idx < sv->shm->capacity) {
+        idx = sv->shm->next_back_idx;
+        shmarray_set_active(sv->shm, idx, true);
+        shmarray_write_begin(sv->shm);
+        sv->shm->next_back_idx++;
+        sv->shm->active_count++;
+        shmarray_write_end(sv->shm);
     }
-    bool *actives = shmarray_get_actives(sv->shm);
     return idx;
 }
 
 /* If the element at idx exists, mark it available */
 int shmvector_del(shmvector_t* sv, size_t idx) {
     int rc = -1;
-    bool *actives = shmarray_get_actives(sv->shm);
-    if (actives[idx]) {
-        actives[idx] = false;
+    shmvector_sync(sv);
+    if (idx < sv->shm->capacity && shmarray_is_active(sv->shm, idx)) {
+        shmarray_set_active(sv->shm, idx, false);
+        shmarray_free_push(sv->shm, idx);
+        shmarray_write_begin(sv->shm);
         sv->shm->active_count--;
+        shmarray_write_end(sv->shm);
         rc = 0;
     }
     return rc;
 }
 
-/* Double the size of the shmarray and copy data as needed */
+/* Double the size of the shmarray, keeping every element at its index */
 int shmvector_grow_array(shmvector_t *sv) {
-	int rc = -1;
+    if (0 != shmvector_sync(sv))
+        return 1;
+    size_t capacity = sv->shm->capacity;
     size_t newsz = 1024;
-    if (sv->shm->capacity > 0) {
-	    newsz = sv->shm->capacity * 2;
+    if (capacity > 0) {
+	    newsz = capacity * 2;
     }
-    /* Not yet implemented */
-	return -1;
+    size_t segsize = shmarray_segsize(newsz, sv->shm->esize);
+    if (0 != ftruncate(sv->segd, shmvector_file_size(sv, segsize))) {
+        fprintf(stderr, "ERROR: Failure growing shared array\n");
+        return 1;
+    }
+    if (0 != shmvector_map(sv, segsize))
+        return 1;
+
+    /*
+     * The free slot stack, the stack positions and the occupancy bitmap move
+     * past the new elements, and may overlap their old places, so move the
+     * highest first. Lock-free readers wait for the sequence meanwhile. The
+     * file grew zero filled, so new slots are inactive.
+     */
+    shmarray_t *sa = sv->shm;
+    uint32_t *old_frees = shmarray_get_frees(sa);
+    uint32_t *old_pos = shmarray_get_free_pos(sa);
+    uint64_t *old_actives = shmarray_get_actives(sa);
+    size_t frees_offset = shmarray_frees_offset(newsz, sa->esize);
+    size_t actives_offset = shmarray_actives_offset(newsz, sa->esize);
+    uint32_t *frees = (uint32_t*)((void*)sa + frees_offset);
+    shmarray_write_begin(sa);
+    memmove((void*)sa + actives_offset, old_actives, shmarray_active_words(capacity) * sizeof(uint64_t));
+    memmove(frees + newsz, old_pos, capacity * sizeof(uint32_t));
+    memmove(frees, old_frees, sa->free_count * sizeof(uint32_t));
+    sa->frees_offset = frees_offset;
+    sa->actives_offset = actives_offset;
+    sa->capacity = newsz;
+    sa->map_gen++;
+    shmarray_write_end(sa);
+    sv->map_gen = sa->map_gen;
+
+    /* What lies between the old elements and the moved arrays is storage of the new elements */
+    void *old_end = shmarray_get_eles(sa) + (capacity * sa->esize);
+    memset(old_end, 0, (void*)frees - old_end);
+    return 0;
 }
@@ -8,12 +8,19 @@
  * Using access functions adds the ability to grow the array dynamically
  * and reuse space. Direct access to memory removes that capability.
  *
+ * A vector created with attr.growable doubles its capacity when push_back
+ * or insert_quick find it full. Indices stay valid across growth, but the
+ * segment may be remapped at another address, so pointers returned by at()
+ * are only valid until the next vector call on the same shmvector_t.
+ *
  */
 #ifndef SHM_VECTOR_H
 #define SHM_VECTOR_H
 
 #include <stdbool.h>
+#include "shm_cond.h"
 #include "shm_mutex.h"
+#include "shm_rwlock.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,9 +32,81 @@ extern "C" {
  */
 typedef int (*shmvector_elecmp_fn)(void* lhs, void* rhs);
 
+/** Segment flags */
+#define SHMVECTOR_FLAG_RWLOCK 0x1
+#define SHMVECTOR_FLAG_STATS 0x2
+#define SHMVECTOR_FLAG_GROWABLE 0x4
+#define SHMVECTOR_FLAG_HUGETLB 0x8
+#define SHMVECTOR_FLAG_THP 0x10
+
+/** Huge page sizes for shmvector_attr_t page_size */
+#define SHMVECTOR_PAGE_2M ((size_t)2 << 20)
+#define SHMVECTOR_PAGE_1G ((size_t)1 << 30)
+
+/** Segment layout version; segments with another version are not attached */
+#define SHMVECTOR_FORMAT_VERSION 0x53560008
+
+/** Alignment of the shmarray_t regions and of the first element */
+#define SHMVECTOR_CACHELINE 64
+
 /* Private type for creating an array with holes in shared memory */
 typedef struct shmarray shmarray_t;
 
+/** Options applied by the process that initializes the shared memory segment */
+typedef struct shmvector_attr {
+	/* Type of the mutex protecting the segment, one of SHMMUTEX_TYPE_* */
+	uint32_t lock_type;
+
+	/* Protect the segment with a reader-writer lock so readers run concurrently */
+	bool rwlock;
+
+	/* Record segment lock contention statistics (needs SHMMUTEX_STATS) */
+	bool stats;
+
+	/* Double the capacity instead of failing when push_back or insert_quick find the vector full.
+	   Growth may move the mapping, so lists and counter sets, which hand out pointers
+	   into their segments, refuse this option with EINVAL. */
+	bool growable;
+
+	/* 0 for the default pages, or SHMVECTOR_PAGE_2M or SHMVECTOR_PAGE_1G to back the
+	   segment with a file on a hugetlbfs mount of that page size. Without such a mount,
+	   or if it has too few free pages, the segment uses transparent huge pages where
+	   the kernel allows them. Every process sharing the segment must pass the same value. */
+	size_t page_size;
+
+	/* The options below apply to the mapping of each process that passes them,
+	   whether it creates the segment or attaches to it */
+
+	/* Fault the whole segment in before returning, and again after growth */
+	bool prefault;
+
+	/* Lock the mapping in memory so its pages are never swapped out or reclaimed */
+	bool mlock;
+
+	/* Threads faulting the segment in concurrently; 0 or 1 uses the calling thread */
+	uint32_t prefault_threads;
+} shmvector_attr_t;
+
+typedef struct shmvector shmvector_t;
+
+/**
+ * Functor used to restore a container's invariants after a process died while
+ * holding the segment lock. Called with the segment lock held.
+ */
+typedef void (*shmvector_repair_fn)(shmvector_t* sv, void* arg);
+
+/** Snapshot of the mutable vector bookkeeping, see shmvector_header */
+typedef struct shmvector_header {
+	/* Number of total buffers allocated */
+	size_t capacity;
+
+	/* Index to use for the next push_back */
+	size_t next_back_idx;
+
+	/* Number of allocated buffers in use */
+	size_t active_count;
+} shmvector_header_t;
+
 /** Public type for creating a shared memory vector */
 typedef struct shmvector {
 	/* Name of the shared memory segment to store data within */
@@ -38,15 +117,42 @@ typedef struct shmvector {
 
 	/* An array of items stored in shared memory */
 	shmarray_t* shm;
+
+	/* Repair hook for containers built on this vector, or NULL */
+	shmvector_repair_fn repair;
+
+	/* Argument passed to the repair hook */
+	void* repair_arg;
+
+	/* Bytes of the segment mapped by this process */
+	size_t map_size;
+
+	/* Mapping generation of the segment when this process last mapped it */
+	uint32_t map_gen;
+
+	/* Size of the pages backing the segment; the segment is a whole number of huge pages */
+	size_t page_size;
+
+	/* Path of the segment file on hugetlbfs, or NULL if it lives in POSIX shared memory */
+	char* hugetlb_path;
+
+	/* Mapping options of this process, see shmvector_attr_t */
+	bool prefault;
+	bool mlock;
+	uint32_t prefault_threads;
 } shmvector_t;
 
-/* Private type for creating an array with holes in shared memory */
+/* Private type for creating an array with holes in shared memory.
+ * Fields are grouped by how they are accessed so that lock traffic does not
+ * invalidate the cache lines readers need: read-mostly geometry, the lock
+ * words, then the counters written by every modification. The elements
+ * start on the next cache line boundary. */
 typedef struct shmarray {
-	/* Mutual exclusion lock */
-	shmmutex_t lock;
-	
-	/* A reference count */
-	size_t ref_count;
+	/* Layout version, SHMVECTOR_FORMAT_VERSION */
+	uint32_t version;
+
+	/* Segment flags (SHMVECTOR_FLAG_*) */
+	uint32_t flags;
 
 	/* Number of total buffers allocated */
 	size_t capacity;
@@ -54,18 +160,53 @@ typedef struct shmarray {
 	/* Size of each array element */
 	size_t esize;
 
+	/* Offset from the beginning of this struct to the array of shared memory array buffers */
+	size_t eles_offset;
+
+	/* Offset from the beginning of this struct to the free slot stack, followed by
+	   the position of each free slot on the stack (capacity uint32_t each) */
+	size_t frees_offset;
+
+	/* Offset from the beginning of this struct to the occupancy bitmap, one bit per buffer in 64 bit words */
+	size_t actives_offset;
+
+	/* Incremented each time the segment grows, so other processes know to remap it */
+	uint32_t map_gen;
+
+	/* sizeof(shmarray_t) in the build that created the segment */
+	uint32_t header_size;
+
+	/* Mutual exclusion lock */
+	shmmutex_t lock __attribute__((aligned(SHMVECTOR_CACHELINE)));
+
+	/* Reader-writer lock used instead of lock when SHMVECTOR_FLAG_RWLOCK is set */
+	shmrwlock_t rwlock;
+
+	/* Sequence counter for capacity, actives_offset, map_gen, next_back_idx and active_count, odd while they change */
+	uint32_t seq __attribute__((aligned(SHMVECTOR_CACHELINE)));
+
+	/* A reference count */
+	size_t ref_count;
+
 	/* Index to use for the next push_back */
 	size_t next_back_idx;
 
 	/* Number of allocated buffers in use */
 	size_t active_count;
 
-	/* Offset from the beginning of this struct to the array of shared memory array buffers */
-	size_t eles_offset;
+	/* Number of free slots below next_back_idx, all of which are on the free slot stack */
+	size_t free_count;
 
-	/* Offset from the beginning of this struct to the array of booleans indicating whether a buffer is active */
-	size_t actives_offset;
-} shmarray_t;
+	/* Signalled when the contents change, waited on with the segment lock */
+	shmcond_t cond;
+
+	/* Number of segments a container has chained to this one, see shmvector_chain_gen */
+	uint32_t chain_gen;
+
+	/* Contention statistics for lock, recorded if SHMVECTOR_FLAG_STATS is set. Reserved
+	   even without SHMMUTEX_STATS so that every build shares one header layout. */
+	shmmutex_stats_t lock_stats;
+} __attribute__((aligned(SHMVECTOR_CACHELINE))) shmarray_t;
 
 /**
 	Create and allocate a new shared memory vector
@@ -76,6 +217,24 @@ typedef struct shmarray {
 */
 int shmvector_create(shmvector_t *sv, const char* segname, size_t elesz, size_t sz);
 
+/**
+	Create and allocate a new shared memory vector with non-default options.
+	The options only take effect in the process that initializes the segment.
+	@param sv Struct to fill in
+	@param segname Name of the shared memory segment to use
+	@param elesz Size of each vector element
+	@param sz Number of vector elements to allocate
+	@param attr Segment options, or NULL for the defaults
+*/
+int shmvector_create_attr(shmvector_t *sv, const char* segname, size_t elesz, size_t sz,
+						  const shmvector_attr_t *attr);
+
+/**
+ * Fill in the default segment options
+ * @param attr Options struct to initialize
+ */
+void shmvector_attr_init(shmvector_attr_t *attr);
+
 /**
  * Release resources associated with this shared memory vector. 
  * Once called this list is destroyed in all instances.
@@ -89,16 +248,164 @@ int shmvector_destroy(shmvector_t *sv);
 int shmvector_destroy_safe(shmvector_t *sv);
 
 /**
- * @return the number of active elements in the vector
+ * Acquire the segment lock exclusively. Vector, list and counter operations
+ * that modify the segment use this lock. If the segment uses a robust lock
+ * and its previous owner died, the vector bookkeeping and the repair hook are
+ * run before returning.
+ * @return 0 on success, non-zero on failure
+ */
+int shmvector_lock(shmvector_t *sv);
+
+/**
+ * Release the exclusive segment lock
+ * @return 0 on success, non-zero on failure
+ */
+int shmvector_unlock(shmvector_t *sv);
+
+/**
+ * Acquire the segment lock exclusively if it can be taken without waiting
+ * @return 0 on success, EBUSY if the lock is held, other non-zero on failure
+ */
+int shmvector_trylock(shmvector_t *sv);
+
+/**
+ * Acquire the segment lock exclusively, giving up at a deadline
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed, other non-zero on failure
+ */
+int shmvector_timedlock(shmvector_t *sv, const struct timespec *abstime);
+
+/**
+ * Acquire the segment lock for reading. Readers run concurrently when the
+ * segment was created with a reader-writer lock, otherwise this is
+ * equivalent to shmvector_lock.
+ * @return 0 on success, non-zero on failure
+ */
+int shmvector_lock_shared(shmvector_t *sv);
+
+/**
+ * Acquire the segment lock for reading if it can be taken without waiting
+ * @return 0 on success, EBUSY if the lock is held, other non-zero on failure
+ */
+int shmvector_trylock_shared(shmvector_t *sv);
+
+/**
+ * Acquire the segment lock for reading, giving up at a deadline
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed, other non-zero on failure
+ */
+int shmvector_timedlock_shared(shmvector_t *sv, const struct timespec *abstime);
+
+/**
+ * Release the segment lock acquired with shmvector_lock_shared
+ * @return 0 on success, non-zero on failure
+ */
+int shmvector_unlock_shared(shmvector_t *sv);
+
+/**
+ * Release the exclusive segment lock, sleep until another process calls
+ * shmvector_signal or shmvector_broadcast, and reacquire the lock. Wakeups
+ * may be spurious, so re-check the awaited condition in a loop.
+ * @param abstime deadline on CLOCK_MONOTONIC, or NULL to wait forever
+ * @return 0 on success, ETIMEDOUT if the deadline passed, ENOTSUP if the
+ *         segment uses a reader-writer lock, other non-zero on failure
+ */
+int shmvector_wait(shmvector_t *sv, const struct timespec *abstime);
+
+/**
+ * Wake one process sleeping in shmvector_wait. Cheap when nobody waits.
+ * @return 0 on success, non-zero on failure
+ */
+int shmvector_signal(shmvector_t *sv);
+
+/**
+ * Wake every process sleeping in shmvector_wait
+ * @return 0 on success, non-zero on failure
+ */
+int shmvector_broadcast(shmvector_t *sv);
+
+/**
+ * Recompute the vector bookkeeping from the occupancy bitmap. Called with the
+ * segment lock held after a process died while holding it.
+ */
+void shmvector_repair(shmvector_t *sv);
+
+/**
+ * Read the segment lock statistics without taking the lock
+ * @param out totals over all processes
+ * @return 0 on success, ENOTSUP if the segment does not record statistics or the
+ *         library was built without SHMMUTEX_STATS
+ */
+int shmvector_stats(shmvector_t *sv, shmmutex_stats_counts_t *out);
+
+/**
+ * Read the segment lock statistics of a vector, list or counter set by
+ * segment name, whether the segment lives in POSIX shared memory or on a
+ * hugetlbfs mount. The segment is mapped read-only, so a monitoring process
+ * neither takes the lock nor holds a reference.
+ * @param segname Name of the shared memory segment
+ * @param out totals over all processes
+ * @return 0 on success, ENOTSUP if the segment does not record statistics,
+ *         other non-zero values if the segment cannot be mapped or has another layout
+ */
+int shmvector_stats_by_name(const char* segname, shmmutex_stats_counts_t *out);
+
+/**
+ * Read a consistent snapshot of the vector bookkeeping without taking the
+ * segment lock. Writers publish changes under a sequence counter, so the
+ * reader only retries while a modification is in progress and never stores
+ * to the segment.
+ * @param out snapshot to fill in
+ */
+void shmvector_header(shmvector_t *sv, shmvector_header_t *out);
+
+/**
+ * @return the chain generation, read without the lock. Containers that
+ *         spread over several segments record in the first one how many
+ *         segments follow it, so other processes can attach to new ones.
+ */
+uint32_t shmvector_chain_gen(shmvector_t *sv);
+
+/**
+ * Publish a new chain generation. Call with the segment lock held, after
+ * the chained segments are ready.
+ */
+void shmvector_set_chain_gen(shmvector_t *sv, uint32_t gen);
+
+/**
+ * @return the size of the pages backing the segment: the hugetlbfs page
+ *         size, SHMVECTOR_PAGE_2M if transparent huge pages were requested
+ *         for it, otherwise the base page size
+ */
+size_t shmvector_page_size(shmvector_t *sv);
+
+/**
+ * @return the number of active elements in the vector, read without the lock
  */
 size_t shmvector_size(shmvector_t *sv);
 
+/**
+ * Iterate over the active elements: the occupancy bitmap is scanned a word
+ * at a time, so free regions cost little to skip.
+ * E.g. for (int i = shmvector_next(sv, 0); i >= 0; i = shmvector_next(sv, i + 1))
+ * @return the first active index at or after idx, or -1 if there is none
+ */
+int shmvector_next(shmvector_t *sv, size_t idx);
+
 /**
  * @return the index of the element compares equal,
  *         or -1 if the element does not exist
  */
 int shmvector_find_first_of(shmvector_t *sv, void *data, shmvector_elecmp_fn elecmp);
 
+/**
+ * Concurrent safe find_first_of() holding the segment lock for reading
+ * 
+ * @return the index of the element compares equal,
+ *         or -1 if the element does not exist
+ */
+int shmvector_find_first_of_shared(shmvector_t *sv, void *data, shmvector_elecmp_fn elecmp);
+
 /**
  * Concurrent safe push_back() function
  * 
@@ -106,6 +413,23 @@ int shmvector_find_first_of(shmvector_t *sv, void *data, shmvector_elecmp_fn ele
 */
 int shmvector_safe_push_back(shmvector_t* sv, void* ele);
 
+/**
+ * safe_push_back() that fails instead of waiting for the segment lock
+ * 
+ * @return the index to which ele is copied, -1 if the vector is full,
+ *         or -EBUSY if the lock is held
+*/
+int shmvector_safe_push_back_try(shmvector_t* sv, void* ele);
+
+/**
+ * safe_push_back() that gives up waiting for the segment lock at a deadline
+ * 
+ * @param abstime deadline on CLOCK_MONOTONIC
+ * @return the index to which ele is copied, -1 if the vector is full,
+ *         or -ETIMEDOUT if the deadline passed
+*/
+int shmvector_safe_push_back_timed(shmvector_t* sv, void* ele, const struct timespec *abstime);
+
 /**
  * @return the index to which ele is copied
  */
@@ -123,14 +447,46 @@ int shmvector_insert_at(shmvector_t* sv, size_t idx, void* ele);
 */
 void* shmvector_safe_at(shmvector_t* sv, size_t idx);
 
+/**
+ * safe_at() that fails instead of waiting for the segment lock
+ * 
+ * @return the element at idx or NULL if no such element exists or the lock
+ *         is held, in which case errno is EBUSY
+*/
+void* shmvector_safe_at_try(shmvector_t* sv, size_t idx);
+
+/**
+ * safe_at() that gives up waiting for the segment lock at a deadline
+ * 
+ * @param abstime deadline on CLOCK_MONOTONIC
+ * @return the element at idx or NULL if no such element exists or the
+ *         deadline passed, in which case errno is ETIMEDOUT
+*/
+void* shmvector_safe_at_timed(shmvector_t* sv, size_t idx, const struct timespec *abstime);
+
+/**
+ * Concurrent safe at() function holding the segment lock for reading
+ * 
+ * @return the element at idx or NULL if no such element exists
+*/
+void* shmvector_safe_at_shared(shmvector_t* sv, size_t idx);
+
 /**
  * @return the element at idx or NULL if no such element exists
 */
 void* shmvector_at(shmvector_t* sv, size_t idx);
 
 /**
- * Allocate an element at the first location found by a simple search
- * @return a pointer to the allocated element
+ * Storage of the element at idx whether or not it is active. Containers that
+ * keep their own bookkeeping in free slots use this.
+ * @return the storage for idx or NULL if idx is past the capacity
+*/
+void* shmvector_slot(shmvector_t* sv, size_t idx);
+
+/**
+ * Allocate an element, reusing the most recently deleted slot if there is
+ * one and otherwise the slot at the back. Both are O(1).
+ * @return the index of the allocated element, or -1 if the vector is full
 */
 int shmvector_insert_quick(shmvector_t* sv);
 
@@ -142,9 +498,12 @@ int shmvector_del(shmvector_t* sv, size_t idx);
 
 
 /**
- * Double the size of the shared vector
+ * Double the capacity of the shared vector. Call with the segment lock held.
+ * Elements keep their indices; other processes remap the segment on their
+ * next vector call.
+ * @return 0 on success, non-zero on failure
 */
-//int shmvector_grow_array(shmvector_t *sv);
+int shmvector_grow_array(shmvector_t *sv);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <time.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shm_barrier.h"
+#include "shm_test_util.h"
+using namespace std;
+
+static string shmdir = "/dev/shm";
+
+/* Test participants must agree on the barrier size */
+TEST(shmbarrier, create_mismatch) {
+    const char* setname = "/shmbarrier_create_mismatch";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+
+    shmcounter_uid_t id = {.group = 1, .ctype = 2, .tag = 3, .lid = 4};
+    shmbarrier_t b1, b2;
+    EXPECT_EQ(0, shmbarrier_create(&b1, &scs, id, 2));
+    EXPECT_EQ(EINVAL, shmbarrier_create(&b2, &scs, id, 3));
+    EXPECT_EQ(EINVAL, shmbarrier_create(&b2, &scs, id, 0));
+    EXPECT_EQ(EINVAL, shmbarrier_wait(&b1, NULL));
+
+    // A barrier of one never waits
+    shmcounter_uid_t solo_id = {.group = 1, .ctype = 2, .tag = 3, .lid = 5};
+    shmbarrier_t solo;
+    EXPECT_EQ(0, shmbarrier_create(&solo, &scs, solo_id, 1));
+    EXPECT_EQ(SHMBARRIER_SERIAL, shmbarrier_arrive_and_wait(&solo));
+    EXPECT_EQ(SHMBARRIER_SERIAL, shmbarrier_arrive_and_wait(&solo));
+
+    // A sharded counter has no single count to arrive at
+    shmcounter_uid_t sharded_id = {.group = 1, .ctype = 2, .tag = 3, .lid = 6};
+    shmcounter_t sharded;
+    ASSERT_EQ(0, shmcounter_create_sharded(&sharded, &scs, sharded_id));
+    EXPECT_EQ(EINVAL, shmbarrier_create(&b2, &scs, sharded_id, 2));
+    shmcounter_destroy(&sharded);
+
+    shmbarrier_destroy(&solo);
+    shmbarrier_destroy(&b1);
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test split-phase arrival and a deadline while a participant is missing */
+TEST(shmbarrier, split_phase_timeout) {
+    const char* setname = "/shmbarrier_split_phase";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+    shmcounter_uid_t id = {.group = 7, .ctype = 0, .tag = 0, .lid = 0};
+    shmbarrier_t sb;
+    ASSERT_EQ(0, shmbarrier_create(&sb, &scs, id, 2));
+
+    EXPECT_EQ(0, shmbarrier_arrive(&sb));
+    struct timespec ts = deadline_in_ms(10);
+    EXPECT_EQ(ETIMEDOUT, shmbarrier_wait(&sb, &ts));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmcounter_set_t cscs;
+        shmbarrier_t csb;
+        shmcounter_set_create(&cscs, setname);
+        shmbarrier_create(&csb, &cscs, id, 2);
+        int rc = shmbarrier_arrive_and_wait(&csb);
+        shmbarrier_destroy(&csb);
+        shmcounter_set_destroy(&cscs);
+        _exit(rc);
+    }
+    // Waiting resumes after the deadline and completes once the child arrives
+    EXPECT_EQ(0, shmbarrier_wait(&sb, NULL));
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(SHMBARRIER_SERIAL, WEXITSTATUS(status));
+
+    shmbarrier_destroy(&sb);
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test no process passes a phase before every process reached it */
+TEST(shmbarrier, phases_processes) {
+    const char* setname = "/shmbarrier_phases";
+    unlink(string(shmdir + string(setname)).c_str());
+    const int nprocs = 4, phases = 200;
+    int* arrived = (int*)mmap(0, phases * sizeof(int), PROT_READ|PROT_WRITE,
+                              MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, (void*)arrived);
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+    shmcounter_uid_t id = {.group = 9, .ctype = 9, .tag = 9, .lid = 9};
+
+    for (int p = 0; p < nprocs; p++) {
+        if (0 == fork()) {
+            shmcounter_set_t cscs;
+            shmbarrier_t sb;
+            shmcounter_set_create(&cscs, setname);
+            shmbarrier_create(&sb, &cscs, id, nprocs);
+            int early = 0, serial = 0;
+            for (int i = 0; i < phases; i++) {
+                __atomic_fetch_add(&arrived[i], 1, __ATOMIC_SEQ_CST);
+                if (SHMBARRIER_SERIAL == shmbarrier_arrive_and_wait(&sb))
+                    serial++;
+                if (nprocs != __atomic_load_n(&arrived[i], __ATOMIC_SEQ_CST))
+                    early++;
+            }
+            shmbarrier_destroy(&sb);
+            shmcounter_set_destroy(&cscs);
+            _exit(early ? 255 : serial);
+        }
+    }
+    int serial = 0;
+    for (int p = 0; p < nprocs; p++) {
+        int status;
+        wait(&status);
+        ASSERT_TRUE(WIFEXITED(status));
+        EXPECT_NE(255, WEXITSTATUS(status));
+        serial += WEXITSTATUS(status);
+    }
+    // Exactly one process completes each phase
+    EXPECT_EQ(phases, serial);
+
+    shmcounter_set_destroy(&scs);
+    munmap(arrived, phases * sizeof(int));
+}
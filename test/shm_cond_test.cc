@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shm_cond.h"
+#include "shm_test_util.h"
+using namespace std;
+
+struct cond_shared {
+    shmmutex_t lock;
+    shmcond_t cond;
+    int go;
+    int woken;
+};
+
+static struct cond_shared* cond_shared_create(uint32_t type) {
+    struct cond_shared* sh = (struct cond_shared*)mmap(0, sizeof(struct cond_shared),
+        PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    shmmutex_create_type(&sh->lock, type);
+    shmcond_create(&sh->cond);
+    return sh;
+}
+
+/* Wait for go under the lock, then count the wakeup */
+static void cond_waiter(struct cond_shared* sh) {
+    shmmutex_lock(&sh->lock);
+    while (!sh->go)
+        shmcond_wait(&sh->cond, &sh->lock);
+    sh->woken++;
+    shmmutex_unlock(&sh->lock);
+}
+
+/* Test a timed wait returns with the mutex held again */
+TEST(shmcond, timedwait_timeout) {
+    struct cond_shared* sh = cond_shared_create(SHMMUTEX_TYPE_FUTEX);
+    EXPECT_EQ(0, shmmutex_lock(&sh->lock));
+    struct timespec ts = deadline_in_ms(20);
+    EXPECT_EQ(ETIMEDOUT, shmcond_timedwait(&sh->cond, &sh->lock, &ts));
+    EXPECT_EQ(EBUSY, shmmutex_trylock(&sh->lock));
+    EXPECT_EQ(0u, sh->cond.waiters);
+    EXPECT_EQ(0, shmmutex_unlock(&sh->lock));
+
+    // Signalling without waiters does not advance the sequence
+    EXPECT_EQ(0, shmcond_signal(&sh->cond));
+    EXPECT_EQ(0, shmcond_broadcast(&sh->cond, &sh->lock));
+    EXPECT_EQ(0u, sh->cond.seq);
+    munmap(sh, sizeof(struct cond_shared));
+}
+
+/* Test signal wakes a single waiting process */
+TEST(shmcond, signal_one) {
+    struct cond_shared* sh = cond_shared_create(SHMMUTEX_TYPE_FUTEX);
+    pid_t pid = fork();
+    if (0 == pid) {
+        cond_waiter(sh);
+        _exit(0);
+    }
+    while (0 == __atomic_load_n(&sh->cond.waiters, __ATOMIC_SEQ_CST))
+        usleep(1000);
+
+    shmmutex_lock(&sh->lock);
+    sh->go = 1;
+    EXPECT_EQ(0, shmcond_signal(&sh->cond));
+    shmmutex_unlock(&sh->lock);
+
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_EQ(1, sh->woken);
+    munmap(sh, sizeof(struct cond_shared));
+}
+
+/* Test broadcast wakes every waiter, requeueing onto FUTEX and ADAPTIVE mutexes */
+TEST(shmcond, broadcast_all_types) {
+    const uint32_t types[] = {SHMMUTEX_TYPE_FUTEX, SHMMUTEX_TYPE_SPIN, SHMMUTEX_TYPE_ADAPTIVE,
+                              SHMMUTEX_TYPE_TICKET, SHMMUTEX_TYPE_ROBUST, SHMMUTEX_TYPE_PI};
+    const int nwaiters = 4;
+    for (uint32_t type : types) {
+        struct cond_shared* sh = cond_shared_create(type);
+        for (int i = 0; i < nwaiters; i++) {
+            if (0 == fork()) {
+                cond_waiter(sh);
+                _exit(0);
+            }
+        }
+        while (nwaiters != __atomic_load_n(&sh->cond.waiters, __ATOMIC_SEQ_CST))
+            usleep(1000);
+
+        shmmutex_lock(&sh->lock);
+        sh->go = 1;
+        EXPECT_EQ(0, shmcond_broadcast(&sh->cond, &sh->lock));
+        shmmutex_unlock(&sh->lock);
+
+        for (int i = 0; i < nwaiters; i++) {
+            int status;
+            wait(&status);
+            EXPECT_EQ(0, WEXITSTATUS(status));
+        }
+        EXPECT_EQ(nwaiters, sh->woken) << "type " << type;
+        EXPECT_EQ(0u, sh->cond.waiters);
+        EXPECT_EQ(0, shmmutex_trylock(&sh->lock));
+        shmmutex_unlock(&sh->lock);
+        munmap(sh, sizeof(struct cond_shared));
+    }
+}
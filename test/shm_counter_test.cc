@@ -1,9 +1,14 @@
 
 #include <gtest/gtest.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/wait.h>
 #include <string>
+#include <vector>
 #include "shm_counter.h"
+#include "shm_test_util.h"
 using namespace std;
 
 static string shmdir = "/dev/shm";
@@ -31,6 +36,32 @@ TEST(shmcounter, set_create_simple) {
     shmcounter_set_destroy(&sc2);
 }
 
+/* Test a counter set protected by a spin lock */
+TEST(shmcounter, set_create_attr_spin) {
+    const char* setname = "/shmcounter_set_create_attr_spin";
+    unlink(string(shmdir + string(setname)).c_str());
+
+    shmvector_attr_t attr;
+    shmvector_attr_init(&attr);
+    attr.lock_type = SHMMUTEX_TYPE_SPIN;
+    shmcounter_set_t scs;
+    EXPECT_EQ(0, shmcounter_set_create_attr(&scs, setname, &attr));
+    EXPECT_EQ(SHMMUTEX_TYPE_SPIN, scs.v->shm->lock.type);
+
+    shmcounter_uid_t id1 = {.group = 1, .ctype = 2, .tag = 3, .lid = 4};
+    shmcounter_t sc1;
+    EXPECT_EQ(0, shmcounter_create(&sc1, &scs, id1));
+    shmcounter_inc_safe(&sc1, 3);
+    EXPECT_EQ(3, shmcounter_value(&sc1));
+
+    shmcounter_destroy(&sc1);
+    shmcounter_set_destroy(&scs);
+
+    // Counter handles point into the segment, which growth could move
+    attr.growable = true;
+    EXPECT_EQ(EINVAL, shmcounter_set_create_attr(&scs, setname, &attr));
+}
+
 /* Test basic set destruction */
 TEST(shmcounter, set_destroy_basic) {
 
@@ -135,6 +166,57 @@ TEST(shmcounter, destroy_reuse) {
     shmcounter_set_destroy(&scs);
 }
 
+/* Test that counters stay reachable past the tombstones of deleted ones */
+TEST(shmcounter, hash_index_tombstones) {
+    shmcounter_set_t scs;
+    const char* setname = "/shmcounter_hash_index_tombstones";
+    unlink(string(shmdir + string(setname)).c_str());
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+
+    // Fill the set completely, so every probe sequence collides
+    vector<shmcounter_t> scv(SHMCOUNTER_SET_SIZE);
+    for (size_t i = 0; i < SHMCOUNTER_SET_SIZE; i++) {
+        shmcounter_uid_t id = {.group = 3, .ctype = 1, .tag = i % 7, .lid = i};
+        ASSERT_EQ(0, shmcounter_create(&scv[i], &scs, id));
+        shmcounter_inc_safe(&scv[i], (int)i);
+    }
+    EXPECT_EQ(SHMCOUNTER_SET_SIZE, scs.v->shm->active_count);
+
+    // A new id goes to a chained segment
+    shmcounter_t extra;
+    shmcounter_uid_t extra_id = {.group = 4, .ctype = 1, .tag = 0, .lid = 0};
+    ASSERT_EQ(0, shmcounter_create(&extra, &scs, extra_id));
+    EXPECT_NE(scs.v, extra.v);
+    shmcounter_destroy(&extra);
+
+    // Delete every other counter; the rest must be found by a second reference
+    for (size_t i = 0; i < SHMCOUNTER_SET_SIZE; i += 2)
+        EXPECT_EQ(0, shmcounter_destroy(&scv[i]));
+    EXPECT_EQ(SHMCOUNTER_SET_SIZE / 2, scs.v->shm->active_count);
+    for (size_t i = 1; i < SHMCOUNTER_SET_SIZE; i += 2) {
+        shmcounter_t ref;
+        shmcounter_uid_t id = {.group = 3, .ctype = 1, .tag = i % 7, .lid = i};
+        ASSERT_EQ(0, shmcounter_create(&ref, &scs, id));
+        EXPECT_EQ(scv[i].idx, ref.idx);
+        EXPECT_EQ((int)i, shmcounter_value(&ref));
+        shmcounter_destroy(&ref);
+    }
+    EXPECT_EQ(SHMCOUNTER_SET_SIZE / 2, scs.v->shm->active_count);
+
+    // Deleted ids come back as new counters in the freed slots
+    for (size_t i = 0; i < SHMCOUNTER_SET_SIZE; i += 2) {
+        shmcounter_uid_t id = {.group = 3, .ctype = 1, .tag = i % 7, .lid = i};
+        ASSERT_EQ(0, shmcounter_create(&scv[i], &scs, id));
+        EXPECT_EQ(0, shmcounter_value(&scv[i]));
+    }
+    EXPECT_EQ(SHMCOUNTER_SET_SIZE, scs.v->shm->active_count);
+
+    for (size_t i = 0; i < SHMCOUNTER_SET_SIZE; i++)
+        shmcounter_destroy(&scv[i]);
+    EXPECT_EQ(0, scs.v->shm->active_count);
+    shmcounter_set_destroy(&scs);
+}
+
 /* Test increment */
 TEST(shmcounter, inc_basic) {
 
@@ -334,4 +416,492 @@ TEST(shmcounter, set_if_zero_safe_basic) {
     shmcounter_set_destroy(&scs);
 }
 
+/* Test counters in a set protected by a reader-writer lock */
+TEST(shmcounter, rwlock_set_basic) {
+    const char* setname = "/shmcounter_rwlock_set_basic";
+    unlink(string(shmdir + string(setname)).c_str());
+
+    shmvector_attr_t attr;
+    shmvector_attr_init(&attr);
+    attr.rwlock = true;
+    shmcounter_set_t scs;
+    EXPECT_EQ(0, shmcounter_set_create_attr(&scs, setname, &attr));
+
+    shmcounter_uid_t id1 = {.group = 1, .ctype = 1, .tag = 1, .lid = 1};
+    shmcounter_uid_t id2 = {.group = 1, .ctype = 1, .tag = 1, .lid = 2};
+    shmcounter_t sc1, sc1_copy, sc2;
+    EXPECT_EQ(0, shmcounter_create(&sc1, &scs, id1));
+    EXPECT_EQ(0, shmcounter_create(&sc1_copy, &scs, id1));
+    EXPECT_EQ(0, shmcounter_create(&sc2, &scs, id2));
+    EXPECT_EQ(sc1.idx, sc1_copy.idx);
+    EXPECT_EQ(2, scs.v->shm->active_count);
+
+    shmcounter_inc_safe(&sc1, 5);
+    shmcounter_dec_safe(&sc1_copy, 2);
+    shmcounter_inc_safe(&sc2, 3);
+    EXPECT_EQ(3, shmcounter_value(&sc1));
+    EXPECT_EQ(true, shmcounter_isequal_safe(&sc1, &sc2));
+    EXPECT_EQ(true, shmcounter_isequal_safe(&sc2, &sc1));
+    EXPECT_EQ(0u, scs.v->shm->rwlock.state);
+
+    // The counter survives until its last reference is dropped
+    shmcounter_destroy(&sc1);
+    EXPECT_EQ(2, scs.v->shm->active_count);
+    shmcounter_destroy(&sc1_copy);
+    EXPECT_EQ(1, scs.v->shm->active_count);
+    shmcounter_destroy(&sc2);
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test sleeping until a counter reaches a value or zero */
+TEST(shmcounter, wait_value_zero) {
+    const char* setname = "/shmcounter_wait_value_zero";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+    shmcounter_uid_t id = {.group = 1, .ctype = 2, .tag = 3, .lid = 4};
+    shmcounter_t sc;
+    ASSERT_EQ(0, shmcounter_create(&sc, &scs, id));
+
+    struct timespec ts = deadline_in_ms(10);
+    EXPECT_EQ(0, shmcounter_wait_zero(&sc, &ts));
+    EXPECT_EQ(ETIMEDOUT, shmcounter_wait_value(&sc, 3, &ts));
+    shmcounter_hot_t* h = sc.hot;
+    EXPECT_EQ(0u, h->waiters);
+
+    // A child counts up to 3 and, once we saw 3, back to 0 while we sleep
+    shmcounter_uid_t ackid = {.group = 1, .ctype = 2, .tag = 3, .lid = 5};
+    shmcounter_t ack;
+    ASSERT_EQ(0, shmcounter_create(&ack, &scs, ackid));
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmcounter_set_t cscs;
+        shmcounter_t csc, cack;
+        shmcounter_set_create(&cscs, setname);
+        shmcounter_create(&csc, &cscs, id);
+        shmcounter_create(&cack, &cscs, ackid);
+        while (0 == __atomic_load_n(&h->waiters, __ATOMIC_SEQ_CST))
+            usleep(1000);
+        for (int i = 0; i < 3; i++)
+            shmcounter_inc_safe(&csc, 1);
+        int rc = shmcounter_wait_value(&cack, 1, NULL);
+        shmcounter_dec_safe(&csc, 3);
+        shmcounter_destroy(&cack);
+        shmcounter_destroy(&csc);
+        shmcounter_set_destroy(&cscs);
+        _exit(rc);
+    }
+    ts = deadline_in_ms(10000);
+    EXPECT_EQ(0, shmcounter_wait_value(&sc, 3, &ts));
+    shmcounter_inc_safe(&ack, 1);
+    EXPECT_EQ(0, shmcounter_wait_zero(&sc, &ts));
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    shmcounter_destroy(&ack);
+    EXPECT_EQ(0, shmcounter_value(&sc));
+
+    shmcounter_destroy(&sc);
+    shmcounter_set_destroy(&scs);
+}
 
+/* Test concurrent atomic updates from several processes are not lost */
+TEST(shmcounter, atomic_updates_processes) {
+    const char* setname = "/shmcounter_atomic_updates";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+    shmcounter_uid_t id = {.group = 2, .ctype = 2, .tag = 2, .lid = 2};
+    shmcounter_t sc;
+    ASSERT_EQ(0, shmcounter_create(&sc, &scs, id));
+
+    const int nprocs = 4, iters = 20000;
+    for (int p = 0; p < nprocs; p++) {
+        if (0 == fork()) {
+            shmcounter_set_t cscs;
+            shmcounter_t csc;
+            shmcounter_set_create(&cscs, setname);
+            shmcounter_create(&csc, &cscs, id);
+            for (int i = 0; i < iters; i++) {
+                shmcounter_inc_safe(&csc, 3);
+                shmcounter_dec_safe(&csc, 1);
+            }
+            shmcounter_destroy(&csc);
+            shmcounter_set_destroy(&cscs);
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < nprocs; p++) {
+        int status;
+        wait(&status);
+        EXPECT_EQ(0, WEXITSTATUS(status));
+    }
+    EXPECT_EQ(nprocs * iters * 2, shmcounter_value(&sc));
+    // Every process released its reference
+    shmcounter_data_t* d = (shmcounter_data_t*)shmvector_at(scs.v, sc.idx);
+    EXPECT_EQ(1u, d->refcount);
+    EXPECT_NE(0u, d->packed_hot);
+
+    shmcounter_destroy(&sc);
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test sharded counters summing the updates of several processes */
+TEST(shmcounter, sharded_processes) {
+    const char* setname = "/shmcounter_sharded_processes";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+    shmcounter_uid_t id = {.group = 5, .ctype = 1, .tag = 0, .lid = 1};
+    shmcounter_t sc;
+    ASSERT_EQ(0, shmcounter_create_sharded(&sc, &scs, id));
+    ASSERT_NE(nullptr, sc.shards);
+    EXPECT_EQ(1, scs.shards->shm->active_count);
+
+    // Operations that need one count word are refused
+    EXPECT_FALSE(shmcounter_set_if_zero_safe(&sc, 1));
+    EXPECT_EQ(ENOTSUP, shmcounter_wait_zero(&sc, NULL));
+
+    const int nprocs = 4, iters = 20000;
+    for (int p = 0; p < nprocs; p++) {
+        if (0 == fork()) {
+            // A plain create attaches to the sharded counter
+            shmcounter_set_t cscs;
+            shmcounter_t csc;
+            shmcounter_set_create(&cscs, setname);
+            shmcounter_create(&csc, &cscs, id);
+            int rc = (NULL == csc.shards) ? 1 : 0;
+            for (int i = 0; i < iters; i++) {
+                shmcounter_inc_safe(&csc, 3);
+                shmcounter_dec_safe(&csc, 1);
+            }
+            shmcounter_destroy(&csc);
+            shmcounter_set_destroy(&cscs);
+            _exit(rc);
+        }
+    }
+    for (int p = 0; p < nprocs; p++) {
+        int status;
+        wait(&status);
+        EXPECT_EQ(0, WEXITSTATUS(status));
+    }
+    EXPECT_EQ(nprocs * iters * 2, shmcounter_value(&sc));
+    EXPECT_TRUE(shmcounter_isvalue(&sc, nprocs * iters * 2));
+
+    // Comparisons against plain counters use the sum
+    shmcounter_uid_t pid = {.group = 5, .ctype = 1, .tag = 0, .lid = 2};
+    shmcounter_t plain;
+    ASSERT_EQ(0, shmcounter_create(&plain, &scs, pid));
+    EXPECT_EQ(nullptr, plain.shards);
+    shmcounter_inc_safe(&plain, nprocs * iters * 2);
+    EXPECT_TRUE(shmcounter_isequal_safe(&sc, &plain));
+    shmcounter_destroy(&plain);
+
+    // The last reference frees the shard block, and a new counter starts at 0
+    shmcounter_destroy(&sc);
+    EXPECT_EQ(0, scs.shards->shm->active_count);
+    ASSERT_EQ(0, shmcounter_create_sharded(&sc, &scs, id));
+    EXPECT_EQ(0, shmcounter_value(&sc));
+    shmcounter_destroy(&sc);
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test creating, updating and destroying counters in batches */
+TEST(shmcounter, batch_ops) {
+    const char* setname = "/shmcounter_batch_ops";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+
+    const size_t n = 32;
+    vector<shmcounter_uid_t> ids(n);
+    vector<int> deltas(n);
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = {.group = 6, .ctype = 1, .tag = 0, .lid = i};
+        deltas[i] = (int)i;
+    }
+    vector<shmcounter_t> a(n), b(n);
+    ASSERT_EQ(0, shmcounter_create_n(a.data(), &scs, ids.data(), n));
+    EXPECT_EQ(n, scs.v->shm->active_count);
+    shmcounter_add_n(a.data(), deltas.data(), n);
+
+    // A second batch attaches to the same counters
+    ASSERT_EQ(0, shmcounter_create_n(b.data(), &scs, ids.data(), n));
+    EXPECT_EQ(n, scs.v->shm->active_count);
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(a[i].idx, b[i].idx);
+        EXPECT_EQ((int)i, shmcounter_value(&b[i]));
+    }
+    shmcounter_add_n(b.data(), deltas.data(), n);
+    for (size_t i = 0; i < n; i++)
+        EXPECT_EQ(2 * (int)i, shmcounter_value(&a[i]));
+
+    // Counters of different sets cannot be destroyed together
+    const char* othername = "/shmcounter_batch_ops_other";
+    unlink(string(shmdir + string(othername)).c_str());
+    shmcounter_set_t other;
+    ASSERT_EQ(0, shmcounter_set_create(&other, othername));
+    shmcounter_t mixed[2] = {a[0]};
+    ASSERT_EQ(0, shmcounter_create(&mixed[1], &other, ids[0]));
+    EXPECT_EQ(EINVAL, shmcounter_destroy_n(mixed, 2));
+    shmcounter_destroy(&mixed[1]);
+    shmcounter_set_destroy(&other);
+
+    EXPECT_EQ(0, shmcounter_destroy_n(b.data(), n));
+    EXPECT_EQ(n, scs.v->shm->active_count);
+    EXPECT_EQ(0, shmcounter_destroy_n(a.data(), n));
+    EXPECT_EQ(0u, scs.v->shm->active_count);
+
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test a set growing into chained segments while another process uses it */
+TEST(shmcounter, set_growth_processes) {
+    const char* setname = "/shmcounter_set_growth";
+    unlink(string(shmdir + string(setname)).c_str());
+    unlink(string(shmdir + string(setname) + ".1").c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+    shmcounter_uid_t go_id = {.group = 8, .ctype = 0, .tag = 0, .lid = 0};
+    shmcounter_uid_t late_id = {.group = 8, .ctype = 1, .tag = 0, .lid = 0};
+    shmcounter_t go;
+    ASSERT_EQ(0, shmcounter_create(&go, &scs, go_id));
+
+    // The child attaches before the set grows
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmcounter_set_t cscs;
+        shmcounter_t cgo, clate;
+        shmcounter_set_create(&cscs, setname);
+        shmcounter_create(&cgo, &cscs, go_id);
+        shmcounter_wait_value(&cgo, 1, NULL);
+        int rc = 0;
+        if (0 != shmcounter_create(&clate, &cscs, late_id))
+            _exit(1);
+        if (2 != cscs.nsegs || clate.v == cscs.v || 42 != shmcounter_value(&clate))
+            rc = 2;
+        shmcounter_destroy(&clate);
+        shmcounter_destroy(&cgo);
+        shmcounter_set_destroy(&cscs);
+        _exit(rc);
+    }
+
+    // Fill the first segment, so the next counter chains a segment
+    const size_t fill = SHMCOUNTER_SET_SIZE - 1;
+    vector<shmcounter_uid_t> ids(fill);
+    for (size_t i = 0; i < fill; i++)
+        ids[i] = {.group = 9, .ctype = 1, .tag = 0, .lid = i};
+    vector<shmcounter_t> f(fill);
+    ASSERT_EQ(0, shmcounter_create_n(f.data(), &scs, ids.data(), fill));
+    EXPECT_EQ(0u, shmvector_chain_gen(scs.v));
+    shmcounter_t late;
+    ASSERT_EQ(0, shmcounter_create(&late, &scs, late_id));
+    EXPECT_EQ(1u, shmvector_chain_gen(scs.v));
+    EXPECT_NE(scs.v, late.v);
+    shmcounter_inc_safe(&late, 42);
+    shmcounter_inc_safe(&go, 1);
+
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(0, WEXITSTATUS(status));
+
+    // Counters in the first segment are unaffected
+    shmcounter_inc_safe(&f[0], 5);
+    EXPECT_EQ(5, shmcounter_value(&f[0]));
+    EXPECT_EQ(42, shmcounter_value(&late));
+
+    shmcounter_destroy(&late);
+    EXPECT_EQ(0, shmcounter_destroy_n(f.data(), fill));
+    shmcounter_destroy(&go);
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test counters whose count has a cache line of its own */
+TEST(shmcounter, padded_layout) {
+    const char* setname = "/shmcounter_padded_layout";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create_layout(&scs, setname, NULL, SHMCOUNTER_LAYOUT_PADDED));
+    shmcounter_uid_t id1 = {.group = 10, .ctype = 1, .tag = 0, .lid = 1};
+    shmcounter_uid_t id2 = {.group = 10, .ctype = 1, .tag = 0, .lid = 2};
+    shmcounter_t sc1, sc2;
+    ASSERT_EQ(0, shmcounter_create(&sc1, &scs, id1));
+    ASSERT_EQ(0, shmcounter_create(&sc2, &scs, id2));
+    EXPECT_EQ(2, scs.hot->shm->active_count);
+
+    // Each count is on its own line, outside the slots
+    uintptr_t l1 = (uintptr_t)sc1.hot / SHMVECTOR_CACHELINE;
+    uintptr_t l2 = (uintptr_t)sc2.hot / SHMVECTOR_CACHELINE;
+    EXPECT_NE(l1, l2);
+    shmcounter_data_t* d1 = (shmcounter_data_t*)shmvector_at(sc1.v, sc1.idx);
+    EXPECT_NE(0u, d1->hot_line);
+    EXPECT_EQ(0u, d1->packed_hot);
+
+    // A handle with the packed layout finds the same count
+    shmcounter_set_t packed;
+    ASSERT_EQ(0, shmcounter_set_create(&packed, setname));
+    shmcounter_t p1;
+    ASSERT_EQ(0, shmcounter_create(&p1, &packed, id1));
+    EXPECT_EQ((char*)sc1.hot - (char*)scs.hot->shm, (char*)p1.hot - (char*)packed.hot->shm);
+    shmcounter_inc_safe(&p1, 7);
+    EXPECT_EQ(7, shmcounter_value(&sc1));
+    EXPECT_TRUE(shmcounter_set_if_zero_safe(&sc2, 3));
+    EXPECT_EQ(0, shmcounter_wait_value(&sc2, 3, NULL));
+    shmcounter_destroy(&p1);
+    shmcounter_set_destroy(&packed);
+
+    // The last reference frees the hot line
+    shmcounter_destroy(&sc1);
+    shmcounter_destroy(&sc2);
+    EXPECT_EQ(0, scs.hot->shm->active_count);
+    shmcounter_set_destroy(&scs);
+}
+
+/* Test that the shard and hot line segments appear with the first counter needing them */
+TEST(shmcounter, lazy_segments) {
+    const char* setname = "/shmcounter_lazy_segments";
+    string shards = shmdir + string(setname) + ".shards";
+    string hot = shmdir + string(setname) + ".hot";
+    unlink(string(shmdir + string(setname)).c_str());
+    unlink(shards.c_str());
+    unlink(hot.c_str());
+
+    shmvector_attr_t attr;
+    shmvector_attr_init(&attr);
+    attr.lock_type = SHMMUTEX_TYPE_SPIN;
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create_attr(&scs, setname, &attr));
+    shmcounter_uid_t id1 = {.group = 11, .ctype = 1, .tag = 0, .lid = 1};
+    shmcounter_uid_t id2 = {.group = 11, .ctype = 1, .tag = 0, .lid = 2};
+    shmcounter_uid_t id3 = {.group = 11, .ctype = 1, .tag = 0, .lid = 3};
+    shmcounter_t plain, sharded, padded;
+    ASSERT_EQ(0, shmcounter_create(&plain, &scs, id1));
+    ASSERT_NE(nullptr, scs.counts);
+    EXPECT_EQ(SHMMUTEX_TYPE_SPIN, scs.counts->shm->lock.type);
+    EXPECT_EQ(nullptr, scs.shards);
+    EXPECT_EQ(nullptr, scs.hot);
+    EXPECT_NE(0, access(shards.c_str(), F_OK));
+    EXPECT_NE(0, access(hot.c_str(), F_OK));
+
+    // Each segment is created with the set's options
+    ASSERT_EQ(0, shmcounter_create_sharded(&sharded, &scs, id2));
+    ASSERT_NE(nullptr, scs.shards);
+    EXPECT_EQ(SHMMUTEX_TYPE_SPIN, scs.shards->shm->lock.type);
+    EXPECT_NE(0, access(hot.c_str(), F_OK));
+
+    shmcounter_set_t pscs;
+    ASSERT_EQ(0, shmcounter_set_create_layout(&pscs, setname, &attr, SHMCOUNTER_LAYOUT_PADDED));
+    ASSERT_EQ(0, shmcounter_create(&padded, &pscs, id3));
+    ASSERT_NE(nullptr, pscs.hot);
+    EXPECT_EQ(SHMMUTEX_TYPE_SPIN, pscs.hot->shm->lock.type);
+
+    // Another process attaches to the segments of the counters it creates
+    if (0 == fork()) {
+        shmcounter_set_t cscs;
+        shmcounter_t c;
+        int rc = shmcounter_set_create_attr(&cscs, setname, &attr);
+        rc |= (NULL != cscs.hot) ? 2 : 0;
+        rc |= shmcounter_create(&c, &cscs, id3);
+        rc |= (NULL == cscs.hot || NULL != cscs.shards) ? 4 : 0;
+        shmcounter_inc_safe(&c, 5);
+        shmcounter_destroy(&c);
+        shmcounter_set_destroy(&cscs);
+        _exit(rc);
+    }
+    int status;
+    wait(&status);
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_EQ(5, shmcounter_value(&padded));
+
+    shmcounter_destroy(&padded);
+    shmcounter_set_destroy(&pscs);
+    shmcounter_destroy(&sharded);
+    shmcounter_destroy(&plain);
+    shmcounter_set_destroy(&scs);
+    EXPECT_NE(0, access(shards.c_str(), F_OK));
+    EXPECT_NE(0, access(hot.c_str(), F_OK));
+}
+
+/* Test the read-modify-write operations and 64 bit values */
+TEST(shmcounter, rmw_ops) {
+    const char* setname = "/shmcounter_rmw_ops";
+    unlink(string(shmdir + string(setname)).c_str());
+    shmcounter_set_t scs;
+    ASSERT_EQ(0, shmcounter_set_create(&scs, setname));
+    shmcounter_uid_t id = {.group = 11, .ctype = 1, .tag = 0, .lid = 0};
+    shmcounter_t sc;
+    ASSERT_EQ(0, shmcounter_create(&sc, &scs, id));
+
+    int64_t prev;
+    const int64_t big = 1LL << 40;
+    EXPECT_EQ(0, shmcounter_fetch_add(&sc, big, &prev));
+    EXPECT_EQ(0, prev);
+    EXPECT_EQ(big, shmcounter_value64(&sc));
+    EXPECT_EQ(0, shmcounter_cas(&sc, 5, 7, &prev));
+    EXPECT_EQ(big, prev);
+    EXPECT_EQ(big, shmcounter_value64(&sc));
+    EXPECT_EQ(0, shmcounter_cas(&sc, big, 7, &prev));
+    EXPECT_EQ(big, prev);
+    EXPECT_EQ(7, shmcounter_value64(&sc));
+    EXPECT_EQ(0, shmcounter_exchange(&sc, -3, &prev));
+    EXPECT_EQ(7, prev);
+    EXPECT_EQ(0, shmcounter_fetch_max(&sc, -5, &prev));
+    EXPECT_EQ(-3, prev);
+    EXPECT_EQ(-3, shmcounter_value64(&sc));
+    EXPECT_EQ(0, shmcounter_fetch_max(&sc, 10, &prev));
+    EXPECT_EQ(-3, prev);
+    EXPECT_EQ(0, shmcounter_fetch_min(&sc, 20, &prev));
+    EXPECT_EQ(10, prev);
+    EXPECT_EQ(0, shmcounter_fetch_min(&sc, 2, &prev));
+    EXPECT_EQ(10, prev);
+    EXPECT_EQ(2, shmcounter_value(&sc));
+
+    // Sharded counters have no single value to swap
+    shmcounter_uid_t sid = {.group = 11, .ctype = 1, .tag = 0, .lid = 1};
+    shmcounter_t sharded;
+    ASSERT_EQ(0, shmcounter_create_sharded(&sharded, &scs, sid));
+    EXPECT_EQ(ENOTSUP, shmcounter_fetch_add(&sharded, 1, &prev));
+    EXPECT_EQ(ENOTSUP, shmcounter_cas(&sharded, 0, 1, &prev));
+    EXPECT_EQ(ENOTSUP, shmcounter_exchange(&sharded, 1, &prev));
+    EXPECT_EQ(ENOTSUP, shmcounter_fetch_max(&sharded, 1, &prev));
+    EXPECT_EQ(ENOTSUP, shmcounter_fetch_min(&sharded, 1, &prev));
+    shmcounter_destroy(&sharded);
+
+    // Processes draw distinct tickets and publish the largest one they drew
+    shmcounter_uid_t tid = {.group = 11, .ctype = 1, .tag = 0, .lid = 2};
+    shmcounter_uid_t mid = {.group = 11, .ctype = 1, .tag = 0, .lid = 3};
+    shmcounter_t ticket, maxc;
+    ASSERT_EQ(0, shmcounter_create(&ticket, &scs, tid));
+    ASSERT_EQ(0, shmcounter_create(&maxc, &scs, mid));
+    const int nprocs = 4, iters = 5000;
+    for (int p = 0; p < nprocs; p++) {
+        if (0 == fork()) {
+            shmcounter_set_t cscs;
+            shmcounter_t ct, cm;
+            shmcounter_set_create(&cscs, setname);
+            shmcounter_create(&ct, &cscs, tid);
+            shmcounter_create(&cm, &cscs, mid);
+            int64_t t, m;
+            for (int i = 0; i < iters; i++) {
+                shmcounter_fetch_add(&ct, 1, &t);
+                shmcounter_fetch_max(&cm, t, &m);
+            }
+            shmcounter_destroy(&cm);
+            shmcounter_destroy(&ct);
+            shmcounter_set_destroy(&cscs);
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < nprocs; p++) {
+        int status;
+        wait(&status);
+        EXPECT_EQ(0, WEXITSTATUS(status));
+    }
+    EXPECT_EQ(nprocs * iters, shmcounter_value64(&ticket));
+    EXPECT_EQ(nprocs * iters - 1, shmcounter_value64(&maxc));
+
+    shmcounter_destroy(&maxc);
+    shmcounter_destroy(&ticket);
+    shmcounter_destroy(&sc);
+    shmcounter_set_destroy(&scs);
+}
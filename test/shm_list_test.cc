@@ -1,7 +1,12 @@
 
 #include <gtest/gtest.h>
 #include <string>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "shm_list.h"
+#include "shm_test_util.h"
 using namespace std;
 
 static string shmdir = "/dev/shm";
@@ -408,3 +413,179 @@ TEST(shmlist, shmlist_insert_after_safe) {
 
 TEST(shmlist, basic_shmlist_insert_before_safe) {
 }
+
+TEST(shmlist, find_first_match_shared_basic) {
+    const char* listname = "/shmlist_find_first_match_shared_basic";
+    unlink(string(shmdir + string(listname)).c_str());
+
+    shmvector_attr_t attr;
+    shmvector_attr_init(&attr);
+    attr.rwlock = true;
+    shmlist_t sl;
+    shmlist_create_attr(&sl, listname, sizeof(char), 16, &attr);
+
+    char ele[5] = "abcd";
+    for (int i = 0; i < 4; i++)
+        shmlist_add_tail_safe(&sl, &ele[i]);
+
+    // Finding an element copies it and leaves it in the list
+    char* item;
+    int rc = shmlist_find_first_match_shared(&sl, ele + 2, basic_char_cmp, (void**)&item);
+    EXPECT_EQ(0, rc);
+    EXPECT_EQ(ele[2], item[0]);
+    EXPECT_EQ(4, shmlist_length(&sl));
+    free(item);
+
+    char nonele = 'z';
+    rc = shmlist_find_first_match_shared(&sl, &nonele, basic_char_cmp, (void**)&item);
+    EXPECT_NE(0, rc);
+
+    shmlist_destroy(&sl);
+}
+
+TEST(shmlist, robust_owner_died_repair) {
+    const char* listname = "/shmlist_robust_owner_died_repair";
+    unlink(string(shmdir + string(listname)).c_str());
+
+    shmvector_attr_t attr;
+    shmvector_attr_init(&attr);
+    attr.lock_type = SHMMUTEX_TYPE_ROBUST;
+    shmlist_t sl;
+    shmlist_create_attr(&sl, listname, sizeof(char), 16, &attr);
+
+    char ele[5] = "abcd";
+    for (int i = 0; i < 3; i++)
+        shmlist_add_tail_safe(&sl, &ele[i]);
+
+    // The child allocates a node and dies before linking it in
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmvector_lock(sl.v);
+        shmvector_insert_quick(sl.v);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    // The orphaned node is released and the list remains usable
+    EXPECT_EQ(0, shmlist_add_tail_safe(&sl, &ele[3]));
+    EXPECT_EQ(4, shmlist_length(&sl));
+    for (int i = 0; i < 4; i++) {
+        char* item;
+        EXPECT_EQ(0, shmlist_extract_head_safe(&sl, (void**)&item));
+        EXPECT_EQ(ele[i], item[0]);
+        free(item);
+    }
+    EXPECT_TRUE(shmlist_is_empty(&sl));
+
+    shmlist_destroy(&sl);
+}
+
+TEST(shmlist, try_timed_ops) {
+    const char* listname = "/shmlist_try_timed_ops";
+    unlink(string(shmdir + string(listname)).c_str());
+
+    shmlist_t sl;
+    shmlist_create(&sl, listname, sizeof(char), 16);
+    char ele[5] = "abcd";
+    struct timespec abstime = deadline_in_ms(1000);
+    EXPECT_EQ(0, shmlist_add_tail_try(&sl, &ele[0]));
+    EXPECT_EQ(0, shmlist_add_tail_timed(&sl, &ele[1], &abstime));
+    EXPECT_EQ(0, shmlist_add_tail_safe(&sl, &ele[2]));
+    EXPECT_EQ(0, shmlist_add_tail_safe(&sl, &ele[3]));
+
+    // Every operation gives up while another holder has the list
+    char* item = NULL;
+    size_t cnt = 7;
+    shmvector_lock(sl.v);
+    EXPECT_EQ(EBUSY, shmlist_add_tail_try(&sl, &ele[0]));
+    EXPECT_EQ(EBUSY, shmlist_extract_head_try(&sl, (void**)&item));
+    EXPECT_EQ(EBUSY, shmlist_extract_first_match_try(&sl, &ele[1], basic_char_cmp, (void**)&item));
+    EXPECT_EQ(EBUSY, shmlist_extract_n_matches_try(&sl, 2, &ele[1], basic_char_cmp, &cnt, (void**)&item));
+    EXPECT_EQ(0u, cnt);
+    shmlist_head(&sl);
+    EXPECT_EQ(EBUSY, shmlist_del_try(&sl));
+    abstime = deadline_in_ms(10);
+    EXPECT_EQ(ETIMEDOUT, shmlist_add_tail_timed(&sl, &ele[0], &abstime));
+    EXPECT_EQ(ETIMEDOUT, shmlist_extract_head_timed(&sl, (void**)&item, &abstime));
+    EXPECT_EQ(ETIMEDOUT, shmlist_del_timed(&sl, &abstime));
+    shmvector_unlock(sl.v);
+    EXPECT_EQ(NULL, item);
+    EXPECT_EQ(4, shmlist_length(&sl));
+
+    // And succeeds once the list is free
+    abstime = deadline_in_ms(1000);
+    EXPECT_EQ(0, shmlist_extract_head_try(&sl, (void**)&item));
+    EXPECT_EQ('a', item[0]);
+    free(item);
+    EXPECT_EQ(0, shmlist_extract_first_match_timed(&sl, &ele[2], basic_char_cmp, (void**)&item, &abstime));
+    EXPECT_EQ('c', item[0]);
+    free(item);
+    EXPECT_EQ(0, shmlist_extract_n_matches_timed(&sl, 2, &ele[3], basic_char_cmp, &cnt, (void**)&item, &abstime));
+    EXPECT_EQ(1u, cnt);
+    free(item);
+    shmlist_head(&sl);
+    EXPECT_EQ(0, shmlist_del_timed(&sl, &abstime));
+    EXPECT_TRUE(shmlist_is_empty(&sl));
+
+    shmlist_destroy(&sl);
+}
+
+/* Test consumers sleep on an empty list until producers add elements */
+TEST(shmlist, extract_head_wait_consumers) {
+    const char* listname = "/shmlist_extract_head_wait";
+    unlink(string(shmdir + string(listname)).c_str());
+
+    shmlist_t sl;
+    shmlist_create(&sl, listname, sizeof(int), 16);
+    int* item = NULL;
+    struct timespec abstime = deadline_in_ms(10);
+    EXPECT_EQ(ETIMEDOUT, shmlist_extract_head_wait(&sl, (void**)&item, &abstime));
+    EXPECT_EQ(NULL, item);
+
+    // Each consumer blocks until it receives one element
+    const int nconsumers = 3;
+    for (int i = 0; i < nconsumers; i++) {
+        if (0 == fork()) {
+            shmlist_t csl;
+            shmlist_create(&csl, listname, sizeof(int), 16);
+            int* got = NULL;
+            struct timespec deadline = deadline_in_ms(10000);
+            int rc = shmlist_extract_head_wait(&csl, (void**)&got, &deadline);
+            int val = (0 == rc && got) ? *got : -1;
+            free(got);
+            shmlist_destroy(&csl);
+            _exit(val);
+        }
+    }
+    while (nconsumers != __atomic_load_n(&sl.v->shm->cond.waiters, __ATOMIC_SEQ_CST))
+        usleep(1000);
+
+    int seen = 0;
+    for (int i = 1; i <= nconsumers; i++)
+        EXPECT_EQ(0, shmlist_add_tail_safe(&sl, &i));
+    for (int i = 0; i < nconsumers; i++) {
+        int status;
+        wait(&status);
+        ASSERT_TRUE(WIFEXITED(status));
+        int val = WEXITSTATUS(status);
+        EXPECT_TRUE(val >= 1 && val <= nconsumers);
+        seen |= 1 << val;
+    }
+    EXPECT_EQ(0xe, seen);
+    EXPECT_TRUE(shmlist_is_empty(&sl));
+
+    shmlist_destroy(&sl);
+}
+
+/* Test that a list refuses a segment that could move */
+TEST(shmlist, create_attr_growable) {
+    const char* listname = "/shmlist_create_attr_growable";
+    unlink(string(shmdir + string(listname)).c_str());
+
+    shmvector_attr_t attr;
+    shmvector_attr_init(&attr);
+    attr.growable = true;
+    shmlist_t sl;
+    EXPECT_EQ(EINVAL, shmlist_create_attr(&sl, listname, sizeof(int), 16, &attr));
+    EXPECT_NE(0, access(string(shmdir + string(listname)).c_str(), F_OK));
+}
@@ -0,0 +1,550 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shm_mutex.h"
+#include "shm_test_util.h"
+using namespace std;
+
+/* Map a zero-filled anonymous region shared with forked children */
+static void* shared_alloc(size_t sz) {
+    void* p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    EXPECT_NE(MAP_FAILED, p);
+    return p;
+}
+
+/* Test the lock state transitions without contention */
+TEST(shmmutex, lock_unlock_uncontended) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+    EXPECT_EQ(0, shmmutex_create(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_AVAILABLE, sm->val);
+
+    EXPECT_EQ(0, shmmutex_lock(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_TAKEN, sm->val);
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_AVAILABLE, sm->val);
+
+    EXPECT_EQ(0, shmmutex_destroy(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test destroying a held lock */
+TEST(shmmutex, destroy_if_locked) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    shmmutex_create(sm);
+
+    // An unlocked mutex cannot be destroyed with destroy_if_locked
+    EXPECT_NE(0, shmmutex_destroy_if_locked(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_AVAILABLE, sm->val);
+
+    shmmutex_lock(sm);
+    EXPECT_EQ(0, shmmutex_destroy_if_locked(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+
+    // A contended mutex can also be destroyed
+    shmmutex_create(sm);
+    shmmutex_lock(sm);
+    sm->val = SHMMUTEX_LOCK_CONTENDED;
+    EXPECT_EQ(0, shmmutex_destroy_if_locked(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Run nprocs processes that each increment a counter iters times under the lock */
+static void run_contended(uint32_t type, int nprocs, int iters) {
+    struct shared { shmmutex_t lock; long count; };
+    struct shared* sh = (struct shared*)shared_alloc(sizeof(struct shared));
+    EXPECT_EQ(0, shmmutex_create_type(&sh->lock, type));
+    EXPECT_EQ(type, sh->lock.type);
+
+    for (int p = 0; p < nprocs; p++) {
+        if (0 == fork()) {
+            for (int i = 0; i < iters; i++) {
+                shmmutex_lock(&sh->lock);
+                sh->count++;
+                shmmutex_unlock(&sh->lock);
+            }
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < nprocs; p++) {
+        int status;
+        wait(&status);
+        EXPECT_EQ(0, WEXITSTATUS(status));
+    }
+    EXPECT_EQ((long)nprocs * iters, sh->count);
+    EXPECT_EQ(SHMMUTEX_LOCK_AVAILABLE, sh->lock.val);
+    munmap(sh, sizeof(struct shared));
+}
+
+/* Test mutual exclusion across processes */
+TEST(shmmutex, lock_contended_processes) {
+    run_contended(SHMMUTEX_TYPE_FUTEX, 4, 20000);
+}
+
+/* Test the spin mutex across processes */
+TEST(shmmutex, spin_contended_processes) {
+    run_contended(SHMMUTEX_TYPE_SPIN, 4, 5000);
+}
+
+/* Test the adaptive mutex across processes */
+TEST(shmmutex, adaptive_contended_processes) {
+    run_contended(SHMMUTEX_TYPE_ADAPTIVE, 4, 20000);
+}
+
+/* Test the ticket mutex across processes */
+TEST(shmmutex, ticket_contended_processes) {
+    run_contended(SHMMUTEX_TYPE_TICKET, 4, 5000);
+}
+
+/* Test that tickets are served in order */
+TEST(shmmutex, ticket_fifo_handoff) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    shmmutex_create_type(sm, SHMMUTEX_TYPE_TICKET);
+    for (uint32_t i = 0; i < 3; i++) {
+        EXPECT_EQ(0, shmmutex_lock(sm));
+        EXPECT_EQ(SHMMUTEX_LOCK_TAKEN, sm->val);
+        EXPECT_EQ(i, sm->serving);
+        EXPECT_EQ(i + 1, sm->ticket);
+        EXPECT_EQ(0, shmmutex_unlock(sm));
+        EXPECT_EQ(SHMMUTEX_LOCK_AVAILABLE, sm->val);
+    }
+    EXPECT_EQ(sm->ticket, sm->serving);
+
+    // Destroying a held ticket mutex leaves it unusable
+    shmmutex_lock(sm);
+    EXPECT_EQ(0, shmmutex_destroy_if_locked(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+
+    // Destroying an available ticket mutex queues behind the owner
+    shmmutex_create_type(sm, SHMMUTEX_TYPE_TICKET);
+    EXPECT_EQ(0, shmmutex_destroy(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test the robust mutex across processes */
+TEST(shmmutex, robust_contended_processes) {
+    run_contended(SHMMUTEX_TYPE_ROBUST, 4, 20000);
+}
+
+/* Test that a lock held by a dead process is recovered */
+TEST(shmmutex, robust_owner_died) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    shmmutex_create_type(sm, SHMMUTEX_TYPE_ROBUST);
+
+    // A child takes the lock and exits without releasing it
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmmutex_lock(sm);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(SHMMUTEX_LOCK_TAKEN, sm->val);
+    EXPECT_NE(0u, sm->owner & FUTEX_OWNER_DIED);
+
+    // The next locker inherits the lock and is told the owner died
+    EXPECT_EQ(EOWNERDEAD, shmmutex_lock(sm));
+    EXPECT_EQ(0u, sm->owner & FUTEX_OWNER_DIED);
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    EXPECT_EQ(0u, sm->owner);
+
+    // Afterwards the lock behaves normally
+    EXPECT_EQ(0, shmmutex_lock(sm));
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    EXPECT_EQ(0, shmmutex_destroy(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test that a sleeping waiter is woken when the owner dies */
+TEST(shmmutex, robust_owner_died_waiter) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    shmmutex_create_type(sm, SHMMUTEX_TYPE_ROBUST);
+    int* go = (int*)shared_alloc(sizeof(int));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmmutex_lock(sm);
+        __atomic_store_n(go, 1, __ATOMIC_SEQ_CST);
+        usleep(50000);
+        _exit(0);
+    }
+    while (0 == __atomic_load_n(go, __ATOMIC_SEQ_CST))
+        sched_yield();
+    EXPECT_EQ(EOWNERDEAD, shmmutex_lock(sm));
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    waitpid(pid, NULL, 0);
+    munmap(go, sizeof(int));
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test that robust mutexes coexist with glibc robust mutexes in one thread */
+TEST(shmmutex, robust_with_pthread_robust) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(2 * sizeof(shmmutex_t));
+    shmmutex_create_type(&sm[0], SHMMUTEX_TYPE_ROBUST);
+    shmmutex_create_type(&sm[1], SHMMUTEX_TYPE_ROBUST);
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_t pm;
+    pthread_mutex_init(&pm, &attr);
+
+    // Interleave acquisition and release so the lists are spliced both ways
+    EXPECT_EQ(0, shmmutex_lock(&sm[0]));
+    EXPECT_EQ(0, pthread_mutex_lock(&pm));
+    EXPECT_EQ(0, shmmutex_lock(&sm[1]));
+    EXPECT_EQ(0, pthread_mutex_unlock(&pm));
+    EXPECT_EQ(0, shmmutex_unlock(&sm[0]));
+    EXPECT_EQ(0, pthread_mutex_lock(&pm));
+    EXPECT_EQ(0, shmmutex_unlock(&sm[1]));
+    EXPECT_EQ(0, pthread_mutex_unlock(&pm));
+
+    pthread_mutex_destroy(&pm);
+    pthread_mutexattr_destroy(&attr);
+    munmap(sm, 2 * sizeof(shmmutex_t));
+}
+
+/* Child processes block on a lock held by the parent, which then destroys it */
+static void check_destroy_waiter(uint32_t type) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    EXPECT_EQ(0, shmmutex_create_type(sm, type));
+    EXPECT_EQ(0, shmmutex_lock(sm));
+
+    for (int p = 0; p < 2; p++) {
+        if (0 == fork()) {
+            // A waiter left asleep is killed instead of hanging the test
+            alarm(10);
+            _exit(shmmutex_lock(sm));
+        }
+    }
+    usleep(50000);
+    EXPECT_EQ(0, shmmutex_destroy_if_locked(sm));
+    for (int p = 0; p < 2; p++) {
+        int status;
+        wait(&status);
+        EXPECT_TRUE(WIFEXITED(status)) << "type " << type;
+        EXPECT_EQ(EINVAL, WEXITSTATUS(status)) << "type " << type;
+    }
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+    EXPECT_EQ(0u, sm->owner);
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test that destroying a robust mutex releases its sleeping waiters */
+TEST(shmmutex, robust_destroy_waiter) {
+    check_destroy_waiter(SHMMUTEX_TYPE_ROBUST);
+}
+
+/* Test that destroying a ticket mutex releases the queued waiters */
+TEST(shmmutex, ticket_destroy_waiter) {
+    check_destroy_waiter(SHMMUTEX_TYPE_TICKET);
+}
+
+/* Test the priority inheritance mutex across processes */
+TEST(shmmutex, pi_contended_processes) {
+    run_contended(SHMMUTEX_TYPE_PI, 4, 20000);
+}
+
+/* Test that the PI lock word holds the owner's TID */
+TEST(shmmutex, pi_owner_tid) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    EXPECT_EQ(0, shmmutex_create_type(sm, SHMMUTEX_TYPE_PI));
+    EXPECT_EQ(0, shmmutex_lock(sm));
+    EXPECT_EQ((uint32_t)gettid(), sm->owner & FUTEX_TID_MASK);
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    EXPECT_EQ(0u, sm->owner);
+    EXPECT_EQ(0, shmmutex_destroy(sm));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm->val);
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test that a PI lock held by a dead process is recovered, with and without a sleeping waiter */
+TEST(shmmutex, pi_owner_died) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    shmmutex_create_type(sm, SHMMUTEX_TYPE_PI);
+
+    // A child takes the lock and exits without releasing it
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmmutex_lock(sm);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    EXPECT_NE(0u, sm->owner & FUTEX_OWNER_DIED);
+    EXPECT_EQ(0u, sm->owner & FUTEX_TID_MASK);
+
+    // The next locker inherits the lock and is told the owner died
+    EXPECT_EQ(EOWNERDEAD, shmmutex_lock(sm));
+    EXPECT_EQ((uint32_t)gettid(), sm->owner);
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    EXPECT_EQ(0u, sm->owner);
+
+    // A waiter asleep in the kernel is handed the lock when the owner dies
+    int* go = (int*)shared_alloc(sizeof(int));
+    pid = fork();
+    if (0 == pid) {
+        shmmutex_lock(sm);
+        __atomic_store_n(go, 1, __ATOMIC_SEQ_CST);
+        usleep(50000);
+        _exit(0);
+    }
+    while (0 == __atomic_load_n(go, __ATOMIC_SEQ_CST))
+        sched_yield();
+    struct timespec abstime = deadline_in_ms(10000);
+    EXPECT_EQ(EOWNERDEAD, shmmutex_timedlock(sm, &abstime));
+    EXPECT_EQ(0u, sm->owner & FUTEX_OWNER_DIED);
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    waitpid(pid, NULL, 0);
+
+    EXPECT_EQ(0, shmmutex_lock(sm));
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    EXPECT_EQ(0, shmmutex_destroy(sm));
+    munmap(go, sizeof(int));
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test that destroying a PI mutex hands it to its waiters, who then fail */
+TEST(shmmutex, pi_destroy_waiter) {
+    check_destroy_waiter(SHMMUTEX_TYPE_PI);
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool set_fifo(int prio) {
+    struct sched_param sp = {0};
+    sp.sched_priority = prio;
+    return 0 == sched_setscheduler(0, SCHED_FIFO, &sp);
+}
+
+/*
+ * Classic priority inversion on one CPU: a low priority process holds the
+ * lock, a high priority process blocks on it and a medium priority process
+ * spins. Returns how long the high priority process waited, in ns.
+ */
+static long long inversion_wait_ns(uint32_t type, long long hold_ns, long long spin_ns) {
+    struct shared { shmmutex_t lock; int held; long long waited; };
+    struct shared* sh = (struct shared*)shared_alloc(sizeof(struct shared));
+    shmmutex_create_type(&sh->lock, type);
+    pid_t pids[3];
+
+    // Low: take the lock and hold it for hold_ns of wall time
+    if (0 == (pids[0] = fork())) {
+        set_fifo(10);
+        shmmutex_lock(&sh->lock);
+        __atomic_store_n(&sh->held, 1, __ATOMIC_SEQ_CST);
+        long long end = now_ns() + hold_ns;
+        while (now_ns() < end);
+        shmmutex_unlock(&sh->lock);
+        _exit(0);
+    }
+    while (0 == __atomic_load_n(&sh->held, __ATOMIC_SEQ_CST))
+        usleep(100);
+
+    // Medium: occupy the CPU without touching the lock
+    if (0 == (pids[1] = fork())) {
+        set_fifo(20);
+        long long end = now_ns() + spin_ns;
+        while (now_ns() < end);
+        _exit(0);
+    }
+
+    // High: measure how long acquiring the lock takes
+    if (0 == (pids[2] = fork())) {
+        set_fifo(30);
+        long long start = now_ns();
+        shmmutex_lock(&sh->lock);
+        sh->waited = now_ns() - start;
+        shmmutex_unlock(&sh->lock);
+        _exit(0);
+    }
+    for (int i = 0; i < 3; i++)
+        waitpid(pids[i], NULL, 0);
+    long long waited = sh->waited;
+    munmap(sh, sizeof(struct shared));
+    return waited;
+}
+
+/* Test that a PI mutex bounds the handoff latency under SCHED_FIFO contention */
+TEST(shmmutex, pi_bounded_handoff_sched_fifo) {
+    // Run every process on one CPU so the medium process can starve the owner
+    cpu_set_t cpus, saved;
+    sched_getaffinity(0, sizeof(saved), &saved);
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+    struct sched_param sp = {0};
+    int policy = sched_getscheduler(0);
+    sched_getparam(0, &sp);
+    if (!set_fifo(40)) {
+        sched_setaffinity(0, sizeof(saved), &saved);
+        GTEST_SKIP() << "SCHED_FIFO is not permitted";
+    }
+
+    const long long hold_ns = 20000000, spin_ns = 300000000;
+    long long pi_wait = inversion_wait_ns(SHMMUTEX_TYPE_PI, hold_ns, spin_ns);
+    long long futex_wait = inversion_wait_ns(SHMMUTEX_TYPE_FUTEX, hold_ns, spin_ns);
+
+    sched_setscheduler(0, policy, &sp);
+    sched_setaffinity(0, sizeof(saved), &saved);
+
+    // The boosted owner finishes its critical section before the spinner runs
+    EXPECT_LT(pi_wait, hold_ns + 50000000);
+    // Without inheritance the waiter is stuck behind the spinner
+    EXPECT_GT(futex_wait, pi_wait);
+    RecordProperty("pi_wait_us", (int)(pi_wait / 1000));
+    RecordProperty("futex_wait_us", (int)(futex_wait / 1000));
+}
+
+/* A child process checks that a lock held by the parent cannot be taken */
+static void check_try_timed(uint32_t type) {
+    shmmutex_t* sm = (shmmutex_t*)shared_alloc(sizeof(shmmutex_t));
+    EXPECT_EQ(0, shmmutex_create_type(sm, type));
+
+    // Uncontended try and timed locks succeed at once
+    EXPECT_EQ(0, shmmutex_trylock(sm));
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    struct timespec soon = deadline_in_ms(1000);
+    EXPECT_EQ(0, shmmutex_timedlock(sm, &soon));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        if (EBUSY != shmmutex_trylock(sm))
+            _exit(1);
+        long long start = now_ns();
+        struct timespec abstime = deadline_in_ms(20);
+        if (ETIMEDOUT != shmmutex_timedlock(sm, &abstime))
+            _exit(2);
+        if (now_ns() - start < 20000000)
+            _exit(3);
+        // The lock is released before this deadline
+        abstime = deadline_in_ms(10000);
+        if (0 != shmmutex_timedlock(sm, &abstime))
+            _exit(4);
+        shmmutex_unlock(sm);
+        _exit(0);
+    }
+    usleep(50000);
+    EXPECT_EQ(0, shmmutex_unlock(sm));
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(0, WEXITSTATUS(status)) << "type " << type;
+    EXPECT_EQ(SHMMUTEX_LOCK_AVAILABLE, sm->val);
+    EXPECT_EQ(0, shmmutex_destroy(sm));
+    munmap(sm, sizeof(shmmutex_t));
+}
+
+/* Test trylock and timedlock for every mutex type */
+TEST(shmmutex, try_timed_all_types) {
+    for (uint32_t type = SHMMUTEX_TYPE_FUTEX; type <= SHMMUTEX_TYPE_PI; type++)
+        check_try_timed(type);
+}
+
+/* Test that a timed lock on an uncreated mutex gives up */
+TEST(shmmutex, timedlock_notready) {
+    shmmutex_t sm = {0};
+    EXPECT_EQ(EBUSY, shmmutex_trylock(&sm));
+    struct timespec abstime = deadline_in_ms(5);
+    EXPECT_EQ(ETIMEDOUT, shmmutex_timedlock(&sm, &abstime));
+}
+
+#ifdef SHMMUTEX_STATS
+static uint64_t hist_total(const shmmutex_stats_counts_t& c) {
+    uint64_t total = 0;
+    for (int b = 0; b < SHMMUTEX_STATS_BUCKETS; b++)
+        total += c.hold_hist[b];
+    return total;
+}
+#endif
+
+/* Test that uncontended acquisitions and hold times are counted */
+TEST(shmmutex, stats_uncontended) {
+#ifndef SHMMUTEX_STATS
+    GTEST_SKIP() << "built without SHMMUTEX_STATS";
+#else
+    struct shared { shmmutex_t lock; shmmutex_stats_t stats; };
+    struct shared* sh = (struct shared*)shared_alloc(sizeof(struct shared));
+    EXPECT_EQ(0, shmmutex_stats_attach(&sh->lock, &sh->stats));
+    EXPECT_EQ(0, shmmutex_create(&sh->lock));
+
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(0, shmmutex_lock(&sh->lock));
+        EXPECT_EQ(0, shmmutex_unlock(&sh->lock));
+    }
+    EXPECT_EQ(0, shmmutex_trylock(&sh->lock));
+    usleep(2000);
+    EXPECT_EQ(0, shmmutex_unlock(&sh->lock));
+
+    shmmutex_stats_counts_t c;
+    EXPECT_EQ(0, shmmutex_stats_read(&sh->stats, &c));
+    EXPECT_EQ(11u, c.acquisitions);
+    EXPECT_EQ(0u, c.contended);
+    EXPECT_EQ(0u, c.futex_waits);
+    EXPECT_EQ(11u, hist_total(c));
+    // The 2ms hold lands in bucket 20 or above
+    uint64_t long_holds = 0;
+    for (int b = 20; b < SHMMUTEX_STATS_BUCKETS; b++)
+        long_holds += c.hold_hist[b];
+    EXPECT_EQ(1u, long_holds);
+    munmap(sh, sizeof(struct shared));
+#endif
+}
+
+/* Test that a waiter records its wait across processes */
+TEST(shmmutex, stats_contended) {
+#ifndef SHMMUTEX_STATS
+    GTEST_SKIP() << "built without SHMMUTEX_STATS";
+#else
+    struct shared { shmmutex_t lock; shmmutex_stats_t stats; };
+    struct shared* sh = (struct shared*)shared_alloc(sizeof(struct shared));
+    shmmutex_stats_attach(&sh->lock, &sh->stats);
+    shmmutex_create(&sh->lock);
+
+    EXPECT_EQ(0, shmmutex_lock(&sh->lock));
+    pid_t pid = fork();
+    if (0 == pid) {
+        shmmutex_lock(&sh->lock);
+        shmmutex_unlock(&sh->lock);
+        _exit(0);
+    }
+    usleep(20000);
+    EXPECT_EQ(0, shmmutex_unlock(&sh->lock));
+    waitpid(pid, NULL, 0);
+
+    shmmutex_stats_counts_t c;
+    EXPECT_EQ(0, shmmutex_stats_read(&sh->stats, &c));
+    EXPECT_EQ(2u, c.acquisitions);
+    EXPECT_EQ(1u, c.contended);
+    EXPECT_LE(1u, c.futex_waits);
+    EXPECT_LE(10000000u, c.max_wait_ns);
+    EXPECT_EQ(c.max_wait_ns, c.wait_ns);
+    EXPECT_EQ(2u, hist_total(c));
+
+    // Detached mutexes record nothing
+    shmmutex_stats_attach(&sh->lock, NULL);
+    shmmutex_lock(&sh->lock);
+    shmmutex_unlock(&sh->lock);
+    shmmutex_stats_read(&sh->stats, &c);
+    EXPECT_EQ(2u, c.acquisitions);
+    munmap(sh, sizeof(struct shared));
+#endif
+}
+
+/* Test that unknown types are rejected */
+TEST(shmmutex, create_type_invalid) {
+    shmmutex_t sm = {0};
+    EXPECT_NE(0, shmmutex_create_type(&sm, 99));
+    EXPECT_EQ(SHMMUTEX_LOCK_NOTREADY, sm.val);
+}
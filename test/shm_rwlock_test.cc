@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shm_rwlock.h"
+#include "shm_test_util.h"
+using namespace std;
+
+/* Test the state word through read and write locking */
+TEST(shmrwlock, lock_unlock_uncontended) {
+    shmrwlock_t rw;
+    EXPECT_EQ(0, shmrwlock_create(&rw));
+    EXPECT_EQ(0u, rw.state);
+
+    // Readers share the lock
+    EXPECT_EQ(0, shmrwlock_rdlock(&rw));
+    EXPECT_EQ(0, shmrwlock_rdlock(&rw));
+    EXPECT_EQ(2u, rw.state & SHMRWLOCK_READERS);
+    EXPECT_EQ(0, shmrwlock_rdunlock(&rw));
+    EXPECT_EQ(0, shmrwlock_rdunlock(&rw));
+    EXPECT_EQ(0u, rw.state);
+
+    // A writer holds it alone
+    EXPECT_EQ(0, shmrwlock_wrlock(&rw));
+    EXPECT_EQ(SHMRWLOCK_WRITER, rw.state);
+    EXPECT_EQ(0, shmrwlock_wrunlock(&rw));
+    EXPECT_EQ(0u, rw.state);
+}
+
+/* Test that readers never observe a half finished write */
+TEST(shmrwlock, readers_and_writers_processes) {
+    struct shared { shmrwlock_t rw; long a; long b; long torn; };
+    const int nreaders = 3, nwriters = 2, iters = 5000;
+    struct shared* sh = (struct shared*)mmap(0, sizeof(struct shared), PROT_READ|PROT_WRITE,
+                                             MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, sh);
+    shmrwlock_create(&sh->rw);
+
+    for (int p = 0; p < nwriters; p++) {
+        if (0 == fork()) {
+            for (int i = 0; i < iters; i++) {
+                shmrwlock_wrlock(&sh->rw);
+                sh->a++;
+                sched_yield();
+                sh->b++;
+                shmrwlock_wrunlock(&sh->rw);
+            }
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < nreaders; p++) {
+        if (0 == fork()) {
+            for (int i = 0; i < iters; i++) {
+                shmrwlock_rdlock(&sh->rw);
+                if (sh->a != sh->b)
+                    __atomic_fetch_add(&sh->torn, 1, __ATOMIC_RELAXED);
+                shmrwlock_rdunlock(&sh->rw);
+            }
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < nreaders + nwriters; p++) {
+        int status;
+        wait(&status);
+        EXPECT_EQ(0, WEXITSTATUS(status));
+    }
+    EXPECT_EQ(0, sh->torn);
+    EXPECT_EQ((long)nwriters * iters, sh->a);
+    EXPECT_EQ((long)nwriters * iters, sh->b);
+    EXPECT_EQ(0u, sh->rw.state);
+    munmap(sh, sizeof(struct shared));
+}
+
+/* Test the try and deadline-bounded lock variants */
+TEST(shmrwlock, try_timed) {
+    shmrwlock_t rw;
+    shmrwlock_create(&rw);
+
+    // Readers exclude writers
+    EXPECT_EQ(0, shmrwlock_tryrdlock(&rw));
+    EXPECT_EQ(0, shmrwlock_tryrdlock(&rw));
+    EXPECT_EQ(EBUSY, shmrwlock_trywrlock(&rw));
+    struct timespec abstime = deadline_in_ms(10);
+    EXPECT_EQ(ETIMEDOUT, shmrwlock_timedwrlock(&rw, &abstime));
+    // A writer that gave up lets readers in again
+    EXPECT_EQ(2u, rw.state & SHMRWLOCK_READERS);
+    EXPECT_EQ(0u, rw.state & SHMRWLOCK_WWAIT);
+    EXPECT_EQ(0u, rw.writers);
+    EXPECT_EQ(0, shmrwlock_tryrdlock(&rw));
+    for (int i = 0; i < 3; i++)
+        EXPECT_EQ(0, shmrwlock_rdunlock(&rw));
+
+    // A writer excludes everyone
+    EXPECT_EQ(0, shmrwlock_trywrlock(&rw));
+    EXPECT_EQ(EBUSY, shmrwlock_tryrdlock(&rw));
+    EXPECT_EQ(EBUSY, shmrwlock_trywrlock(&rw));
+    abstime = deadline_in_ms(10);
+    EXPECT_EQ(ETIMEDOUT, shmrwlock_timedrdlock(&rw, &abstime));
+    EXPECT_EQ(0, shmrwlock_wrunlock(&rw));
+
+    abstime = deadline_in_ms(10);
+    EXPECT_EQ(0, shmrwlock_timedwrlock(&rw, &abstime));
+    EXPECT_EQ(0, shmrwlock_wrunlock(&rw));
+    EXPECT_EQ(0, shmrwlock_timedrdlock(&rw, &abstime));
+    EXPECT_EQ(0, shmrwlock_rdunlock(&rw));
+    EXPECT_EQ(0u, rw.state);
+}
@@ -0,0 +1,19 @@
+/**
+ * Helpers shared by the tests
+ */
+#ifndef SHM_TEST_UTIL_H
+#define SHM_TEST_UTIL_H
+
+#include <time.h>
+
+/* Absolute CLOCK_MONOTONIC deadline ms milliseconds from now */
+static inline struct timespec deadline_in_ms(long ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    ts.tv_sec += ms / 1000 + ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+    return ts;
+}
+
+#endif
@@ -1,11 +1,26 @@
 
 #include <gtest/gtest.h>
 #include <string>
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "shm_vector.h"
+#include "shm_test_util.h"
 using namespace std;
 
 static const string shmdir = "/dev/shm";
 
+/* Read the occupancy bit of idx */
+static bool test_active(shmvector_t* sv, size_t idx) {
+	uint64_t* actives = (uint64_t*)((char*)sv->shm + sv->shm->actives_offset);
+	return (actives[idx / 64] >> (idx % 64)) & 1;
+}
+
 /* Test empty creation */
 TEST(shmvector, create_empty) {
     const char* vecname = "/shmvector_create_empty";
@@ -64,15 +79,44 @@ TEST(shmvector, create_basic) {
 	EXPECT_EQ(24, sv.shm->esize);
 	EXPECT_EQ(0, sv.shm->active_count);
 	EXPECT_EQ(sizeof(shmarray_t), sv.shm->eles_offset);
-	EXPECT_EQ(sizeof(shmarray_t) + 24*1024, sv.shm->actives_offset);
+	EXPECT_EQ(sizeof(shmarray_t) + 24*1024, sv.shm->frees_offset);
+	EXPECT_EQ(sizeof(shmarray_t) + 24*1024 + 8*1024, sv.shm->actives_offset);
+	EXPECT_EQ(sizeof(shmarray_t) + 24*1024 + 8*1024 + 1024/8, (size_t)lseek(sv.segd, 0, SEEK_END));
 
 	for (int i = 0; i < 1024; i++) {
 		EXPECT_EQ(0, *( ((char*)sv.shm + sv.shm->eles_offset) + i*24));
-		EXPECT_EQ(false, ((bool*)((char*)sv.shm + sv.shm->actives_offset))[i]);
+		EXPECT_EQ(false, test_active(&sv, i));
 	}
 	shmvector_destroy(&sv);
 }
 
+/* Test creation with a non-default lock type */
+TEST(shmvector, create_attr_lock_type) {
+    const char* vecname = "/shmvector_create_attr_lock_type";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	shmvector_attr_t attr;
+	shmvector_attr_init(&attr);
+	EXPECT_EQ(SHMMUTEX_DEFAULT_TYPE, attr.lock_type);
+	attr.lock_type = SHMMUTEX_TYPE_ADAPTIVE;
+
+	shmvector_t sv1, sv2;
+	EXPECT_EQ(0, shmvector_create_attr(&sv1, vecname, sizeof(int), 16, &attr));
+	EXPECT_EQ(SHMMUTEX_TYPE_ADAPTIVE, sv1.shm->lock.type);
+	EXPECT_EQ(SHMMUTEX_LOCK_AVAILABLE, sv1.shm->lock.val);
+
+	/* Attaching processes keep the creator's lock type */
+	EXPECT_EQ(0, shmvector_create(&sv2, vecname, sizeof(int), 16));
+	EXPECT_EQ(SHMMUTEX_TYPE_ADAPTIVE, sv2.shm->lock.type);
+
+	int val = 42;
+	EXPECT_EQ(0, shmvector_safe_push_back(&sv2, &val));
+	EXPECT_EQ(42, *(int*)shmvector_safe_at(&sv1, 0));
+
+	shmvector_destroy_safe(&sv2);
+	shmvector_destroy_safe(&sv1);
+}
+
 /* Allocate the same vector twice to confirm values are shared */
 TEST(shmvector, create_shared) {
     const char* vecname = "/shmvector_create_shared";
@@ -89,7 +133,8 @@ TEST(shmvector, create_shared) {
 	EXPECT_EQ(24, sv1.shm->esize);
 	EXPECT_EQ(0, sv1.shm->active_count);
 	EXPECT_EQ(sizeof(shmarray_t), sv1.shm->eles_offset);
-	EXPECT_EQ(sizeof(shmarray_t) + 24*1024, sv1.shm->actives_offset);
+	EXPECT_EQ(sizeof(shmarray_t) + 24*1024, sv1.shm->frees_offset);
+	EXPECT_EQ(sizeof(shmarray_t) + 24*1024 + 8*1024, sv1.shm->actives_offset);
 
 	/* Confirm the second shared vector has the same contents as the first */
 	rc2 = shmvector_create(&sv2, vecname, 24, 1024);
@@ -118,7 +163,6 @@ TEST(shmvector, push_back_safe_simple) {
 	shmvector_t sv1;
 	rc1 = shmvector_create(&sv1, vecname, sizeof(double), 3);
 	double* eles = (double*)((char*)sv1.shm + sv1.shm->eles_offset);
-	bool* actives = (bool*)((char*)sv1.shm + sv1.shm->actives_offset);
 	EXPECT_EQ(0, rc1);
 	EXPECT_NE((char*)NULL, sv1.segname);
 	EXPECT_EQ(3, sv1.shm->capacity);
@@ -129,27 +173,27 @@ TEST(shmvector, push_back_safe_simple) {
 	EXPECT_EQ(3, sv1.shm->capacity);
 	EXPECT_EQ(1, sv1.shm->active_count);
 	EXPECT_EQ(val, eles[0]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(false, actives[1]);
-	EXPECT_EQ(false, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(false, test_active(&sv1, 1));
+	EXPECT_EQ(false, test_active(&sv1, 2));
 
 	val = 777.77;
 	rc1 = shmvector_safe_push_back(&sv1, &val);
 	EXPECT_EQ(3, sv1.shm->capacity);
 	EXPECT_EQ(2, sv1.shm->active_count);
 	EXPECT_EQ(val, eles[1]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(true, actives[1]);
-	EXPECT_EQ(false, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(true, test_active(&sv1, 1));
+	EXPECT_EQ(false, test_active(&sv1, 2));
 
 	val = 1.0;
 	rc1 = shmvector_safe_push_back(&sv1, &val);
 	EXPECT_EQ(3, sv1.shm->capacity);
 	EXPECT_EQ(3, sv1.shm->active_count);
 	EXPECT_EQ(val, eles[2]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(true, actives[1]);
-	EXPECT_EQ(true, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(true, test_active(&sv1, 1));
+	EXPECT_EQ(true, test_active(&sv1, 2));
 
 	shmvector_destroy(&sv1);
 
@@ -167,7 +211,6 @@ TEST(shmvector, push_back_safe_shared) {
 	double val1 = 1234.1234;
 	rc1 = shmvector_create(&sv1, vecname, sizeof(double), 3);
 	double* eles = (double*)((char*)sv1.shm + sv1.shm->eles_offset);
-	bool* actives = (bool*)((char*)sv1.shm + sv1.shm->actives_offset);
 	EXPECT_EQ(0, rc1);
 	EXPECT_NE((char*)NULL, sv1.segname);
 	EXPECT_EQ(3, sv1.shm->capacity);
@@ -180,9 +223,9 @@ TEST(shmvector, push_back_safe_shared) {
 	EXPECT_EQ(val1, eles[0]);
 	EXPECT_EQ(0.0, eles[1]);
 	EXPECT_EQ(0.0, eles[2]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(false, actives[1]);
-	EXPECT_EQ(false, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(false, test_active(&sv1, 1));
+	EXPECT_EQ(false, test_active(&sv1, 2));
 
 	/* Create a second shared vector and push an element onto that */
 	double val2 = 777.77;
@@ -199,9 +242,9 @@ TEST(shmvector, push_back_safe_shared) {
 	EXPECT_EQ(val1, eles[0]);
 	EXPECT_EQ(val2, eles[1]);
 	EXPECT_EQ(0.0, eles[2]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(true, actives[1]);
-	EXPECT_EQ(false, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(true, test_active(&sv1, 1));
+	EXPECT_EQ(false, test_active(&sv1, 2));
 
 	/* Create a 3rd vector and verify early values plus a new value */
 	double val3 = 1.0;
@@ -218,9 +261,9 @@ TEST(shmvector, push_back_safe_shared) {
 	EXPECT_EQ(val1, eles[0]);
 	EXPECT_EQ(val2, eles[1]);
 	EXPECT_EQ(val3, eles[2]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(true, actives[1]);
-	EXPECT_EQ(true, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(true, test_active(&sv1, 1));
+	EXPECT_EQ(true, test_active(&sv1, 2));
 
 	/* Confirm the first 2 instances have the same data as the third */
 	EXPECT_EQ(3, sv1.shm->capacity);
@@ -228,18 +271,18 @@ TEST(shmvector, push_back_safe_shared) {
 	EXPECT_EQ(val1, eles[0]);
 	EXPECT_EQ(val2, eles[1]);
 	EXPECT_EQ(val3, eles[2]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(true, actives[1]);
-	EXPECT_EQ(true, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(true, test_active(&sv1, 1));
+	EXPECT_EQ(true, test_active(&sv1, 2));
 
 	EXPECT_EQ(3, sv2.shm->capacity);
 	EXPECT_EQ(3, sv2.shm->active_count);
 	EXPECT_EQ(val1, eles[0]);
 	EXPECT_EQ(val2, eles[1]);
 	EXPECT_EQ(val3, eles[2]);
-	EXPECT_EQ(true, actives[0]);
-	EXPECT_EQ(true, actives[1]);
-	EXPECT_EQ(true, actives[2]);
+	EXPECT_EQ(true, test_active(&sv1, 0));
+	EXPECT_EQ(true, test_active(&sv1, 1));
+	EXPECT_EQ(true, test_active(&sv1, 2));
 
 	/* Destroy all 3 shared instances */
 	shmvector_destroy(&sv1);
@@ -455,6 +498,524 @@ TEST(shmvector, find_first_of_double) {
 	shmvector_destroy(&sv);
 }
 
+/* Test reader-side access to a reader-writer locked vector */
+TEST(shmvector, rwlock_shared_readers) {
+    const char* vecname = "/shmvector_rwlock_shared_readers";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	shmvector_attr_t attr;
+	shmvector_attr_init(&attr);
+	attr.rwlock = true;
+	shmvector_t sv;
+	EXPECT_EQ(0, shmvector_create_attr(&sv, vecname, sizeof(char), 8, &attr));
+	EXPECT_EQ(SHMVECTOR_FLAG_RWLOCK, sv.shm->flags & SHMVECTOR_FLAG_RWLOCK);
+
+	char ele = 'q';
+	EXPECT_EQ(0, shmvector_safe_push_back(&sv, &ele));
+	EXPECT_EQ(0u, sv.shm->rwlock.state);
+
+	// Readers can hold the segment concurrently
+	EXPECT_EQ(0, shmvector_lock_shared(&sv));
+	EXPECT_EQ('q', *(char*)shmvector_safe_at_shared(&sv, 0));
+	EXPECT_EQ(1u, sv.shm->rwlock.state & SHMRWLOCK_READERS);
+	EXPECT_EQ(0, shmvector_unlock_shared(&sv));
+	EXPECT_EQ(NULL, shmvector_safe_at_shared(&sv, 1));
+
+	char nonele = 'z';
+	EXPECT_EQ(0, shmvector_find_first_of_shared(&sv, &ele, test_charcmp));
+	EXPECT_EQ(-1, shmvector_find_first_of_shared(&sv, &nonele, test_charcmp));
+	EXPECT_EQ(0u, sv.shm->rwlock.state);
+
+	shmvector_destroy_safe(&sv);
+}
+
+/* Test that a robust segment is repaired when its lock owner dies */
+TEST(shmvector, robust_owner_died_repair) {
+    const char* vecname = "/shmvector_robust_owner_died_repair";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	shmvector_attr_t attr;
+	shmvector_attr_init(&attr);
+	attr.lock_type = SHMMUTEX_TYPE_ROBUST;
+	shmvector_t sv;
+	EXPECT_EQ(0, shmvector_create_attr(&sv, vecname, sizeof(char), 8, &attr));
+	char ele = 'r';
+	EXPECT_EQ(0, shmvector_safe_push_back(&sv, &ele));
+	EXPECT_EQ(1, shmvector_safe_push_back(&sv, &ele));
+
+	// The child dies half way through an update
+	pid_t pid = fork();
+	if (0 == pid) {
+		shmvector_lock(&sv);
+		sv.shm->active_count = 7;
+		sv.shm->next_back_idx = 1;
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+
+	EXPECT_EQ(0, shmvector_lock(&sv));
+	EXPECT_EQ(2u, shmvector_size(&sv));
+	EXPECT_EQ(2u, sv.shm->next_back_idx);
+	EXPECT_EQ(0, shmvector_unlock(&sv));
+	EXPECT_EQ(2, shmvector_safe_push_back(&sv, &ele));
+
+	shmvector_destroy_safe(&sv);
+}
+
+/* Test that the try and timed operations give up while the segment is locked */
+TEST(shmvector, try_timed_ops) {
+    const char* vecname = "/shmvector_try_timed_ops";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	shmvector_t sv;
+	EXPECT_EQ(0, shmvector_create(&sv, vecname, sizeof(char), 2));
+	char ele = 't';
+	struct timespec abstime = deadline_in_ms(1000);
+	EXPECT_EQ(0, shmvector_safe_push_back_try(&sv, &ele));
+	EXPECT_EQ(1, shmvector_safe_push_back_timed(&sv, &ele, &abstime));
+	EXPECT_EQ(-1, shmvector_safe_push_back_try(&sv, &ele));
+	EXPECT_EQ('t', *(char*)shmvector_safe_at_try(&sv, 1));
+	EXPECT_EQ('t', *(char*)shmvector_safe_at_timed(&sv, 0, &abstime));
+
+	EXPECT_EQ(0, shmvector_lock(&sv));
+	EXPECT_EQ(EBUSY, shmvector_trylock(&sv));
+	EXPECT_EQ(-EBUSY, shmvector_safe_push_back_try(&sv, &ele));
+	errno = 0;
+	EXPECT_EQ(NULL, shmvector_safe_at_try(&sv, 0));
+	EXPECT_EQ(EBUSY, errno);
+	abstime = deadline_in_ms(10);
+	EXPECT_EQ(-ETIMEDOUT, shmvector_safe_push_back_timed(&sv, &ele, &abstime));
+	EXPECT_EQ(NULL, shmvector_safe_at_timed(&sv, 0, &abstime));
+	EXPECT_EQ(ETIMEDOUT, errno);
+	EXPECT_EQ(0, shmvector_unlock(&sv));
+	EXPECT_EQ(2u, shmvector_size(&sv));
+
+	shmvector_destroy_safe(&sv);
+}
+
+/* Test reading segment lock statistics from an unattached process */
+TEST(shmvector, stats_by_name) {
+    const char* vecname = "/shmvector_stats_by_name";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	shmvector_attr_t attr;
+	shmvector_attr_init(&attr);
+	attr.stats = true;
+	shmvector_t sv;
+	EXPECT_EQ(0, shmvector_create_attr(&sv, vecname, sizeof(char), 8, &attr));
+	char ele = 's';
+	for (int i = 0; i < 3; i++)
+		shmvector_safe_push_back(&sv, &ele);
+
+	shmmutex_stats_counts_t c, byname;
+#ifdef SHMMUTEX_STATS
+	EXPECT_EQ(0, shmvector_stats(&sv, &c));
+	EXPECT_EQ(3u, c.acquisitions);
+	EXPECT_EQ(0u, c.contended);
+
+	// A monitor maps the segment read-only and sees the same totals
+	pid_t pid = fork();
+	if (0 == pid) {
+		if (0 != shmvector_stats_by_name(vecname, &byname) || byname.acquisitions != 3)
+			_exit(1);
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	EXPECT_EQ(0, WEXITSTATUS(status));
+	// The monitor did not take a reference
+	EXPECT_EQ(1u, sv.shm->ref_count);
+	EXPECT_NE(0, shmvector_stats_by_name("/shmvector_stats_missing", &byname));
+
+	// Segments record statistics only when asked to
+	const char* plainname = "/shmvector_stats_by_name_plain";
+	unlink(string(shmdir + string(plainname)).c_str());
+	shmvector_t plain;
+	EXPECT_EQ(0, shmvector_create(&plain, plainname, sizeof(char), 8));
+	EXPECT_EQ(ENOTSUP, shmvector_stats(&plain, &c));
+	EXPECT_EQ(ENOTSUP, shmvector_stats_by_name(plainname, &byname));
+	shmvector_destroy_safe(&plain);
+#else
+	EXPECT_EQ(ENOTSUP, shmvector_stats(&sv, &c));
+#endif
+
+	shmvector_destroy_safe(&sv);
+}
+
+/* Test lock-free readers always see consistent bookkeeping */
+TEST(shmvector, header_snapshot_consistent) {
+    const char* vecname = "/shmvector_header_snapshot";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	const size_t count = 200000;
+	shmvector_t sv;
+	EXPECT_EQ(0, shmvector_create(&sv, vecname, sizeof(char), count));
+	shmvector_header_t hdr;
+	shmvector_header(&sv, &hdr);
+	EXPECT_EQ(count, hdr.capacity);
+	EXPECT_EQ(0u, hdr.next_back_idx);
+	EXPECT_EQ(0u, hdr.active_count);
+
+	// push_back moves next_back_idx and active_count together
+	pid_t pid = fork();
+	if (0 == pid) {
+		shmvector_t child;
+		shmvector_create(&child, vecname, sizeof(char), count);
+		char ele = 'h';
+		for (size_t i = 0; i < count; i++)
+			shmvector_safe_push_back(&child, &ele);
+		shmvector_destroy_safe(&child);
+		_exit(0);
+	}
+	size_t torn = 0, reads = 0;
+	while (0 == waitpid(pid, NULL, WNOHANG)) {
+		shmvector_header(&sv, &hdr);
+		if (hdr.active_count != hdr.next_back_idx || hdr.capacity != count)
+			torn++;
+		reads++;
+	}
+	EXPECT_EQ(0u, torn);
+	EXPECT_LT(0u, reads);
+
+	shmvector_header(&sv, &hdr);
+	EXPECT_EQ(count, hdr.next_back_idx);
+	EXPECT_EQ(count, shmvector_size(&sv));
+	EXPECT_EQ(0u, sv.shm->seq & 1);
+	EXPECT_NE(nullptr, shmvector_at(&sv, count - 1));
+	shmvector_destroy_safe(&sv);
+}
+
+/* Test the header regions are cache line aligned and versions are checked */
+TEST(shmvector, layout_version) {
+    const char* vecname = "/shmvector_layout_version";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	// Geometry, lock, counters and elements each start a cache line
+	EXPECT_EQ(0u, offsetof(shmarray_t, version));
+	EXPECT_EQ(0u, offsetof(shmarray_t, lock) % SHMVECTOR_CACHELINE);
+	EXPECT_LE(offsetof(shmarray_t, actives_offset) + sizeof(size_t), offsetof(shmarray_t, lock));
+	EXPECT_EQ(0u, offsetof(shmarray_t, seq) % SHMVECTOR_CACHELINE);
+	EXPECT_LE(offsetof(shmarray_t, rwlock) + sizeof(shmrwlock_t), offsetof(shmarray_t, seq));
+	EXPECT_EQ(0u, sizeof(shmarray_t) % SHMVECTOR_CACHELINE);
+
+	shmvector_t sv;
+	EXPECT_EQ(0, shmvector_create(&sv, vecname, sizeof(double), 16));
+	EXPECT_EQ((uint32_t)SHMVECTOR_FORMAT_VERSION, sv.shm->version);
+	EXPECT_EQ(0u, ((uintptr_t)sv.shm + sv.shm->eles_offset) % SHMVECTOR_CACHELINE);
+	shmvector_destroy_safe(&sv);
+
+	// A segment written with another layout is refused
+	int fd = shm_open(vecname, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+	ASSERT_NE(-1, fd);
+	ASSERT_EQ(0, ftruncate(fd, sizeof(shmarray_t)));
+	shmarray_t* old = (shmarray_t*)mmap(0, sizeof(shmarray_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	ASSERT_NE(MAP_FAILED, (void*)old);
+	old->version = 1;
+	shmmutex_create(&old->lock);
+	EXPECT_NE(0, shmvector_create(&sv, vecname, sizeof(double), 16));
+
+	// So is one whose header was sized by a build with another configuration
+	old->version = SHMVECTOR_FORMAT_VERSION;
+	old->header_size = sizeof(shmarray_t) - sizeof(shmmutex_stats_t);
+	shmmutex_stats_counts_t byname;
+	EXPECT_NE(0, shmvector_create(&sv, vecname, sizeof(double), 16));
+	EXPECT_EQ(1, shmvector_stats_by_name(vecname, &byname));
+	old->header_size = sizeof(shmarray_t);
+	EXPECT_EQ(ENOTSUP, shmvector_stats_by_name(vecname, &byname));
+	munmap(old, sizeof(shmarray_t));
+	close(fd);
+	shm_unlink(vecname);
+}
+
+/* Test a growable vector doubling while other processes read it */
+TEST(shmvector, grow_processes) {
+    const char* vecname = "/shmvector_grow_processes";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	const size_t count = 20000;
+	const int nreaders = 2;
+	shmvector_attr_t attr;
+	shmvector_attr_init(&attr);
+	attr.growable = true;
+	shmvector_t sv;
+	ASSERT_EQ(0, shmvector_create_attr(&sv, vecname, sizeof(size_t), 4, &attr));
+	for (size_t i = 0; i < 4; i++) {
+		size_t ele = i * 7;
+		ASSERT_EQ((int)i, shmvector_safe_push_back(&sv, &ele));
+	}
+
+	// Readers map the small segment, then follow it through every doubling
+	pid_t pids[nreaders];
+	for (int r = 0; r < nreaders; r++) {
+		pids[r] = fork();
+		if (0 == pids[r]) {
+			shmvector_t child;
+			shmvector_create_attr(&child, vecname, sizeof(size_t), 4, &attr);
+			int bad = 0;
+			size_t size;
+			do {
+				size = shmvector_size(&child);
+				for (size_t i = 0; i < size; i++) {
+					size_t* ele = (size_t*)shmvector_at(&child, i);
+					if (NULL == ele || *ele != i * 7)
+						bad = 1;
+				}
+			} while (size < count);
+			if (child.map_size < sizeof(shmarray_t) + count * (sizeof(size_t) + sizeof(bool)))
+				bad = 1;
+			shmvector_destroy_safe(&child);
+			_exit(bad);
+		}
+	}
+	for (size_t i = 4; i < count; i++) {
+		size_t ele = i * 7;
+		ASSERT_EQ((int)i, shmvector_safe_push_back(&sv, &ele));
+	}
+	for (int r = 0; r < nreaders; r++) {
+		int status;
+		ASSERT_EQ(pids[r], waitpid(pids[r], &status, 0));
+		EXPECT_TRUE(WIFEXITED(status));
+		EXPECT_EQ(0, WEXITSTATUS(status));
+	}
+
+	shmvector_header_t hdr;
+	shmvector_header(&sv, &hdr);
+	EXPECT_EQ(32768u, hdr.capacity);
+	EXPECT_EQ(count, hdr.active_count);
+	EXPECT_EQ(13u, sv.shm->map_gen);
+
+	// Explicit growth keeps deleted slots and elements at their indices
+	shmvector_lock(&sv);
+	EXPECT_EQ(0, shmvector_del(&sv, 1));
+	EXPECT_EQ(0, shmvector_grow_array(&sv));
+	EXPECT_EQ(1u, sv.shm->free_count);
+	EXPECT_EQ(65536u, sv.shm->capacity);
+	EXPECT_EQ(nullptr, shmvector_at(&sv, 1));
+	EXPECT_EQ(14u, *(size_t*)shmvector_at(&sv, 2));
+	EXPECT_EQ(count - 1, *(size_t*)shmvector_at(&sv, count - 1) / 7);
+	EXPECT_EQ(1, shmvector_insert_quick(&sv));
+	EXPECT_EQ((int)count, shmvector_insert_quick(&sv));
+	shmvector_unlock(&sv);
+	shmvector_destroy_safe(&sv);
+}
+
+/* Test insert_quick reuses deleted slots from the free slot stack */
+TEST(shmvector, insert_quick_free_stack) {
+    const char* vecname = "/shmvector_insert_quick_free_stack";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	shmvector_t sv;
+	ASSERT_EQ(0, shmvector_create(&sv, vecname, sizeof(char), 16));
+	for (int i = 0; i < 8; i++)
+		EXPECT_EQ(i, shmvector_insert_quick(&sv));
+
+	// The most recently deleted slot is reused first
+	EXPECT_EQ(0, shmvector_del(&sv, 2));
+	EXPECT_EQ(0, shmvector_del(&sv, 6));
+	EXPECT_EQ(0, shmvector_del(&sv, 5));
+	EXPECT_EQ(-1, shmvector_del(&sv, 5));
+	EXPECT_EQ(3u, sv.shm->free_count);
+	EXPECT_EQ(5, shmvector_insert_quick(&sv));
+	EXPECT_EQ(6, shmvector_insert_quick(&sv));
+	EXPECT_EQ(2, shmvector_insert_quick(&sv));
+	EXPECT_EQ(8, shmvector_insert_quick(&sv));
+
+	// insert_at takes its slot off the stack, and leaves the skipped slots on it
+	char ele = 'x';
+	EXPECT_EQ(0, shmvector_del(&sv, 3));
+	EXPECT_EQ(0, shmvector_del(&sv, 4));
+	EXPECT_EQ(3, shmvector_insert_at(&sv, 3, &ele));
+	EXPECT_EQ(12, shmvector_insert_at(&sv, 12, &ele));
+	EXPECT_EQ(4u, sv.shm->free_count);
+	EXPECT_EQ(11, shmvector_insert_quick(&sv));
+	EXPECT_EQ(10, shmvector_insert_quick(&sv));
+	EXPECT_EQ(9, shmvector_insert_quick(&sv));
+	EXPECT_EQ(4, shmvector_insert_quick(&sv));
+	EXPECT_EQ(13, shmvector_insert_quick(&sv));
+
+	// Repair rebuilds the stack from the actives array
+	EXPECT_EQ(0, shmvector_del(&sv, 7));
+	EXPECT_EQ(0, shmvector_del(&sv, 1));
+	sv.shm->free_count = 0;
+	shmvector_repair(&sv);
+	EXPECT_EQ(2u, sv.shm->free_count);
+	EXPECT_EQ(7, shmvector_insert_quick(&sv));
+	EXPECT_EQ(1, shmvector_insert_quick(&sv));
+	EXPECT_EQ(14, shmvector_insert_quick(&sv));
+	EXPECT_EQ(15, shmvector_insert_quick(&sv));
+	EXPECT_EQ(-1, shmvector_insert_quick(&sv));
+	EXPECT_EQ(16u, shmvector_size(&sv));
+
+	// Growing moves the stack and the actives array over their old places
+	EXPECT_EQ(0, shmvector_del(&sv, 3));
+	EXPECT_EQ(0, shmvector_grow_array(&sv));
+	EXPECT_EQ(32u, sv.shm->capacity);
+	EXPECT_EQ(1u, sv.shm->free_count);
+	for (int i = 0; i < 16; i++)
+		EXPECT_EQ(3 != i, NULL != shmvector_at(&sv, i));
+	EXPECT_EQ(3, shmvector_insert_quick(&sv));
+	EXPECT_EQ(16, shmvector_insert_quick(&sv));
+	EXPECT_EQ(nullptr, shmvector_at(&sv, 17));
+	shmvector_destroy(&sv);
+}
+
+/* Test iterating a sparse vector through the occupancy bitmap */
+TEST(shmvector, next_sparse_bitmap) {
+    const char* vecname = "/shmvector_next_sparse_bitmap";
+    unlink(string(shmdir + string(vecname)).c_str());
 
+	shmvector_t sv;
+	ASSERT_EQ(0, shmvector_create(&sv, vecname, sizeof(char), 1000));
+	EXPECT_EQ(-1, shmvector_next(&sv, 0));
+	size_t idxs[] = {3, 64, 127, 128, 700, 999};
+	for (size_t i = 0; i < 6; i++) {
+		char ele = 'a' + i;
+		EXPECT_EQ((int)idxs[i], shmvector_insert_at(&sv, idxs[i], &ele));
+	}
+	int expect = 0;
+	for (int i = shmvector_next(&sv, 0); i >= 0; i = shmvector_next(&sv, i + 1))
+		EXPECT_EQ((int)idxs[expect++], i);
+	EXPECT_EQ(6, expect);
+	EXPECT_EQ(128, shmvector_next(&sv, 128));
+	EXPECT_EQ(-1, shmvector_next(&sv, 1000));
+	char ele = 'e';
+	EXPECT_EQ(700, shmvector_find_first_of(&sv, &ele, test_charcmp));
+
+	// Repair recounts from the bitmap
+	EXPECT_EQ(0, shmvector_del(&sv, 999));
+	sv.shm->active_count = 0;
+	sv.shm->next_back_idx = 0;
+	shmvector_repair(&sv);
+	EXPECT_EQ(5u, shmvector_size(&sv));
+	EXPECT_EQ(701u, sv.shm->next_back_idx);
+	EXPECT_EQ(696u, sv.shm->free_count);
+	shmvector_destroy(&sv);
+}
+
+/* Test huge page segments, which fall back when no huge pages are available */
+TEST(shmvector, huge_pages) {
+    const char* vecname = "/shmvector_huge_pages";
+    unlink(string(shmdir + string(vecname)).c_str());
 
+	size_t sizes[] = {SHMVECTOR_PAGE_2M, SHMVECTOR_PAGE_1G};
+	for (size_t s = 0; s < 2; s++) {
+		shmvector_attr_t attr;
+		shmvector_attr_init(&attr);
+		attr.page_size = sizes[s];
+		attr.growable = true;
+		attr.stats = true;
+		shmvector_t sv;
+		ASSERT_EQ(0, shmvector_create_attr(&sv, vecname, sizeof(size_t), 1000, &attr));
+		size_t page = shmvector_page_size(&sv);
+		if (sv.shm->flags & SHMVECTOR_FLAG_HUGETLB) {
+			EXPECT_EQ(sizes[s], page);
+			EXPECT_NE(nullptr, sv.hugetlb_path);
+		} else {
+			EXPECT_EQ(nullptr, sv.hugetlb_path);
+			EXPECT_NE(0u, sv.shm->flags & SHMVECTOR_FLAG_THP);
+			EXPECT_EQ(SHMVECTOR_PAGE_2M, page);
+		}
+		EXPECT_EQ(0u, sv.map_size % page);
+		for (size_t i = 0; i < 1000; i++)
+			EXPECT_EQ((int)i, shmvector_push_back(&sv, &i));
+
+		// A monitor finds the segment wherever it lives
+		shmmutex_stats_counts_t byname;
+#ifdef SHMMUTEX_STATS
+		EXPECT_EQ(0, shmvector_stats_by_name(vecname, &byname));
+#else
+		EXPECT_EQ(ENOTSUP, shmvector_stats_by_name(vecname, &byname));
+#endif
+
+		// Another process finds the same segment, and sees it grow
+		pid_t pid = fork();
+		if (0 == pid) {
+			shmvector_t child;
+			int bad = shmvector_create_attr(&child, vecname, sizeof(size_t), 1000, &attr);
+			for (size_t i = 0; i < 1000 && !bad; i++)
+				bad = (NULL == shmvector_at(&child, i) || i != *(size_t*)shmvector_at(&child, i));
+			bad |= (page != shmvector_page_size(&child));
+			size_t ele = 1000;
+			bad |= (1000 != shmvector_safe_push_back(&child, &ele));
+			shmvector_destroy_safe(&child);
+			_exit(bad);
+		}
+		int status;
+		ASSERT_EQ(pid, waitpid(pid, &status, 0));
+		EXPECT_EQ(0, WEXITSTATUS(status));
+		EXPECT_EQ(1000u, *(size_t*)shmvector_at(&sv, 1000));
+		EXPECT_EQ(2000u, sv.shm->capacity);
+		EXPECT_EQ(0u, sv.map_size % page);
+		shmvector_destroy_safe(&sv);
+		EXPECT_NE(0, access(string(shmdir + string(vecname)).c_str(), F_OK));
+	}
+}
 
+/* Count the resident pages of a mapping */
+static size_t test_resident_pages(void* addr, size_t len) {
+	size_t page = sysconf(_SC_PAGESIZE), pages = (len + page - 1) / page, resident = 0;
+	vector<unsigned char> vec(pages);
+	if (0 != mincore(addr, len, vec.data()))
+		return 0;
+	for (size_t i = 0; i < pages; i++)
+		resident += vec[i] & 1;
+	return resident;
+}
+
+/* Read the locked memory of this process in kB */
+static size_t test_locked_kb() {
+	FILE* f = fopen("/proc/self/status", "r");
+	char line[256];
+	size_t kb = 0;
+	while (NULL != f && NULL != fgets(line, sizeof(line), f))
+		sscanf(line, "VmLck: %zu kB", &kb);
+	if (NULL != f)
+		fclose(f);
+	return kb;
+}
+
+/* Test segments are faulted in and locked on create, attach and growth when asked */
+TEST(shmvector, prefault_mlock) {
+    const char* vecname = "/shmvector_prefault_mlock";
+    unlink(string(shmdir + string(vecname)).c_str());
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	const size_t count = 1 << 18;
+	shmvector_t lazy;
+	ASSERT_EQ(0, shmvector_create(&lazy, vecname, sizeof(char), count));
+	EXPECT_GT((lazy.map_size + page - 1) / page, test_resident_pages(lazy.shm, lazy.map_size) + 32);
+	shmvector_destroy(&lazy);
+
+	shmvector_attr_t attr;
+	shmvector_attr_init(&attr);
+	attr.prefault = true;
+	attr.mlock = true;
+	attr.prefault_threads = 4;
+	attr.growable = true;
+	size_t locked = test_locked_kb();
+	shmvector_t sv;
+	ASSERT_EQ(0, shmvector_create_attr(&sv, vecname, sizeof(char), count, &attr));
+	size_t pages = (sv.map_size + page - 1) / page;
+	EXPECT_EQ(pages, test_resident_pages(sv.shm, sv.map_size));
+	EXPECT_LE(locked + sv.map_size / 1024, test_locked_kb());
+
+	pid_t pid = fork();
+	if (0 == pid) {
+		shmvector_t child;
+		int bad = shmvector_create_attr(&child, vecname, sizeof(char), count, &attr);
+		bad |= (pages != test_resident_pages(child.shm, child.map_size));
+		bad |= (child.map_size / 1024 > test_locked_kb());
+		shmvector_destroy_safe(&child);
+		_exit(bad);
+	}
+	int status;
+	ASSERT_EQ(pid, waitpid(pid, &status, 0));
+	EXPECT_EQ(0, WEXITSTATUS(status));
+
+	// The part added by growth is faulted in as well
+	shmvector_lock(&sv);
+	EXPECT_EQ(0, shmvector_grow_array(&sv));
+	shmvector_unlock(&sv);
+	EXPECT_EQ((sv.map_size + page - 1) / page, test_resident_pages(sv.shm, sv.map_size));
+	shmvector_destroy_safe(&sv);
+}